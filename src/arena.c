@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "nprofilerlib.h"
+
+/**
+ * Arenas and interned strings.
+ *
+ * An arena hands out memory from big chunks by bumping an offset, and frees
+ * all of it at once. Resetting it only rewinds to the first chunk, so the
+ * chunks are reused by the next batch of allocations, e.g., the names of the
+ * next scores file loaded.
+ *
+ * A string set keeps a single copy of each distinct string, in an arena, and
+ * indexes them in an open addressing hash table. Interning a string returns
+ * that copy, so two interned strings are equal if and only if they're the
+ * same pointer.
+ */
+
+#define STRINGS_MIN 1024 // Initial size of the hash table of a string set
+
+void arena_init(struct arena* arena) {
+  memset(arena, 0, sizeof(struct arena));
+}
+
+/* Memory for size bytes, aligned for any type, valid until the arena is reset */
+void* arena_alloc(struct arena* arena, size_t size) {
+  size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+  /* Move on to the next chunk that fits, allocating it if there's none */
+  while (arena->current < arena->chunk_count && arena->used + size > arena->sizes[arena->current]) {
+    arena->current++;
+    arena->used = 0;
+  }
+  if (arena->current == arena->chunk_count) {
+    size_t chunk = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+    arena->chunks = (char**)  realloc(arena->chunks, (arena->chunk_count + 1) * sizeof(char*));
+    arena->sizes  = (size_t*) realloc(arena->sizes,  (arena->chunk_count + 1) * sizeof(size_t));
+    arena->chunks[arena->chunk_count] = (char*) malloc(chunk);
+    arena->sizes[arena->chunk_count]  = chunk;
+    arena->chunk_count++;
+    arena->used = 0;
+  }
+  void* p = arena->chunks[arena->current] + arena->used;
+  arena->used += size;
+  return p;
+}
+
+char* arena_strdup(struct arena* arena, const char* s) {
+  size_t len = strlen(s) + 1;
+  char* copy = (char*) arena_alloc(arena, len);
+  memcpy(copy, s, len);
+  return copy;
+}
+
+/* Release everything allocated so far, keeping the chunks */
+void arena_reset(struct arena* arena) {
+  arena->current = 0;
+  arena->used    = 0;
+}
+
+void arena_free(struct arena* arena) {
+  for (unsigned int i = 0; i < arena->chunk_count; i++) free(arena->chunks[i]);
+  free(arena->chunks);
+  free(arena->sizes);
+  memset(arena, 0, sizeof(struct arena));
+}
+
+static uint32_t hash_string(const char* s) {
+  uint32_t h = 2166136261u; // FNV-1a
+  for (; *s; s++) {
+    h ^= (unsigned char) *s;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/* Slot of a string, or of the empty slot where it would go */
+static unsigned int slot(const struct strings* set, const char* s, uint32_t hash) {
+  unsigned int mask = set->capacity - 1;
+  unsigned int i = hash & mask;
+  while (set->table[i] != NULL && (set->hashes[i] != hash || strcmp(set->table[i], s) != 0)) i = (i + 1) & mask;
+  return i;
+}
+
+static void strings_grow(struct strings* set) {
+  const char** table = set->table;
+  uint32_t* hashes   = set->hashes;
+  unsigned int old   = set->capacity;
+  set->capacity = old > 0 ? 2 * old : STRINGS_MIN;
+  set->table    = (const char**) calloc(set->capacity, sizeof(const char*));
+  set->hashes   = (uint32_t*) calloc(set->capacity, sizeof(uint32_t));
+  for (unsigned int i = 0; i < old; i++) {
+    if (table[i] == NULL) continue;
+    unsigned int j = slot(set, table[i], hashes[i]);
+    set->table[j]  = table[i];
+    set->hashes[j] = hashes[i];
+  }
+  free(table);
+  free(hashes);
+}
+
+void strings_init(struct strings* set) {
+  memset(set, 0, sizeof(struct strings));
+  arena_init(&set->arena);
+}
+
+/**
+ * The single copy of a string, added if it's new. It's copied into the arena,
+ * unless told otherwise, in which case it must outlive the set (or its next
+ * clear), like names pointing into a mapped scores file.
+ */
+const char* strings_intern(struct strings* set, const char* s, bool copy) {
+  if (2 * (set->count + 1) > set->capacity) strings_grow(set);
+  uint32_t hash  = hash_string(s);
+  unsigned int i = slot(set, s, hash);
+  if (set->table[i] != NULL) return set->table[i];
+  set->table[i]  = copy ? arena_strdup(&set->arena, s) : s;
+  set->hashes[i] = hash;
+  set->count++;
+  return set->table[i];
+}
+
+/* The single copy of a string, NULL if it was never interned */
+const char* strings_find(const struct strings* set, const char* s) {
+  if (set->count == 0) return NULL;
+  return set->table[slot(set, s, hash_string(s))];
+}
+
+/* Forget every string at once */
+void strings_clear(struct strings* set) {
+  if (set->count > 0) {
+    memset(set->table,  0, set->capacity * sizeof(const char*));
+    memset(set->hashes, 0, set->capacity * sizeof(uint32_t));
+  }
+  set->count = 0;
+  arena_reset(&set->arena);
+}
+
+void strings_free(struct strings* set) {
+  free(set->table);
+  free(set->hashes);
+  arena_free(&set->arena);
+  memset(set, 0, sizeof(struct strings));
+}
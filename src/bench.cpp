@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <chrono>
+#include <algorithm>
+
+#include "nprofilerlib.h"
+
+/**
+ * Benchmarks of the library's hot paths, for judging performance changes.
+ *
+ * Fixtures are generated from a seed, so every run measures the same work:
+ * a synthetic nprofile with every block record filled in, a scores file with
+ * 20 entries on every leaderboard spread over a given number of players, a
+ * month of daily deltas on top of it, each changing CHURN% of the
+ * leaderboards, and a corpus of get_scores responses, names with escapes
+ * included. They're written to a directory, and the benchmarks read them
+ * back from there.
+ *
+ * Each benchmark times a number of samples of a batch of calls, after one
+ * sample to warm up, and reports the median and 99th percentile time per
+ * call, and how many allocations a call makes (malloc, calloc and realloc,
+ * counted on glibc only).
+ */
+
+#define REPS      50    // Samples per benchmark
+#define PLAYERS   5000  // Players of the scores file
+#define RESPONSES 1000  // Responses in the corpus
+#define SEED      1
+#define DAYS      30    // Deltas in the chain, one a day
+#define CHURN     5     // Percent of the leaderboards a day changes
+
+/* Allocation counting, by standing in for the allocator */
+static uint64_t allocs = 0;
+#ifdef __GLIBC__
+#define COUNTS_ALLOCS 1
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void  __libc_free(void* p);
+void* malloc(size_t size)               { __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED); return __libc_malloc(size); }
+void* calloc(size_t count, size_t size) { __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED); return __libc_calloc(count, size); }
+void* realloc(void* p, size_t size)     { __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED); return __libc_realloc(p, size); }
+void  free(void* p)                     { __libc_free(p); }
+}
+#else
+#define COUNTS_ALLOCS 0
+#endif
+
+/* Fixtures, and the state the benchmarks work on */
+static uint32_t seed = SEED;
+static struct env env;
+static struct config config;
+static struct mapping savefile;
+static char nprofile_file[PATH_MAX], scores_file[PATH_MAX], saved_file[PATH_MAX], responses_file[PATH_MAX];
+static char** responses;
+static size_t* lengths;
+static unsigned int rcount;
+static unsigned int* ids;
+static char** names;
+static unsigned int pcount;
+static unsigned int* perm;
+static struct env chain;
+static struct config chain_config;
+static char chain_files[DAYS + 1][PATH_MAX], delta_file[PATH_MAX];
+
+/* xorshift32, reproducible everywhere */
+static uint32_t rnd() {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static void usage() {
+  printf("Usage: nprofiler-bench [-d dir] [-p players] [-c responses] [-r reps] [-s seed] [benchmark]\n");
+  printf("  Generate the fixtures into dir (/tmp by default), and time every benchmark,\n");
+  printf("  or the ones whose name starts with the one given\n");
+}
+
+/* Names of the players, some with characters the responses have to escape */
+static void make_players() {
+  ids   = (unsigned int*) malloc(pcount * sizeof(unsigned int));
+  names = (char**) malloc(pcount * sizeof(char*));
+  for (unsigned int i = 0; i < pcount; i++) {
+    char name[NAME_SIZE];
+    if (i % 11 == 0)     snprintf(name, sizeof(name), "\"Quoted\" %u", i);
+    else if (i % 7 == 0) snprintf(name, sizeof(name), "Jos\xc3\xa9 %u", i);
+    else                 snprintf(name, sizeof(name), "Player%u", i);
+    ids[i]   = 100000 + i * 37;
+    names[i] = strdup(name);
+  }
+}
+
+/* A savefile with every record filled in, and the header */
+static int make_nprofile() {
+  unsigned char* f = (unsigned char*) calloc(FILESIZE, 1);
+  for (unsigned int i = 0; i < BLOCK_COUNT; i++) {
+    struct record r;
+    memset(&r, 0, sizeof(r));
+    r.id              = i;
+    r.attempts        = rnd() % 5000;
+    r.deaths          = r.attempts / 2;
+    r.victories       = rnd() % (r.attempts + 1);
+    r.victories_ep    = rnd() % 3 == 0 ? rnd() % 100 : 0;
+    r.state           = rnd() % 4;
+    r.gold            = rnd() % 32;
+    r.score_deathless = rnd() % 200000;
+    r.replay          = rnd();
+    memcpy(f + catalogue.items[i].offset, &r, sizeof(r));
+  }
+  struct header header;
+  memset(&header, 0, sizeof(header));
+  header.id = ids[0];
+  snprintf(header.username, sizeof(header.username), "%s", "Bench");
+  memcpy(f + NPP_USER_ID, &header, sizeof(header));
+
+  FILE* file = fopen(nprofile_file, "wb");
+  bool ok = file != NULL && fwrite(f, 1, FILESIZE, file) == FILESIZE;
+  if (file != NULL) fclose(file);
+  free(f);
+  return ok ? 0 : 1;
+}
+
+/* The 20 entries of a leaderboard, with decreasing scores and some ties */
+static void make_board(struct board* board) {
+  memset(board, 0, sizeof(struct board));
+  board->count = BOARD_SIZE;
+  unsigned int score = 100000 + rnd() % 900000;
+  for (unsigned int k = 0; k < BOARD_SIZE; k++) {
+    unsigned int p = rnd() % pcount;
+    struct entry* e = &board->entries[k];
+    if (rnd() % 4 != 0) score -= rnd() % 500;
+    e->id       = ids[p];
+    e->score    = score;
+    e->replay   = rnd();
+    e->has_name = true;
+    snprintf(e->name, sizeof(e->name), "%s", names[p]);
+  }
+}
+
+static int make_scores() {
+  struct env scores;
+  env_init(&scores, &config);
+  for (int t = 0; t < scores.tcount; t++) {
+    if (!scores.tabs[t].online) continue;
+    for (int i = 0; i < scores.tabs[t].size; i++) {
+      struct board board;
+      make_board(&board);
+      apply_board(&scores, &scores.tabs[t].blocks[i], &board);
+      scores.lcount++;
+    }
+  }
+  int ret = save_scores(&scores, scores_file);
+  env_free(&scores);
+  return ret;
+}
+
+/* JSON string, escaping quotes, backslashes and anything not ASCII */
+static size_t put_string(char* p, const char* s) {
+  char* start = p;
+  *p++ = '"';
+  for (const unsigned char* c = (const unsigned char*) s; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      *p++ = '\\';
+      *p++ = *c;
+    } else if (*c == 0xc3 && c[1] != '\0') { // Latin-1 supplement, as its code point
+      p += sprintf(p, "\\u%04x", 0xc0 + (c[1] & 0x3f));
+      c++;
+    } else {
+      *p++ = *c;
+    }
+  }
+  *p++ = '"';
+  return p - start;
+}
+
+/* Responses like the server's, one per line */
+static int make_responses() {
+  FILE* file = fopen(responses_file, "wb");
+  if (file == NULL) return 1;
+  char* res = (char*) malloc(64 * 1024);
+  for (unsigned int i = 0; i < rcount; i++) {
+    struct board board;
+    make_board(&board);
+    char* p = res;
+    p += sprintf(p, "{\"userInfo\":{\"my_score\":%u,\"my_rank\":%u,\"my_replay_id\":%u,\"my_display_name\":", board.entries[3].score, 3, board.entries[3].replay);
+    p += put_string(p, board.entries[3].name);
+    p += sprintf(p, "},\"scores\":[");
+    for (unsigned int k = 0; k < board.count; k++) {
+      const struct entry* e = &board.entries[k];
+      p += sprintf(p, "%s{\"score\":%u,\"rank\":%u,\"user_id\":%u,\"user_name\":", k > 0 ? "," : "", e->score, k, e->id);
+      p += put_string(p, e->name);
+      p += sprintf(p, ",\"replay_id\":%u}", e->replay);
+    }
+    p += sprintf(p, "],\"query_type\":\"global\"}\n");
+    fwrite(res, 1, p - res, file);
+  }
+  free(res);
+  fclose(file);
+  return 0;
+}
+
+/* Size of a file, 0 if it can't be read */
+static long file_size(const char* filename) {
+  FILE* file = fopen(filename, "rb");
+  if (file == NULL) return 0;
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+/* A full snapshot, then a delta of the one before for every day */
+static int make_chain() {
+  struct config day_config = config;
+  struct env day;
+  env_init(&day, &day_config);
+  if (parse_scores(&day, scores_file) != 0) {
+    env_free(&day);
+    return 1;
+  }
+  int ret = save_scores(&day, chain_files[0]);
+  for (unsigned int d = 1; d <= DAYS && ret == 0; d++) {
+    for (int t = 0; t < day.tcount; t++) {
+      if (!day.tabs[t].online) continue;
+      for (int i = 0; i < day.tabs[t].size; i++) {
+        if (rnd() % 100 >= CHURN) continue;
+        struct board board;
+        make_board(&board);
+        apply_board(&day, &day.tabs[t].blocks[i], &board);
+      }
+    }
+    day_config.time += 86400;
+    ret = save_delta(&day, chain_files[d - 1], chain_files[d]);
+  }
+  env_free(&day);
+  return ret;
+}
+
+static int load_responses() {
+  FILE* file = fopen(responses_file, "rb");
+  if (file == NULL) return 1;
+  responses = (char**) malloc(rcount * sizeof(char*));
+  lengths   = (size_t*) malloc(rcount * sizeof(size_t));
+  char* line = (char*) malloc(64 * 1024);
+  unsigned int n = 0;
+  while (n < rcount && fgets(line, 64 * 1024, file) != NULL) {
+    lengths[n]   = strcspn(line, "\n");
+    responses[n] = strndup(line, lengths[n]);
+    n++;
+  }
+  free(line);
+  fclose(file);
+  return n == rcount ? 0 : 1;
+}
+
+/**
+ * How the main table used to be sorted, as the baseline of sort_blocks(): a
+ * qsort of the block indices on a single column, which the comparison
+ * function finds in globals.
+ */
+static enum orders blkorder;
+static bool blkorder_rev;
+static const struct store* blkstore;
+
+static int blkval(const struct store* store, unsigned int b) {
+  switch (blkorder) {
+    case ATTEMPTS:  return (int) store->attempts[b];
+    case VICTORIES: return (int) store->victories[b] + (int) store->victories_ep[b];
+    case GOLD:      return (int) store->gold[b];
+    case SCORE:     return (int) store->score[b];
+    case RANK:      return (int) store->rank[b];
+    case ID:
+    default:        return (int) store->id[b];
+  }
+}
+
+static int blkcmp(const void* b1, const void* b2) {
+  int r = blkval(blkstore, *(const unsigned int*) b1);
+  int s = blkval(blkstore, *(const unsigned int*) b2);
+  return blkorder_rev ? (r < s) - (r > s) : (r > s) - (r < s);
+}
+
+static void blksort(const struct store* store, size_t sz, enum orders order, bool reverse, unsigned int* perm) {
+  blkorder     = order;
+  blkorder_rev = reverse;
+  blkstore     = store;
+  for (unsigned int i = 0; i < sz; i++) perm[i] = i;
+  qsort(perm, sz, sizeof(unsigned int), blkcmp);
+}
+
+/* Benchmarks, called with the index of the call */
+static void op_parse_tabs(unsigned int i)    { parse_tabs(savefile.data, &env); }
+static void op_parse_profile(unsigned int i) {
+  struct profile profile;
+  parse_profile(savefile.data, &profile);
+  free((void*) profile.username);
+}
+static void op_parse_scores(unsigned int i)  { parse_scores(&env, scores_file); }
+static void op_save_scores(unsigned int i)   { save_scores(&env, saved_file); }
+static void op_parse_json(unsigned int i)    {
+  unsigned int r = i % rcount;
+  parse_json(&env, &env.blocks[r % L_COUNT], responses[r], lengths[r]);
+}
+static void op_parse_chain(unsigned int i)   { parse_scores(&chain, chain_files[DAYS]); }
+static void op_save_delta(unsigned int i)    { save_delta(&chain, chain_files[DAYS - 1], delta_file); }
+static void op_decode(unsigned int i)        {
+  struct board board;
+  unsigned int r = i % rcount;
+  decode_scores(responses[r], lengths[r], &board);
+}
+static void op_decode_cjson(unsigned int i)  {
+  struct board board;
+  unsigned int r = i % rcount;
+  decode_scores_cjson(responses[r], lengths[r], &board);
+}
+static void op_blksort(unsigned int i)       { blksort(&env.store, env.bcount, (enum orders) (i % 6), i % 2, perm); }
+static void op_sort_single(unsigned int i)   {
+  struct sort_key key = { (enum orders) (i % 6), i % 2 == 1 }; // The same sorts as blksort
+  sort_blocks(&env.store, env.bcount, &key, 1, perm);
+}
+static void op_sort_blocks(unsigned int i)   {
+  static const struct sort_key specs[][2] = { // A column, then another breaking its ties, as shift-clicked in the table
+    { { GOLD, true },  { ATTEMPTS, false } },
+    { { SCORE, true }, { ID, false } },
+    { { VICTORIES, false }, { RANK, false } },
+  };
+  sort_blocks(&env.store, env.bcount, specs[i % 3], 1 + i % 2, perm);
+}
+static void op_find_id(unsigned int i)       { find_player_by_id(env.players, ids[(i * 7919) % pcount]); }
+static void op_find_name(unsigned int i)     { find_player_by_name(env.players, names[(i * 7919) % pcount]); }
+static void op_log_write(unsigned int i)     { log_write(LOG_INFO, "Benchmark message %u", i); }
+
+static void decode_scalar() { decode_select(DECODE_SCALAR); }
+static void decode_sse2()   { decode_select(DECODE_SSE2); }
+static void decode_avx2()   { decode_select(DECODE_AVX2); }
+
+static const struct benchmark {
+  const char* name;
+  unsigned int batch;   // Calls per sample
+  void (*setup)();      // Run before timing it, if any
+  void (*op)(unsigned int i);
+} benchmarks[] = {
+  { "parse_tabs",           1,    NULL,          op_parse_tabs },
+  { "parse_tabs/scalar",    1,    decode_scalar, op_parse_tabs },
+  { "parse_tabs/sse2",      1,    decode_sse2,   op_parse_tabs },
+  { "parse_tabs/avx2",      1,    decode_avx2,   op_parse_tabs },
+  { "parse_profile",        100,  NULL,          op_parse_profile },
+  { "parse_scores",         1,    NULL,          op_parse_scores },
+  { "save_scores",          1,    NULL,          op_save_scores },
+  { "parse_scores/chain",   1,    NULL,          op_parse_chain },
+  { "save_delta",           1,    NULL,          op_save_delta },
+  { "parse_json",           100,  NULL,          op_parse_json },
+  { "decode_scores",        100,  NULL,          op_decode },
+  { "decode_scores/cjson",  100,  NULL,          op_decode_cjson },
+  { "blksort",              1,    NULL,          op_blksort },
+  { "sort_blocks/single",   1,    NULL,          op_sort_single },
+  { "sort_blocks",          1,    NULL,          op_sort_blocks },
+  { "find_player_by_id",    1000, NULL,          op_find_id },
+  { "find_player_by_name",  1000, NULL,          op_find_name },
+  { "log_write",            1000, NULL,          op_log_write },
+};
+
+static void print_time(double ns) {
+  if (ns < 10000)           printf(" %8.1f ns", ns);
+  else if (ns < 10000000)   printf(" %8.1f us", ns / 1000);
+  else                      printf(" %8.1f ms", ns / 1000000);
+}
+
+static void run(const struct benchmark* b, unsigned int reps) {
+  if (b->setup != NULL) b->setup();
+  double* samples = (double*) malloc(reps * sizeof(double));
+  unsigned int call = 0;
+  for (unsigned int k = 0; k < b->batch; k++) b->op(call++); // Warm up
+  uint64_t before = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+  for (unsigned int s = 0; s < reps; s++) {
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int k = 0; k < b->batch; k++) b->op(call++);
+    samples[s] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / b->batch;
+  }
+  uint64_t count = __atomic_load_n(&allocs, __ATOMIC_RELAXED) - before;
+  std::sort(samples, samples + reps);
+  unsigned int p99 = (unsigned int) (0.99 * reps + 0.5);
+  printf("%-22s %8u", b->name, reps * b->batch);
+  print_time(samples[reps / 2]);
+  print_time(samples[p99 > 0 ? p99 - 1 : 0]);
+  if (COUNTS_ALLOCS) printf(" %12.2f\n", (double) count / (reps * b->batch));
+  else printf(" %12s\n", "-");
+  free(samples);
+  decode_select(DECODE_AVX2);
+}
+
+int main(int argc, char** argv) {
+  const char* dir    = "/tmp";
+  const char* filter = NULL;
+  unsigned int reps  = REPS;
+  pcount = PLAYERS;
+  rcount = RESPONSES;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)      dir    = argv[++i];
+    else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) pcount = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) rcount = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) reps   = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) seed   = atoi(argv[++i]);
+    else if (filter == NULL && argv[i][0] != '-')        filter = argv[i];
+    else {
+      usage();
+      return 1;
+    }
+  }
+  if (pcount == 0 || rcount == 0 || reps == 0 || seed == 0) {
+    usage();
+    return 1;
+  }
+  snprintf(nprofile_file,  sizeof(nprofile_file),  "%s/bench-nprofile", dir);
+  snprintf(scores_file,    sizeof(scores_file),    "%s/bench-scores", dir);
+  snprintf(saved_file,     sizeof(saved_file),     "%s/bench-saved", dir);
+  snprintf(responses_file, sizeof(responses_file), "%s/bench-responses", dir);
+  snprintf(delta_file,     sizeof(delta_file),     "%s/bench-delta", dir);
+  for (unsigned int d = 0; d <= DAYS; d++) snprintf(chain_files[d], sizeof(chain_files[d]), "%s/bench-chain-%02u", dir, d);
+
+  /* Fixtures, without any config file so no player is left out */
+  uint32_t first_seed = seed;
+  initialize();
+  memset(&config, 0, sizeof(config));
+  make_players();
+  if (make_nprofile() != 0 || make_scores() != 0 || make_chain() != 0 || make_responses() != 0) {
+    fprintf(stderr, "Error writing the fixtures to %s\n", dir);
+    return 1;
+  }
+  env_init(&env, &config);
+  chain_config = config;
+  env_init(&chain, &chain_config);
+  if (savefile_open(&savefile, nprofile_file) != FILESIZE || parse_scores(&env, scores_file) != 0 || parse_scores(&chain, chain_files[DAYS]) != 0 || load_responses() != 0) {
+    fprintf(stderr, "Error reading the fixtures from %s\n", dir);
+    return 1;
+  }
+  perm = (unsigned int*) malloc(env.bcount * sizeof(unsigned int));
+  printf("Fixtures in %s: seed %u, %u players, %u leaderboards, %u scores, %u responses\n", dir, first_seed, env.players->count, env.lcount, env.scount, rcount);
+  long full = file_size(chain_files[0]), deltas = 0;
+  for (unsigned int d = 1; d <= DAYS; d++) deltas += file_size(chain_files[d]);
+  printf("Delta chain: %u days of %u%% churn in %.1f KB, %.1f KB as full snapshots\n", DAYS, CHURN, (full + deltas) / 1024.0, (DAYS + 1) * full / 1024.0);
+  printf("%-22s %8s %11s %11s %12s\n", "benchmark", "calls", "median", "p99", "allocs/call");
+
+  for (size_t i = 0; i < sizeof(benchmarks) / sizeof(*benchmarks); i++) {
+    const struct benchmark* b = &benchmarks[i];
+    if (filter != NULL && strncmp(b->name, filter, strlen(filter)) != 0) continue;
+    if (b->setup == decode_sse2 && decode_select(DECODE_SSE2) != DECODE_SSE2) continue; // Unsupported by the CPU
+    if (b->setup == decode_avx2 && decode_select(DECODE_AVX2) != DECODE_AVX2) continue;
+    run(b, reps);
+  }
+
+  savefile_close(&savefile);
+  env_free(&chain);
+  env_free(&env);
+  return 0;
+}
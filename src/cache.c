@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "curl/curl.h"
+#include "nprofilerlib.h"
+
+/**
+ * Response cache.
+ *
+ * Downloading every leaderboard takes a while and depends on the server's
+ * mood, which gets in the way of working on what comes after. When
+ * recording, every response is appended to a file as it comes, failures
+ * included: its URL, status, cURL code, latency and body. When replaying,
+ * requests are served from that file without touching the network, after
+ * the latency they had if timed, so a whole download, slots, retries and
+ * all, runs the same way offline every time.
+ *
+ * URLs are keyed without their host, so a recording made against one server
+ * replays for another. A URL requested more than once, e.g., because its
+ * first response was a 502, gets its responses in the order they were
+ * recorded, then the last one over again. A URL that was never recorded is
+ * a miss, which is answered with a 404 so the block is set aside.
+ */
+
+#define FILETYPE_CACHE 4 // Same numbering as the scores files
+#define CACHE_VERSION  1
+
+/* Part of a URL after its host */
+static const char* url_key(const char* url, size_t* len) {
+  const char* p = strstr(url, "://");
+  p = p != NULL ? strchr(p + 3, '/') : url;
+  if (p == NULL) p = url;
+  *len = strlen(p);
+  return p;
+}
+
+/* FNV-1a */
+static uint32_t hash(const char* key, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char) key[i]) * 16777619u;
+  return h;
+}
+
+/* Entries are packed, so they're copied out rather than read in place */
+static struct cache_entry entry_at(const struct cache* cache, uint32_t index) {
+  struct cache_entry e;
+  memcpy(&e, cache->map.data + cache->offsets[index], sizeof(e));
+  return e;
+}
+
+static const char* entry_key(const struct cache* cache, uint32_t index) {
+  return (const char*) (cache->map.data + cache->offsets[index] + sizeof(struct cache_entry));
+}
+
+/* Slot of the table for a URL, empty if it was never recorded */
+static uint32_t find(const struct cache* cache, const char* key, size_t len) {
+  uint32_t i = hash(key, len) & (cache->size - 1);
+  while (cache->table[i] != (uint32_t) -1) {
+    uint32_t first = cache->table[i];
+    if (entry_at(cache, first).key_size == len && memcmp(entry_key(cache, first), key, len) == 0) break;
+    i = (i + 1) & (cache->size - 1);
+  }
+  return i;
+}
+
+/* Index every entry of a mapped cache by URL, stopping at the first torn one */
+static int load(struct cache* cache) {
+  const unsigned char* f = cache->map.data;
+  size_t size = cache->map.size;
+  if (size < sizeof(struct cache_header)) return 1;
+  const struct cache_header* h = (const struct cache_header*) f;
+  if (memcmp(h->magic, MAGIC, 4) != 0 || h->filetype != FILETYPE_CACHE || h->version != CACHE_VERSION) return 1;
+
+  unsigned int cap = 1024;
+  cache->offsets = (uint32_t*) malloc(cap * sizeof(uint32_t));
+  size_t offset = sizeof(struct cache_header);
+  while (size - offset >= sizeof(struct cache_entry)) {
+    struct cache_entry e;
+    memcpy(&e, f + offset, sizeof(e));
+    size_t total = sizeof(e) + e.key_size + (size_t) e.size;
+    if (total > size - offset || offset > UINT32_MAX) break;
+    if (cache->count == cap) {
+      cap *= 2;
+      cache->offsets = (uint32_t*) realloc(cache->offsets, cap * sizeof(uint32_t));
+    }
+    cache->offsets[cache->count++] = offset;
+    offset += total;
+  }
+  if (offset < size) {
+    setlog(cache->filename);
+    putlog("Response cache was cut short, replaying up to its last whole response");
+  }
+
+  /* Chain the entries of each URL in recording order */
+  cache->size = 64;
+  while (cache->size < 2 * cache->count) cache->size *= 2;
+  cache->table  = (uint32_t*) malloc(cache->size * sizeof(uint32_t));
+  cache->served = (uint32_t*) malloc(cache->size * sizeof(uint32_t));
+  cache->next   = (uint32_t*) malloc((cache->count + 1) * sizeof(uint32_t));
+  memset(cache->table, 0xFF, cache->size * sizeof(uint32_t));
+  memset(cache->next,  0xFF, (cache->count + 1) * sizeof(uint32_t));
+  uint32_t* last = (uint32_t*) malloc(cache->size * sizeof(uint32_t));
+  for (uint32_t i = 0; i < cache->count; i++) {
+    uint32_t slot = find(cache, entry_key(cache, i), entry_at(cache, i).key_size);
+    if (cache->table[slot] == (uint32_t) -1) {
+      cache->table[slot]  = i;
+      cache->served[slot] = i;
+    } else {
+      cache->next[last[slot]] = i;
+    }
+    last[slot] = i;
+  }
+  free(last);
+  return 0;
+}
+
+/**
+ * Open a cache to record the responses to, from scratch, or to replay them
+ * from. Returns 0 on success, in which case it must be closed.
+ */
+int cache_open(struct cache* cache, const char* filename, enum caching mode, unsigned int window) {
+  memset(cache, 0, sizeof(struct cache));
+  cache->filename = filename;
+  cache->mode     = mode;
+  if (mode == CACHE_REPLAY) {
+    if (map_open(&cache->map, filename) <= 0 || load(cache) != 0) {
+      seterr("Error reading response cache");
+      cache_close(cache);
+      return 1;
+    }
+    return 0;
+  }
+
+  cache->file = fopen(filename, "wb");
+  if (cache->file == NULL) {
+    seterr("Error creating response cache");
+    return 1;
+  }
+  struct cache_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MAGIC, 4);
+  h.filetype = FILETYPE_CACHE;
+  h.major    = MAJOR;
+  h.minor    = MINOR;
+  h.patch    = PATCH;
+  h.version  = CACHE_VERSION;
+  h.window   = window;
+  h.time     = time(NULL);
+  if (fwrite(&h, sizeof(h), 1, cache->file) != 1) {
+    seterr("Error writing response cache");
+    fclose(cache->file);
+    cache->file = NULL;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Replay the response to a URL into res, with its status, cURL code and the
+ * microseconds it took. Returns false on a miss, answered as a 404.
+ */
+bool cache_fetch(struct cache* cache, const char* url, struct buffer* res, long* status, CURLcode* code, uint64_t* latency) {
+  size_t len;
+  const char* key = url_key(url, &len);
+  buffer_clear(res);
+  uint32_t slot = find(cache, key, len);
+  if (cache->table[slot] == (uint32_t) -1) {
+    cache->misses++;
+    log_write(LOG_WARN, "No recorded response to %.*s", (int) len, key);
+    *status  = 404;
+    *code    = CURLE_OK;
+    *latency = 0;
+    return false;
+  }
+  uint32_t index = cache->served[slot];
+  if (cache->next[index] != (uint32_t) -1) cache->served[slot] = cache->next[index];
+  struct cache_entry e = entry_at(cache, index);
+  buffer_append(res, entry_key(cache, index) + e.key_size, e.size);
+  *status  = e.status;
+  *code    = (CURLcode) e.code;
+  *latency = e.latency;
+  return true;
+}
+
+/* Record the response to a URL, whatever it was */
+void cache_store(struct cache* cache, const char* url, const struct buffer* res, long status, CURLcode code, uint64_t latency) {
+  if (cache->file == NULL) return;
+  size_t len;
+  const char* key = url_key(url, &len);
+  struct cache_entry e;
+  memset(&e, 0, sizeof(e));
+  e.size     = res->len;
+  e.latency  = latency < UINT32_MAX ? latency : UINT32_MAX;
+  e.key_size = len;
+  e.status   = status > 0 && status <= UINT16_MAX ? status : 0;
+  e.code     = code;
+  if (fwrite(&e, sizeof(e), 1, cache->file) != 1 || fwrite(key, len, 1, cache->file) != 1 || (e.size > 0 && fwrite(res->data, e.size, 1, cache->file) != 1)) {
+    seterr("Error writing response cache");
+    puterr("Failed to record a response");
+    fclose(cache->file);
+    cache->file = NULL;
+    return;
+  }
+  cache->count++;
+}
+
+void cache_close(struct cache* cache) {
+  if (cache->file != NULL) fclose(cache->file);
+  map_close(&cache->map);
+  free(cache->offsets);
+  free(cache->next);
+  free(cache->table);
+  free(cache->served);
+  cache->file    = NULL;
+  cache->offsets = cache->next = cache->table = cache->served = NULL;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "nprofilerlib.h"
+
+/**
+ * Block catalogue.
+ *
+ * The tabs of the game and the blocks in them never change, so they're
+ * generated at compile time into a read-only table: the name of every level,
+ * episode and story, its row, column and level within its tab, and where its
+ * record is in the savefile. Starting up only points the blocks at it, and a
+ * block is found from its coordinates or name with a bit of arithmetic,
+ * without searching.
+ *
+ * Blocks are in the same order as env->blocks, tab by tab. Within a tab,
+ * levels are ordered by column, row and level, and episodes by column and
+ * row, followed by the X row if the tab has one. Secret levels (? and !) are
+ * laid out like episodes. Stories are the columns of rows A to E.
+ */
+
+#define ROW_X 5 // Row of the X episodes and levels
+
+/* Tabs, in the order of env->tabs. Offsets count blocks from the start of their savefile region */
+static constexpr struct tab TABS[TAB_COUNT] = {
+  { PC, SOLO, LEVEL, SI,  "SI",  L_OFFSET_SI,  L_COUNT_SI,  NULL, false, true },
+  { PC, SOLO, LEVEL, S,   "S",   L_OFFSET_S,   L_COUNT_S,   NULL, true,  true },
+  { PC, SOLO, LEVEL, SU,  "SU",  L_OFFSET_SU,  L_COUNT_SU,  NULL, true,  true },
+  { PC, SOLO, LEVEL, SL,  "SL",  L_OFFSET_SL,  L_COUNT_SL,  NULL, true,  true },
+  { PC, SOLO, LEVEL, SS,  "?",   L_OFFSET_SS,  L_COUNT_SS,  NULL, true,  true },
+  { PC, SOLO, LEVEL, SS2, "!",   L_OFFSET_SS2, L_COUNT_SS2, NULL, true,  true },
+
+  { PC, SOLO, EPISODE, SI, "SI", E_OFFSET_SI, E_COUNT_SI, NULL, false, true },
+  { PC, SOLO, EPISODE, S,  "S",  E_OFFSET_S,  E_COUNT_S,  NULL, true,  true },
+  { PC, SOLO, EPISODE, SU, "SU", E_OFFSET_SU, E_COUNT_SU, NULL, true,  true },
+  { PC, SOLO, EPISODE, SL, "SL", E_OFFSET_SL, E_COUNT_SL, NULL, true,  true },
+
+  { PC, SOLO, STORY, SI, "SI", S_OFFSET_SI, S_COUNT_SI, NULL, false, true },
+  { PC, SOLO, STORY, S,  "S",  S_OFFSET_S,  S_COUNT_S,  NULL, false, true },
+  { PC, SOLO, STORY, SU, "SU", S_OFFSET_SU, S_COUNT_SU, NULL, false, true },
+  { PC, SOLO, STORY, SL, "SL", S_OFFSET_SL, S_COUNT_SL, NULL, false, true }
+};
+
+/* Whether a tab's blocks are named and ordered like episodes, by column and row */
+static constexpr bool by_row(const struct tab* tab) {
+  return tab->type == EPISODE || tab->tab == SS || tab->tab == SS2;
+}
+
+/* Blocks of a tab before its X row, if any */
+static constexpr unsigned int x_start(const struct tab* tab) {
+  return tab->x ? 5 * tab->size / 6 : tab->size;
+}
+
+/* Coordinates of the i-th block of a tab */
+static constexpr void locate(const struct tab* tab, unsigned int i, struct item* item) {
+  item->row    = NO_COORD;
+  item->level  = NO_COORD;
+  if (tab->type == STORY) {
+    item->column = i;
+  } else if (by_row(tab)) {
+    bool x       = i >= x_start(tab);
+    item->row    = x ? ROW_X : i % 5;
+    item->column = x ? i - x_start(tab) : i / 5;
+  } else {
+    bool x       = i >= x_start(tab);
+    item->row    = x ? ROW_X : (i / 5) % 5;
+    item->column = x ? i / 5 - tab->size / 6 : i / 25;
+    item->level  = i % 5;
+  }
+}
+
+static constexpr char* put_str(char* p, const char* s) {
+  while (*s) *p++ = *s++;
+  return p;
+}
+
+static constexpr char* put_num(char* p, unsigned int n) {
+  *p++ = '0' + n / 10 % 10;
+  *p++ = '0' + n % 10;
+  return p;
+}
+
+/* Name of a block from its coordinates, e.g. SU-A-03-04, SU-A-03 or SU-03 */
+static constexpr void name(const struct tab* tab, struct item* item) {
+  char* p = put_str(item->name, tab->prefix);
+  *p++ = '-';
+  if (item->row != NO_COORD) {
+    *p++ = "ABCDEX"[item->row];
+    *p++ = '-';
+  }
+  p = put_num(p, item->column);
+  if (item->level != NO_COORD) {
+    *p++ = '-';
+    p = put_num(p, item->level);
+  }
+  *p = '\0';
+}
+
+static constexpr struct catalogue build() {
+  struct catalogue c = {};
+  unsigned int index = 0;
+  for (unsigned int t = 0; t < 3; t++) {
+    for (unsigned int k = 0; k < 6; k++) c.find[t][k] = NO_COORD;
+  }
+  for (unsigned int t = 0; t < TAB_COUNT; t++) {
+    const struct tab* tab = &TABS[t];
+    unsigned int region   = tab->type == LEVEL ? L_OFFSET : (tab->type == EPISODE ? E_OFFSET : S_OFFSET);
+    c.tabs[t]  = *tab;
+    c.first[t] = index;
+    c.find[tab->type][tab->tab] = t;
+    for (unsigned int i = 0; i < tab->size; i++, index++) {
+      struct item* item = &c.items[index];
+      item->tab    = t;
+      item->offset = region + (tab->offset + i) * BLOCK_SIZE;
+      locate(tab, i, item);
+      name(tab, item);
+    }
+  }
+  return c;
+}
+
+constexpr struct catalogue catalogue = build();
+
+static constexpr bool same(const char* a, const char* b) {
+  while (*a && *a == *b) a++, b++;
+  return *a == *b;
+}
+
+static_assert(catalogue.first[TAB_COUNT - 1] + S_COUNT_SL == BLOCK_COUNT, "Tabs don't add up to BLOCK_COUNT");
+static_assert(same(catalogue.items[0].name, "SI-A-00-00"), "Bad level name");
+static_assert(same(catalogue.items[L_COUNT_SI + 504].name, "S-X-00-04"), "Bad X level name");
+static_assert(same(catalogue.items[catalogue.first[4] + 101].name, "?-X-01"), "Bad secret level name");
+static_assert(same(catalogue.items[catalogue.first[8] + 17].name, "SU-C-03"), "Bad episode name");
+static_assert(same(catalogue.items[BLOCK_COUNT - 1].name, "SL-19"), "Bad story name");
+
+/**
+ * Index of a block from its coordinates, -1 if there's no such block. Only
+ * the coordinates that apply are looked at: no row for stories, and no level
+ * unless it's a level.
+ */
+int catalogue_find(enum types type, enum tabs tab, unsigned int row, unsigned int column, unsigned int level) {
+  if (type > STORY || tab > SS2 || catalogue.find[type][tab] == NO_COORD) return -1;
+  unsigned int t = catalogue.find[type][tab];
+  const struct tab* info = &catalogue.tabs[t];
+  unsigned int i;
+  if (type == STORY) {
+    i = column;
+  } else if (by_row(info)) {
+    if (row > ROW_X) return -1;
+    i = row == ROW_X ? x_start(info) + column : 5 * column + row;
+  } else {
+    if (row > ROW_X || level > 4) return -1;
+    i = row == ROW_X ? 5 * (info->size / 6 + column) + level : 25 * column + 5 * row + level;
+  }
+  if (i >= info->size) return -1;
+
+  /* Coordinates past the end of a row land on another block, which won't match */
+  const struct item* item = &catalogue.items[catalogue.first[t] + i];
+  if (item->column != column || (type != STORY && item->row != row)) return -1;
+  return catalogue.first[t] + i;
+}
+
+static bool get_num(const char** s, unsigned int* n) {
+  if ((*s)[0] < '0' || (*s)[0] > '9' || (*s)[1] < '0' || (*s)[1] > '9') return false;
+  *n = 10 * ((*s)[0] - '0') + (*s)[1] - '0';
+  *s += 2;
+  return true;
+}
+
+/* Index of a block from its name, e.g. SU-C-12-03, -1 if there's no such block */
+int catalogue_lookup(const char* name) {
+  static const char* prefixes[] = { "SI", "S", "SU", "SL", "?", "!" }; // By enum tabs
+  const char* dash = strchr(name, '-');
+  if (dash == NULL) return -1;
+  int tab = -1;
+  for (int k = 0; k < 6; k++) {
+    if (strlen(prefixes[k]) == (size_t) (dash - name) && strncmp(name, prefixes[k], dash - name) == 0) tab = k;
+  }
+  if (tab < 0) return -1;
+
+  /* Story (SU-12), episode or secret level (SU-C-12), or level (SU-C-12-03) */
+  const char* s = dash + 1;
+  unsigned int row = NO_COORD, column, level = NO_COORD;
+  if (*s < '0' || *s > '9') {
+    const char* rows = strchr("ABCDEX", *s);
+    if (*s == '\0' || rows == NULL || s[1] != '-') return -1;
+    row = rows - "ABCDEX";
+    s += 2;
+  }
+  if (!get_num(&s, &column)) return -1;
+  if (*s == '-') {
+    s++;
+    if (!get_num(&s, &level)) return -1;
+  }
+  if (*s != '\0') return -1;
+
+  enum types type = row == NO_COORD ? STORY : (level != NO_COORD || tab == SS || tab == SS2 ? LEVEL : EPISODE);
+  if ((level != NO_COORD) != (type == LEVEL && tab != SS && tab != SS2)) return -1;
+  return catalogue_find(type, (enum tabs) tab, row, column, level);
+}
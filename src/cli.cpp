@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <thread>
+
+#include "nprofilerlib.h"
+
+/**
+ * Headless front end, for servers and cron: it only links the library, cJSON
+ * and cURL, so nothing is drawn and there's no GLFW nor OpenGL.
+ */
+
+#define ROUNDS 3 // Rounds of attempts at the failing leaderboards before giving up
+
+static void usage() {
+  printf("Usage: nprofiler-cli <command> [options]\n");
+  printf("  download [-n nprofile] [-w window] [-h host] [-b base] [-j journal] [-m metrics]\n");
+  printf("           [-q rate] [-f] [-r record | -R replay [-L]] <output>\n");
+  printf("      Download every leaderboard into a scores file, a delta of base if given,\n");
+  printf("      resuming the last download if it was interrupted, and write its metrics\n");
+  printf("      as JSON to the metrics file if given (- for stdout). Every response can be\n");
+  printf("      recorded to a file, and replayed from it instead of the network, as fast\n");
+  printf("      as possible or with the latencies they were recorded with (-L). Up to window\n");
+  printf("      requests go at once, fewer when the server struggles unless fixed (-f), and\n");
+  printf("      at most rate requests start per second if given\n");
+  printf("  convert <input> <output>       Write any scores file or delta chain as a full snapshot\n");
+  printf("  delta <base> <input> <output>  Write input as a delta of base\n");
+  printf("  merge <output> <input>...      Overlay the leaderboards of each input on the first\n");
+  printf("  totals <input>                 Print the total score of each tab\n");
+  printf("  board <input> <block> [rank] [count]\n");
+  printf("      Print count entries (20 by default) of the leaderboard of a block, e.g. SU-A-00-00,\n");
+  printf("      from a rank on, however deep it is\n");
+  printf("  watch [-n nprofile] [-c count]  Print the blocks changed by each save of the game,\n");
+  printf("      and how long they took to be picked up, until count saves if given\n");
+}
+
+static void totals(struct env* env) {
+  for (int i = 0; i < env->tcount; i++) {
+    if (!env->tabs[i].online) continue;
+    printf("%-8s ", env->tabs[i].type == LEVEL ? "Levels" : (env->tabs[i].type == EPISODE ? "Episodes" : "Stories"));
+    compute_tab(env, &env->tabs[i]);
+  }
+  printf("Players: %u, leaderboards: %u, scores: %u\n", env->players->count, env->lcount, env->scount);
+}
+
+static void dump_metrics(const struct metrics* metrics, const char* filename) {
+  char* json = metrics_json(metrics);
+  FILE* file = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Error writing metrics to %s\n", filename);
+  } else {
+    fprintf(file, "%s\n", json);
+    if (file != stdout) fclose(file);
+  }
+  free(json);
+}
+
+/* Where the concurrency limit went, round by round, and where it ended */
+static void print_pacing(const struct pacing* pacing) {
+  printf("Pacing: %u of %u transfers at once%s, %u up, %u down, last %s, latency %.1f ms (healthy %.1f ms)\n",
+    pace_limit(pacing), pacing->window, pacing->adaptive ? "" : " (fixed)", pacing->increases, pacing->decreases,
+    pace_reason((enum paces) pacing->reason), (double) pacing->latency / 1000, (double) pacing->baseline / 1000);
+  unsigned int first = pacing->rounds >= PACE_HISTORY ? pacing->rounds - PACE_HISTORY + 1 : 1;
+  printf("Limit after each round from %u:", first);
+  for (unsigned int i = first; i <= pacing->rounds; i++) printf(" %u", pacing->history[i % PACE_HISTORY]);
+  printf("\n");
+}
+
+static int download(struct env* env, int argc, char** argv) {
+  const char* nprofile = FILENAME;
+  const char* base     = NULL;
+  const char* output   = NULL;
+  const char* host     = HOST;
+  const char* journal_file = JOURNAL;
+  const char* metrics  = NULL;
+  const char* record   = NULL;
+  const char* replay   = NULL;
+  bool timed           = false;
+  bool fixed           = false;
+  unsigned int rate    = 0;
+  unsigned int window  = WINDOW;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)      nprofile = argv[++i];
+    else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) window   = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) host     = argv[++i];
+    else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) base     = argv[++i];
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) journal_file = argv[++i];
+    else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) metrics  = argv[++i];
+    else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) record   = argv[++i];
+    else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) replay   = argv[++i];
+    else if (strcmp(argv[i], "-L") == 0)                 timed    = true;
+    else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) rate     = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-f") == 0)                 fixed    = true;
+    else if (output == NULL && argv[i][0] != '-')        output   = argv[i];
+    else {
+      usage();
+      return 1;
+    }
+  }
+  if (output == NULL || (record != NULL && replay != NULL)) {
+    usage();
+    return 1;
+  }
+
+  /* Level IDs come from the savefile */
+  struct mapping savefile;
+  int size = savefile_open(&savefile, nprofile);
+  if (size != FILESIZE) {
+    fprintf(stderr, "Error reading nprofile %s\n", nprofile);
+    savefile_close(&savefile);
+    return 1;
+  }
+  parse_tabs(savefile.data, env);
+  savefile_close(&savefile);
+
+  struct curl curl;
+  memset(&curl, 0, sizeof(curl));
+  if (curlinit(&curl, window) != 0) {
+    curldestroy(&curl);
+    return 1;
+  }
+  curl.host = host;
+  curl.pacing.adaptive = !fixed;
+  curl.pacing.rate     = rate;
+  env->curl = &curl;
+
+  /* Responses recorded to, or replayed from, a file */
+  struct cache cache;
+  if (record != NULL || replay != NULL) {
+    if (cache_open(&cache, replay != NULL ? replay : record, replay != NULL ? CACHE_REPLAY : CACHE_RECORD, window) != 0) {
+      fprintf(stderr, "Error opening response cache %s\n", replay != NULL ? replay : record);
+      curldestroy(&curl);
+      return 1;
+    }
+    cache.timed = timed;
+    curl.cache  = &cache;
+  }
+
+  /* Download, after whatever an interrupted download left in the journal */
+  auto start = std::chrono::steady_clock::now();
+  struct journal journal;
+  int resumed = journal_open(&journal, env, journal_file);
+  env->journal = &journal;
+  if (resumed > 0) printf("Resumed %d leaderboards from %s\n", resumed, journal_file);
+
+  /* Retrying the missing leaderboards a few times */
+  int* flags = (int*) &env->flags;
+  sflag(flags, DownloadFlags_Download);
+  unsigned int obcount = 0;
+  for (int i = 0; i < env->tcount; i++) if (env->tabs[i].online) obcount += env->tabs[i].size;
+  int ret = 0;
+  for (int round = 0; round < ROUNDS && env->lcount < obcount; round++) {
+    retry_failed(&curl); // Another round for the blocks that ran out of attempts
+    ret = update_scores(env);
+    journal_flush(&journal, true);
+    if (ret == -1) {
+      fprintf(stderr, "Steam ID %lu is inactive, open N++ and try again\n", (unsigned long) env->config->def_steam_id);
+      break;
+    }
+  }
+  cflag(flags, DownloadFlags_Download);
+  metrics_done(&curl.metrics);
+  if (metrics != NULL) dump_metrics(&curl.metrics, metrics);
+  print_pacing(&curl.pacing);
+  if (curl.cache != NULL) {
+    if (replay != NULL) printf("Replayed %s, %u responses recorded, %u requests missed\n", replay, cache.count, cache.misses);
+    else printf("Recorded %u responses to %s\n", cache.count, record);
+    cache_close(&cache);
+  }
+  env->curl    = NULL;
+  env->journal = NULL;
+  curldestroy(&curl);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (env->lcount < obcount) {
+    fprintf(stderr, "Downloaded %u out of %u leaderboards in %.3f seconds\n", env->lcount, obcount, seconds);
+    journal_close(&journal, false); // Kept for the next attempt
+    return 1;
+  }
+  printf("Downloaded %u leaderboards in %.3f seconds\n", env->lcount, seconds);
+
+  env->config->time = time(NULL);
+  totals(env);
+  ret = base != NULL ? save_delta(env, base, output) : save_scores(env, output);
+  journal_close(&journal, ret == 0); // Only done with once the scores are safe on disk
+  return ret;
+}
+
+static int board(struct env* env, const char* name, unsigned int rank, unsigned int count) {
+  int b = catalogue_lookup(name);
+  if (b < 0) {
+    fprintf(stderr, "No block named %s\n", name);
+    return 1;
+  }
+  unsigned int size = leaderboard_size(env, b);
+  printf("%s: %u entries\n", name, size);
+  struct standing page[64];
+  while (count > 0) {
+    unsigned int n = leaderboard_read(env, b, rank, count < 64 ? count : 64, page);
+    if (n == 0) break;
+    for (unsigned int k = 0; k < n; k++) {
+      const char* player = page[k].player != NULL && page[k].player->name != NULL ? page[k].player->name : "-";
+      printf("%6u %6u  %-25.25s %10.3f\n", page[k].rank, page[k].tied_rank, player, (double) page[k].score / 1000);
+    }
+    rank  += n;
+    count -= n;
+  }
+  return 0;
+}
+
+static int watch(struct env* env, int argc, char** argv) {
+  const char* nprofile = FILENAME;
+  unsigned int limit   = 0;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)      nprofile = argv[++i];
+    else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) limit    = atoi(argv[++i]);
+    else {
+      usage();
+      return 1;
+    }
+  }
+  struct watcher watcher;
+  if (watch_open(&watcher, env, nprofile) != 0) {
+    fprintf(stderr, "Error reading nprofile %s\n", nprofile);
+    watch_close(&watcher);
+    return 1;
+  }
+  printf("Watching %s\n", nprofile);
+  fflush(stdout);
+
+  const struct store* st = &env->store;
+  for (unsigned int updates = 0; limit == 0 || updates < limit; ) {
+    int count = watch_poll(&watcher, env);
+    if (count < 0) { // Nothing downloads meanwhile, so it's loaded again right away
+      watch_close(&watcher);
+      if (watch_open(&watcher, env, nprofile) != 0) {
+        fprintf(stderr, "Error reading nprofile %s\n", nprofile);
+        watch_close(&watcher);
+        return 1;
+      }
+      printf("Block IDs changed, loaded %s again\n", nprofile);
+      fflush(stdout);
+      continue;
+    }
+    if (count == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      continue;
+    }
+    updates++;
+    for (int k = 0; k < count && k < 20; k++) {
+      unsigned int i = watcher.changed[k];
+      printf("  %-10s attempts %u, victories %u, gold %u, state %u\n", env->blocks[i].name, st->attempts[i], st->victories[i] + st->victories_ep[i], st->gold[i], st->state[i]);
+    }
+    if (count > 20) printf("  and %d more\n", count - 20);
+    watch_shown(&watcher);
+    printf("%d blocks changed, from the save: noticed %+.1f ms, applied %+.1f ms, shown %+.1f ms\n", count,
+      ((double) watcher.noticed - watcher.saved) / 1000, ((double) watcher.applied - watcher.saved) / 1000, ((double) watcher.shown - watcher.saved) / 1000);
+    fflush(stdout);
+  }
+  watch_close(&watcher);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  const char* cmd = argv[1];
+  argc -= 2;
+  argv += 2;
+
+  /* Same setup as the GUI, minus everything that's drawn */
+  initialize();
+  struct env env;
+  env_init(&env, NULL);
+  env.config = parse_config(env.players);
+
+  int ret = 1;
+  if (strcmp(cmd, "download") == 0) {
+    ret = download(&env, argc, argv);
+  } else if (strcmp(cmd, "convert") == 0 && argc == 2) {
+    ret = compact_scores(&env, argv[0], argv[1]);
+  } else if (strcmp(cmd, "delta") == 0 && argc == 3) {
+    ret = parse_scores(&env, argv[1]);
+    if (ret == 0) ret = save_delta(&env, argv[0], argv[2]);
+  } else if (strcmp(cmd, "merge") == 0 && argc >= 2) {
+    ret = parse_scores(&env, argv[1]);
+    for (int i = 2; i < argc && ret == 0; i++) ret = merge_scores(&env, argv[i]);
+    if (ret == 0) ret = save_scores(&env, argv[0]);
+  } else if (strcmp(cmd, "watch") == 0) {
+    ret = watch(&env, argc, argv);
+  } else if (strcmp(cmd, "board") == 0 && argc >= 2 && argc <= 4) {
+    ret = parse_scores(&env, argv[0]);
+    if (ret == 0) ret = board(&env, argv[1], argc > 2 ? atoi(argv[2]) : 0, argc > 3 ? atoi(argv[3]) : BOARD_SIZE);
+  } else if (strcmp(cmd, "totals") == 0 && argc == 1) {
+    ret = parse_scores(&env, argv[0]);
+    if (ret == 0) totals(&env);
+  } else {
+    usage();
+  }
+
+  env_free(&env);
+  return ret;
+}
@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cJSON/cJSON.h"
+#include "nprofilerlib.h"
+
+/**
+ * Decoder for the get_scores response.
+ *
+ * Instead of building a cJSON tree and looking keys up by name, we walk the
+ * buffer once and only keep the handful of fields we care about, straight
+ * into a struct board that lives on the caller's stack. Anything that doesn't
+ * look like a get_scores response makes decode_scores() fail, and the caller
+ * is expected to fall back to decode_scores_cjson().
+ */
+
+struct cursor {
+  const char* p;
+  const char* end;
+};
+
+static void skip_ws(struct cursor* c) {
+  while (c->p < c->end && (*c->p == ' ' || *c->p == '\n' || *c->p == '\r' || *c->p == '\t')) c->p++;
+}
+
+static bool expect(struct cursor* c, char ch) {
+  skip_ws(c);
+  if (c->p >= c->end || *c->p != ch) return false;
+  c->p++;
+  return true;
+}
+
+/* Peek next significant char, 0 at the end of the buffer */
+static char peek(struct cursor* c) {
+  skip_ws(c);
+  return c->p < c->end ? *c->p : 0;
+}
+
+static int hex4(const char* p) {
+  int v = 0;
+  for (int i = 0; i < 4; i++) {
+    char ch = p[i];
+    v <<= 4;
+    if (ch >= '0' && ch <= '9') v |= ch - '0';
+    else if (ch >= 'a' && ch <= 'f') v |= ch - 'a' + 10;
+    else if (ch >= 'A' && ch <= 'F') v |= ch - 'A' + 10;
+    else return -1;
+  }
+  return v;
+}
+
+static int utf8(char* dest, unsigned int cp) {
+  if (cp < 0x80) {
+    dest[0] = cp;
+    return 1;
+  } else if (cp < 0x800) {
+    dest[0] = 0xC0 | (cp >> 6);
+    dest[1] = 0x80 | (cp & 0x3F);
+    return 2;
+  } else if (cp < 0x10000) {
+    dest[0] = 0xE0 | (cp >> 12);
+    dest[1] = 0x80 | ((cp >> 6) & 0x3F);
+    dest[2] = 0x80 | (cp & 0x3F);
+    return 3;
+  }
+  dest[0] = 0xF0 | (cp >> 18);
+  dest[1] = 0x80 | ((cp >> 12) & 0x3F);
+  dest[2] = 0x80 | ((cp >> 6) & 0x3F);
+  dest[3] = 0x80 | (cp & 0x3F);
+  return 4;
+}
+
+/**
+ * Read a string. If dest is not NULL, it gets unescaped into it (NUL
+ * terminated, at most size bytes), otherwise it's just skipped.
+ */
+static bool read_string(struct cursor* c, char* dest, size_t size) {
+  if (!expect(c, '"')) return false;
+  size_t n = 0;
+  while (c->p < c->end && *c->p != '"') {
+    char buf[4];
+    int len = 1;
+    if (*c->p != '\\') {
+      buf[0] = *c->p++;
+    } else {
+      if (c->end - c->p < 2) return false;
+      char esc = c->p[1];
+      c->p += 2;
+      switch (esc) {
+        case '"':  buf[0] = '"';  break;
+        case '\\': buf[0] = '\\'; break;
+        case '/':  buf[0] = '/';  break;
+        case 'b':  buf[0] = '\b'; break;
+        case 'f':  buf[0] = '\f'; break;
+        case 'n':  buf[0] = '\n'; break;
+        case 'r':  buf[0] = '\r'; break;
+        case 't':  buf[0] = '\t'; break;
+        case 'u': {
+          if (c->end - c->p < 4) return false;
+          int cp = hex4(c->p);
+          if (cp < 0) return false;
+          c->p += 4;
+          if (cp >= 0xD800 && cp <= 0xDBFF) { // Surrogate pair
+            if (c->end - c->p < 6 || c->p[0] != '\\' || c->p[1] != 'u') return false;
+            int lo = hex4(c->p + 2);
+            if (lo < 0xDC00 || lo > 0xDFFF) return false;
+            c->p += 6;
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+          }
+          if (cp == 0) return false;
+          len = utf8(buf, cp);
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+    if (dest != NULL) {
+      if (n + len >= size) return false; // Doesn't fit, let cJSON deal with it
+      memcpy(dest + n, buf, len);
+    }
+    n += len;
+  }
+  if (c->p >= c->end) return false;
+  c->p++;
+  if (dest != NULL) dest[n] = 0;
+  return true;
+}
+
+/* Compare the next key against a literal, consuming it and the colon */
+static bool read_key(struct cursor* c, const char** key, size_t* len) {
+  skip_ws(c);
+  if (c->p >= c->end || *c->p != '"') return false;
+  const char* start = ++c->p;
+  while (c->p < c->end && *c->p != '"') {
+    if (*c->p == '\\') return false; // None of our keys are escaped
+    c->p++;
+  }
+  if (c->p >= c->end) return false;
+  *key = start;
+  *len = c->p - start;
+  c->p++;
+  return expect(c, ':');
+}
+
+static bool key_is(const char* key, size_t len, const char* lit) {
+  return strlen(lit) == len && memcmp(key, lit, len) == 0;
+}
+
+/**
+ * Read a number, or a null, into an unsigned int like cJSON's valueint would.
+ * Returns false if the value is something else, null and non-numbers are
+ * stored as -1.
+ */
+static bool read_uint(struct cursor* c, unsigned int* dest) {
+  char ch = peek(c);
+  if (ch == 'n') {
+    if (c->end - c->p < 4 || memcmp(c->p, "null", 4) != 0) return false;
+    c->p += 4;
+    *dest = -1;
+    return true;
+  }
+  bool neg = false;
+  if (ch == '-') {
+    neg = true;
+    c->p++;
+  }
+  if (c->p >= c->end || *c->p < '0' || *c->p > '9') return false;
+  long long v = 0;
+  while (c->p < c->end && *c->p >= '0' && *c->p <= '9') {
+    if (v < INT32_MAX) v = 10 * v + (*c->p - '0');
+    c->p++;
+  }
+  if (c->p < c->end && (*c->p == '.' || *c->p == 'e' || *c->p == 'E')) return false;
+  if (v > INT32_MAX) v = INT32_MAX; // cJSON saturates too
+  *dest = (unsigned int) (neg ? -v : v);
+  return true;
+}
+
+static bool skip_literal(struct cursor* c, const char* lit) {
+  size_t len = strlen(lit);
+  if ((size_t) (c->end - c->p) < len || memcmp(c->p, lit, len) != 0) return false;
+  c->p += len;
+  return true;
+}
+
+static bool skip_digits(struct cursor* c) {
+  const char* start = c->p;
+  while (c->p < c->end && *c->p >= '0' && *c->p <= '9') c->p++;
+  return c->p > start;
+}
+
+/* Skip a number as JSON writes them, anything else is left for cJSON to judge */
+static bool skip_number(struct cursor* c) {
+  if (c->p < c->end && *c->p == '-') c->p++;
+  if (c->p < c->end && *c->p == '0') c->p++; // No leading zeros
+  else if (!skip_digits(c)) return false;
+  if (c->p < c->end && *c->p == '.') {
+    c->p++;
+    if (!skip_digits(c)) return false;
+  }
+  if (c->p < c->end && (*c->p == 'e' || *c->p == 'E')) {
+    c->p++;
+    if (c->p < c->end && (*c->p == '+' || *c->p == '-')) c->p++;
+    if (!skip_digits(c)) return false;
+  }
+  return true;
+}
+
+static bool skip_value(struct cursor* c, int depth = 0) {
+  if (depth > 32) return false;
+  char ch = peek(c);
+  switch (ch) {
+    case '"':
+      return read_string(c, NULL, 0);
+    case '{':
+    case '[': {
+      char close = ch == '{' ? '}' : ']';
+      c->p++;
+      if (peek(c) == close) {
+        c->p++;
+        return true;
+      }
+      while (true) {
+        if (ch == '{') {
+          const char* key;
+          size_t len;
+          if (!read_key(c, &key, &len)) return false;
+        }
+        if (!skip_value(c, depth + 1)) return false;
+        if (peek(c) == ',') {
+          c->p++;
+          continue;
+        }
+        return expect(c, close);
+      }
+    }
+    case 't':
+      return skip_literal(c, "true");
+    case 'f':
+      return skip_literal(c, "false");
+    case 'n':
+      return skip_literal(c, "null");
+    default:
+      return skip_number(c);
+  }
+}
+
+/* Read a string field, or null. Anything else is stored as no string at all. */
+static bool read_name(struct cursor* c, char* dest, bool* has) {
+  if (peek(c) == '"') {
+    *has = true;
+    return read_string(c, dest, NAME_SIZE);
+  }
+  *has = false;
+  return skip_value(c);
+}
+
+/* Read a field that cJSON would only accept if it was a number */
+static bool read_field(struct cursor* c, unsigned int* dest) {
+  char ch = peek(c);
+  if (ch == '-' || ch == 'n' || (ch >= '0' && ch <= '9')) return read_uint(c, dest);
+  *dest = -1;
+  return skip_value(c);
+}
+
+static bool read_user(struct cursor* c, struct board* board) {
+  if (peek(c) != '{') return skip_value(c); // Not an object, ignored
+  c->p++;
+  board->has_user = true;
+  if (peek(c) == '}') {
+    c->p++;
+    return true;
+  }
+  while (true) {
+    const char* key;
+    size_t len;
+    bool ok;
+    if (!read_key(c, &key, &len)) return false;
+    if      (key_is(key, len, "my_score"))        ok = read_field(c, &board->user_score);
+    else if (key_is(key, len, "my_rank"))         ok = read_field(c, &board->user_rank);
+    else if (key_is(key, len, "my_replay_id"))    ok = read_field(c, &board->user_replay);
+    else if (key_is(key, len, "my_display_name")) ok = read_name(c, board->user_name, &board->has_user_name);
+    else                                          ok = skip_value(c);
+    if (!ok) return false;
+    if (peek(c) == ',') {
+      c->p++;
+      continue;
+    }
+    return expect(c, '}');
+  }
+}
+
+static bool read_entry(struct cursor* c, struct entry* entry) {
+  entry->id       = -1;
+  entry->score    = -1;
+  entry->replay   = -1;
+  entry->has_name = false;
+  if (!expect(c, '{')) return false;
+  if (peek(c) == '}') {
+    c->p++;
+    return true;
+  }
+  while (true) {
+    const char* key;
+    size_t len;
+    bool ok;
+    if (!read_key(c, &key, &len)) return false;
+    if      (key_is(key, len, "user_id"))   ok = read_field(c, &entry->id);
+    else if (key_is(key, len, "score"))     ok = read_field(c, &entry->score);
+    else if (key_is(key, len, "replay_id")) ok = read_field(c, &entry->replay);
+    else if (key_is(key, len, "user_name")) ok = read_name(c, entry->name, &entry->has_name);
+    else                                    ok = skip_value(c);
+    if (!ok) return false;
+    if (peek(c) == ',') {
+      c->p++;
+      continue;
+    }
+    return expect(c, '}');
+  }
+}
+
+static bool read_entries(struct cursor* c, struct board* board) {
+  if (peek(c) != '[') return skip_value(c); // Not an array, ignored
+  c->p++;
+  if (peek(c) == ']') {
+    c->p++;
+    return true;
+  }
+  while (true) {
+    if (board->count < BOARD_SIZE) {
+      if (!read_entry(c, &board->entries[board->count++])) return false;
+    } else if (!skip_value(c)) { // Never expected, the server returns 20 scores
+      return false;
+    }
+    if (peek(c) == ',') {
+      c->p++;
+      continue;
+    }
+    return expect(c, ']');
+  }
+}
+
+static void board_init(struct board* board) {
+  board->has_user      = false;
+  board->has_user_name = false;
+  board->user_score    = -1;
+  board->user_rank     = -1;
+  board->user_replay   = -1;
+  board->count         = 0;
+}
+
+/* Returns 0 on success, 1 if the response doesn't have the expected shape */
+int decode_scores(const char* res, size_t len, struct board* board) {
+  struct cursor c = { res, res + len };
+  board_init(board);
+  if (!expect(&c, '{')) return 1;
+  if (peek(&c) != '}') {
+    while (true) {
+      const char* key;
+      size_t klen;
+      bool ok;
+      if (!read_key(&c, &key, &klen)) return 1;
+      if      (key_is(key, klen, "userInfo")) ok = read_user(&c, board);
+      else if (key_is(key, klen, "scores"))   ok = read_entries(&c, board);
+      else                                    ok = skip_value(&c);
+      if (!ok) return 1;
+      if (peek(&c) == ',') {
+        c.p++;
+        continue;
+      }
+      break;
+    }
+  }
+  if (!expect(&c, '}')) return 1;
+  skip_ws(&c);
+  return c.p == c.end || *c.p == 0 ? 0 : 1;
+}
+
+static void copy_name(char* dest, const cJSON* json, bool* has) {
+  *has = json != NULL && cJSON_IsString(json);
+  if (*has) {
+    strncpy(dest, json->valuestring, NAME_SIZE - 1);
+    dest[NAME_SIZE - 1] = 0;
+  }
+}
+
+static unsigned int number(const cJSON* json) {
+  return json != NULL && cJSON_IsNumber(json) ? json->valueint : -1;
+}
+
+/* Fallback for responses the fast path can't handle, returns 0 on success */
+int decode_scores_cjson(const char* res, size_t len, struct board* board) {
+  board_init(board);
+  cJSON* json = cJSON_ParseWithLength(res, len);
+  if (json == NULL) return 1; // Incorrect JSON format
+
+  /* Read user info */
+  const cJSON* userInfo = cJSON_GetObjectItemCaseSensitive(json, "userInfo");
+  if (userInfo != NULL && cJSON_IsObject(userInfo)) {
+    board->has_user    = true;
+    board->user_score  = number(cJSON_GetObjectItemCaseSensitive(userInfo, "my_score"));
+    board->user_rank   = number(cJSON_GetObjectItemCaseSensitive(userInfo, "my_rank"));
+    board->user_replay = number(cJSON_GetObjectItemCaseSensitive(userInfo, "my_replay_id"));
+    copy_name(board->user_name, cJSON_GetObjectItemCaseSensitive(userInfo, "my_display_name"), &board->has_user_name);
+  }
+
+  /* Read scores */
+  const cJSON* scores = cJSON_GetObjectItemCaseSensitive(json, "scores");
+  const cJSON* token  = NULL;
+  if (scores != NULL && cJSON_IsArray(scores)) {
+    cJSON_ArrayForEach(token, scores) {
+      if (board->count == BOARD_SIZE) break;
+      struct entry* entry = &board->entries[board->count++];
+      entry->id     = number(cJSON_GetObjectItemCaseSensitive(token, "user_id"));
+      entry->score  = number(cJSON_GetObjectItemCaseSensitive(token, "score"));
+      entry->replay = number(cJSON_GetObjectItemCaseSensitive(token, "replay_id"));
+      copy_name(entry->name, cJSON_GetObjectItemCaseSensitive(token, "user_name"), &entry->has_name);
+    }
+  }
+
+  /* Deallocate json tree */
+  cJSON_Delete(json);
+  return 0;
+}
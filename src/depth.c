@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "nprofilerlib.h"
+
+/**
+ * Deep leaderboards.
+ *
+ * The top BOARD_SIZE entries of every leaderboard are in the entry columns,
+ * which is what the stats and most of the UI read. Entries ranked past them,
+ * which only some leaderboards have, are appended to pages instead: fixed-size
+ * pages from a pool of chunks, linked per block, and returned to a free list
+ * when the block is cleared. A page holds as many entries as fit, coded as
+ * varints: the player index + 1 (0 if none), the drop in score from the entry
+ * before it (zigzagged), and the replay ID + 1. Its header has the rank, tied
+ * rank and score of its first entry, so the others follow from there, and a
+ * reader seeks to a rank by skipping whole pages.
+ *
+ * Entries are read a page at a time through a cursor, or a few ranks at a
+ * time with leaderboard_read(), so no one ever needs a whole deep leaderboard
+ * decoded at once.
+ */
+
+static unsigned char* put_varint(unsigned char* p, uint32_t v) {
+  while (v >= 0x80) {
+    *p++ = (unsigned char) (v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (unsigned char) v;
+  return p;
+}
+
+static bool get_varint(const unsigned char** p, const unsigned char* end, uint32_t* v) {
+  uint32_t value = 0;
+  for (int shift = 0; shift < 35 && *p < end; shift += 7) {
+    unsigned char byte = *(*p)++;
+    value |= (uint32_t) (byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      *v = value;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Code an entry after one with the score given, into p (room for DEEP_ENTRY
+ * bytes), returns the end of it. Scores usually go down, by a little.
+ */
+unsigned char* deep_encode(unsigned char* p, uint32_t player, uint32_t prev, uint32_t score, uint32_t replay) {
+  int32_t drop = (int32_t) (prev - score);
+  p = put_varint(p, player + 1);
+  p = put_varint(p, ((uint32_t) drop << 1) ^ (uint32_t) (drop >> 31));
+  return put_varint(p, replay + 1);
+}
+
+/* Decode an entry, score is the one before it on the way in, returns false past end */
+bool deep_decode(const unsigned char** p, const unsigned char* end, uint32_t* player, uint32_t* score, uint32_t* replay) {
+  uint32_t index, zigzag, id;
+  if (!get_varint(p, end, &index) || !get_varint(p, end, &zigzag) || !get_varint(p, end, &id)) return false;
+  *player = index - 1;
+  *score -= (zigzag >> 1) ^ -(zigzag & 1);
+  *replay = id - 1;
+  return true;
+}
+
+static struct page* page_get(const struct pages* pages, uint32_t index) {
+  return &pages->chunks[index / PAGE_CHUNK][index % PAGE_CHUNK];
+}
+
+/* A page off the free list, or a new one */
+static uint32_t page_new(struct pages* pages) {
+  uint32_t index = pages->free;
+  if (index != (uint32_t) -1) {
+    pages->free = page_get(pages, index)->next;
+    return index;
+  }
+  if (pages->count / PAGE_CHUNK >= pages->chunk_count) {
+    pages->chunks = (struct page**) realloc(pages->chunks, (pages->chunk_count + 1) * sizeof(struct page*));
+    pages->chunks[pages->chunk_count++] = (struct page*) malloc(PAGE_CHUNK * sizeof(struct page));
+  }
+  return pages->count++;
+}
+
+void deep_init(struct entries* entries, unsigned int bcount) {
+  entries->depth = (uint32_t*) calloc(bcount, sizeof(uint32_t));
+  entries->first = (uint32_t*) malloc(bcount * sizeof(uint32_t));
+  entries->last  = (uint32_t*) malloc(bcount * sizeof(uint32_t));
+  memset(entries->first, 0xFF, bcount * sizeof(uint32_t));
+  memset(entries->last,  0xFF, bcount * sizeof(uint32_t));
+  memset(&entries->pages, 0, sizeof(struct pages));
+  entries->pages.free = -1;
+}
+
+void deep_free(struct entries* entries) {
+  struct pages* pages = &entries->pages;
+  for (unsigned int i = 0; i < pages->chunk_count; i++) free(pages->chunks[i]);
+  free(pages->chunks);
+  free(entries->depth);
+  free(entries->first);
+  free(entries->last);
+}
+
+/* Drop the deep entries of count blocks from the one at index first, keeping their pages for reuse */
+void deep_clear(struct entries* entries, unsigned int first, unsigned int count) {
+  struct pages* pages = &entries->pages;
+  for (unsigned int b = first; b < first + count; b++) {
+    if (entries->first[b] == (uint32_t) -1) continue;
+    page_get(pages, entries->last[b])->next = pages->free;
+    pages->free = entries->first[b];
+    entries->depth[b] = 0;
+    entries->first[b] = -1;
+    entries->last[b]  = -1;
+  }
+}
+
+/**
+ * Append an entry ranked past the top BOARD_SIZE of a block, player being a
+ * registry index or -1. Entries go in rank order, and only the rank and tied
+ * rank of the first one are kept, the tied rank of the next ones going up
+ * whenever the score changes.
+ */
+void deep_append(struct entries* entries, unsigned int b, uint32_t player, uint32_t score, uint32_t replay, uint32_t rank, uint32_t tied_rank) {
+  struct pages* pages = &entries->pages;
+  uint32_t last = entries->last[b];
+  struct page* page = last != (uint32_t) -1 ? page_get(pages, last) : NULL;
+  if (page == NULL || (size_t) page->size + DEEP_ENTRY > sizeof(page->data)) {
+    uint32_t index = page_new(pages);
+    struct page* fresh = page_get(pages, index);
+    fresh->next      = -1;
+    fresh->rank      = rank;
+    fresh->tied_rank = tied_rank;
+    fresh->score     = score;
+    fresh->back      = score;
+    fresh->count     = 0;
+    fresh->size      = 0;
+    if (page != NULL) page->next = index;
+    else entries->first[b] = index;
+    entries->last[b] = index;
+    page = fresh;
+  }
+  unsigned char* end = deep_encode(page->data + page->size, player, page->back, score, replay);
+  page->size  = end - page->data;
+  page->back  = score;
+  page->count++;
+  entries->depth[b]++;
+}
+
+/* Point a cursor at the deep entry of a block with the given rank, or past the last one */
+void deep_seek(const struct entries* entries, unsigned int b, unsigned int rank, struct deep_cursor* c) {
+  const struct pages* pages = &entries->pages;
+  c->page = entries->first[b];
+  c->i    = 0;
+  c->pos  = 0;
+  while (c->page != (uint32_t) -1) {
+    const struct page* page = page_get(pages, c->page);
+    if (rank < page->rank + page->count) break;
+    c->page = page->next;
+  }
+  struct standing skipped;
+  while (c->page != (uint32_t) -1 && page_get(pages, c->page)->rank + c->i < rank) deep_next(entries, NULL, c, &skipped);
+}
+
+/* Read the entry under a cursor and move past it, returns false after the last one */
+bool deep_next(const struct entries* entries, struct registry* players, struct deep_cursor* c, struct standing* out) {
+  const struct pages* pages = &entries->pages;
+  if (c->page == (uint32_t) -1) return false;
+  const struct page* page = page_get(pages, c->page);
+  if (c->i == page->count) {
+    c->page = page->next;
+    c->i    = 0;
+    c->pos  = 0;
+    if (c->page == (uint32_t) -1) return false;
+    page = page_get(pages, c->page);
+  }
+
+  /* Pages are written by us, so they're well formed */
+  const unsigned char* p = page->data + c->pos;
+  uint32_t player, score = c->i == 0 ? page->score : c->score, replay;
+  deep_decode(&p, page->data + page->size, &player, &score, &replay);
+  if (c->i == 0) {
+    c->rank      = page->rank;
+    c->tied_rank = page->tied_rank;
+  } else {
+    c->rank++;
+    if (score != c->score) c->tied_rank++;
+  }
+  c->score = score;
+  c->pos   = p - page->data;
+  c->i++;
+
+  out->player    = players != NULL && player != (uint32_t) -1 ? registry_get(players, player) : NULL;
+  out->index     = player;
+  out->score     = score;
+  out->replay    = replay;
+  out->rank      = c->rank;
+  out->tied_rank = c->tied_rank;
+  return true;
+}
+
+/* Entries of a block's leaderboard, top and deep */
+unsigned int leaderboard_size(const struct env* env, unsigned int b) {
+  const struct entries* e = &env->entries;
+  if (e->depth[b] > 0) return BOARD_SIZE + e->depth[b];
+  size_t first = (size_t) b * BOARD_SIZE;
+  unsigned int count = 0;
+  while (count < BOARD_SIZE && e->rank[first + count] != (uint32_t) -1) count++;
+  return count;
+}
+
+/* Put the entry of a block with the next rank, in the top entries or the deep ones */
+void leaderboard_put(struct env* env, unsigned int b, struct player* player, uint32_t score, uint32_t replay, uint32_t rank, uint32_t tied_rank) {
+  struct entries* e = &env->entries;
+  if (rank >= BOARD_SIZE) {
+    deep_append(e, b, player != NULL ? player->index : (uint32_t) -1, score, replay, rank, tied_rank);
+    return;
+  }
+  size_t k = (size_t) b * BOARD_SIZE + rank;
+  e->score[k]     = score;
+  e->player[k]    = player;
+  e->replay[k]    = replay;
+  e->rank[k]      = rank;
+  e->tied_rank[k] = tied_rank;
+}
+
+/**
+ * Read up to count entries of a block's leaderboard from the given rank,
+ * returns how many there were. Only the pages holding them are decoded.
+ */
+unsigned int leaderboard_read(struct env* env, unsigned int b, unsigned int rank, unsigned int count, struct standing* out) {
+  const struct entries* e = &env->entries;
+  unsigned int n = 0;
+  for (size_t k = (size_t) b * BOARD_SIZE + rank; rank < BOARD_SIZE && n < count; rank++, k++) {
+    if (e->rank[k] == (uint32_t) -1) return n;
+    struct player* p = e->player[k];
+    out[n++] = (struct standing) { p, p != NULL ? p->index : (uint32_t) -1, e->score[k], e->replay[k], e->rank[k], e->tied_rank[k] };
+  }
+  if (n == count) return n;
+  struct deep_cursor c;
+  deep_seek(e, b, rank, &c);
+  while (n < count && deep_next(e, env->players, &c, &out[n])) n++;
+  return n;
+}
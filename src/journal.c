@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "nprofilerlib.h"
+
+/**
+ * Download journal.
+ *
+ * Every leaderboard downloaded is appended to the journal as soon as it's
+ * decoded, so a download that's cancelled or dies halfway isn't lost: the
+ * next one replays the journal and only fetches the blocks still missing.
+ * Appends are flushed once per pass of update_scores() and synced to disk
+ * every JOURNAL_BATCH boards.
+ *
+ * Each record carries a checksum, so a record torn by a crash is detected
+ * when replaying, and the journal is cut right before it. A journal only
+ * resumes a download of the same Steam ID and blocks, and only for a while,
+ * past which its scores are too old to be mixed with new ones.
+ */
+
+#define FILETYPE_JOURNAL 3 // Same numbering as the scores files
+#define JOURNAL_VERSION  1
+#define NO_NAME          0xFF // Length byte of an entry without a name
+
+/* CRC-32 (IEEE), bit by bit since records are small */
+static uint32_t crc32(uint32_t crc, const unsigned char* data, size_t len) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+static unsigned char* put_u32(unsigned char* p, uint32_t v) {
+  memcpy(p, &v, sizeof(v));
+  return p + sizeof(v);
+}
+
+static unsigned char* put_name(unsigned char* p, const char* name, bool has_name) {
+  if (!has_name) {
+    *p++ = NO_NAME;
+    return p;
+  }
+  size_t len = strnlen(name, NAME_SIZE - 1);
+  *p++ = (unsigned char) len;
+  memcpy(p, name, len);
+  return p + len;
+}
+
+/* Pack a board into p (room for JOURNAL_RECORD bytes), returns its size */
+static size_t encode_board(unsigned char* p, const struct board* board) {
+  unsigned char* start = p;
+  *p++ = board->has_user;
+  p = put_u32(p, board->user_score);
+  p = put_u32(p, board->user_rank);
+  p = put_u32(p, board->user_replay);
+  p = put_name(p, board->user_name, board->has_user_name);
+  unsigned int count = board->count < BOARD_SIZE ? board->count : BOARD_SIZE;
+  *p++ = (unsigned char) count;
+  for (unsigned int i = 0; i < count; i++) {
+    const struct entry* entry = &board->entries[i];
+    p = put_u32(p, entry->id);
+    p = put_u32(p, entry->score);
+    p = put_u32(p, entry->replay);
+    p = put_name(p, entry->name, entry->has_name);
+  }
+  return p - start;
+}
+
+static bool get_u32(const unsigned char** p, const unsigned char* end, uint32_t* v) {
+  if ((size_t) (end - *p) < sizeof(*v)) return false;
+  memcpy(v, *p, sizeof(*v));
+  *p += sizeof(*v);
+  return true;
+}
+
+static bool get_name(const unsigned char** p, const unsigned char* end, char* name, bool* has_name) {
+  if (*p >= end) return false;
+  unsigned int len = *(*p)++;
+  *has_name = len != NO_NAME;
+  if (!*has_name) {
+    name[0] = '\0';
+    return true;
+  }
+  if (len >= NAME_SIZE || (size_t) (end - *p) < len) return false;
+  memcpy(name, *p, len);
+  name[len] = '\0';
+  *p += len;
+  return true;
+}
+
+/* Unpack a board, returns 0 if the payload was exactly one well-formed board */
+static int decode_board(const unsigned char* p, size_t size, struct board* board) {
+  const unsigned char* end = p + size;
+  if (p >= end) return 1;
+  board->has_user = *p++ != 0;
+  if (!get_u32(&p, end, &board->user_score)) return 1;
+  if (!get_u32(&p, end, &board->user_rank)) return 1;
+  if (!get_u32(&p, end, &board->user_replay)) return 1;
+  if (!get_name(&p, end, board->user_name, &board->has_user_name)) return 1;
+  if (p >= end || *p > BOARD_SIZE) return 1;
+  board->count = *p++;
+  for (unsigned int i = 0; i < board->count; i++) {
+    struct entry* entry = &board->entries[i];
+    if (!get_u32(&p, end, &entry->id)) return 1;
+    if (!get_u32(&p, end, &entry->score)) return 1;
+    if (!get_u32(&p, end, &entry->replay)) return 1;
+    if (!get_name(&p, end, entry->name, &entry->has_name)) return 1;
+  }
+  return p == end ? 0 : 1;
+}
+
+/* Whether a journal was left by an unfinished download we can resume */
+static bool resumable(struct env* env, const struct journal_header* h) {
+  return memcmp(h->magic, MAGIC, 4) == 0
+      && h->filetype == FILETYPE_JOURNAL
+      && h->version == JOURNAL_VERSION
+      && h->bcount == env->bcount
+      && h->steam_id == env->config->def_steam_id
+      && h->time <= (uint64_t) time(NULL)
+      && h->time + JOURNAL_AGE > (uint64_t) time(NULL);
+}
+
+/**
+ * Apply the boards of a journal as if they were just downloaded, returns the
+ * offset right after the last good record, 0 if the journal can't be resumed.
+ */
+static size_t replay(struct env* env, const unsigned char* f, size_t size, unsigned int* count) {
+  *count = 0;
+  if (size < sizeof(struct journal_header)) return 0;
+  const struct journal_header* h = (const struct journal_header*) f;
+  if (!resumable(env, h)) return 0;
+
+  struct board local; // Only used without a feed
+  size_t offset = sizeof(struct journal_header);
+  while (size - offset >= sizeof(struct journal_record)) {
+    struct journal_record r;
+    memcpy(&r, f + offset, sizeof(r));
+    const unsigned char* payload = f + offset + sizeof(r);
+    if (r.size > JOURNAL_RECORD || r.size > size - offset - sizeof(r)) break; // Torn
+    if (crc32(crc32(0, (const unsigned char*) &r.index, 2 * sizeof(uint32_t)), payload, r.size) != r.crc) break;
+    if (r.index >= env->bcount) break;
+    struct block* block = &env->blocks[r.index];
+    if (env->store.id[r.index] != r.id || !block->tab->online) break;
+
+    struct board* board = env->feed != NULL ? feed_board(env->feed) : &local;
+    if (decode_board(payload, r.size, board) != 0) break;
+    offset += sizeof(r) + r.size;
+    if (env->feed != NULL) {
+      feed_put(env->feed, r.index);
+    } else {
+      if (!block->updated) env->lcount++;
+      apply_board(env, block, board);
+    }
+    if (!block->updated) (*count)++;
+    block->updated = true;
+  }
+  return offset;
+}
+
+static int create(struct journal* journal, struct env* env) {
+  journal->file = fopen(journal->filename, "w+b");
+  if (journal->file == NULL) {
+    seterr("Error creating journal");
+    return 1;
+  }
+  struct journal_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MAGIC, 4);
+  h.filetype = FILETYPE_JOURNAL;
+  h.major    = MAJOR;
+  h.minor    = MINOR;
+  h.patch    = PATCH;
+  h.version  = JOURNAL_VERSION;
+  h.bcount   = env->bcount;
+  h.steam_id = env->config->def_steam_id;
+  h.time     = time(NULL);
+  if (fwrite(&h, sizeof(h), 1, journal->file) != 1) {
+    seterr("Error writing journal");
+    fclose(journal->file);
+    journal->file = NULL;
+    return 1;
+  }
+  journal_flush(journal, true);
+  return 0;
+}
+
+/**
+ * Open the journal of a new download. If a previous download left one behind,
+ * its boards are applied (or put in env->feed) and their blocks marked as
+ * updated, so they aren't downloaded again. Returns how many boards were
+ * recovered, -1 if the journal can't be written, in which case the download
+ * can still go on without it.
+ */
+int journal_open(struct journal* journal, struct env* env, const char* filename) {
+  memset(journal, 0, sizeof(struct journal));
+  journal->filename = filename;
+
+  /* Resume the previous download, if any */
+  unsigned int count = 0;
+  size_t end = 0;
+  struct mapping map;
+  if (map_open(&map, filename) > 0) {
+    end = replay(env, map.data, map.size, &count);
+    size_t size = map.size;
+    map_close(&map);
+    if (end > 0 && end < size) putlog("Journal was cut short, resuming from its last whole record");
+    if (end > 0) journal->file = fopen(filename, "r+b");
+    if (journal->file != NULL) {
+#ifdef _WIN32
+      int cut = _chsize(_fileno(journal->file), end);
+#else
+      int cut = ftruncate(fileno(journal->file), end);
+#endif
+      if (cut != 0 || fseek(journal->file, end, SEEK_SET) != 0) {
+        fclose(journal->file);
+        journal->file = NULL;
+      }
+    }
+  }
+
+  /* Or start a new one */
+  if (journal->file == NULL && create(journal, env) != 0) {
+    puterr("Failed to open the download journal");
+    return -1;
+  }
+  return count;
+}
+
+/* Record a board that was just downloaded for the block at index */
+void journal_append(struct journal* journal, unsigned int index, uint32_t id, const struct board* board) {
+  if (journal->file == NULL) return;
+  unsigned char buf[sizeof(struct journal_record) + JOURNAL_RECORD];
+  struct journal_record r;
+  r.size  = encode_board(buf + sizeof(r), board);
+  r.index = index;
+  r.id    = id;
+  r.crc   = crc32(crc32(0, (const unsigned char*) &r.index, 2 * sizeof(uint32_t)), buf + sizeof(r), r.size);
+  memcpy(buf, &r, sizeof(r));
+  if (fwrite(buf, sizeof(r) + r.size, 1, journal->file) != 1) { // Disk full or similar, stop journaling
+    seterr("Error writing journal");
+    puterr("Failed to write the download journal");
+    fclose(journal->file);
+    journal->file = NULL;
+    return;
+  }
+  journal->pending++;
+}
+
+/* Hand the appended records to the OS, and to the disk every JOURNAL_BATCH of them or if forced */
+void journal_flush(struct journal* journal, bool sync) {
+  if (journal->file == NULL) return;
+  fflush(journal->file);
+  if (!sync && journal->pending < JOURNAL_BATCH) return;
+#ifdef _WIN32
+  _commit(_fileno(journal->file));
+#else
+  fsync(fileno(journal->file));
+#endif
+  journal->pending = 0;
+}
+
+/* Close the journal, deleting it if the download it records is done with */
+void journal_close(struct journal* journal, bool done) {
+  if (journal->file != NULL) {
+    journal_flush(journal, true);
+    fclose(journal->file);
+    journal->file = NULL;
+  }
+  if (done && journal->filename != NULL) remove(journal->filename);
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "nprofilerlib.h"
+
+/**
+ * Log.
+ *
+ * Every thread logs to the same ring of LOG_CAPACITY records, overwriting
+ * the oldest ones, and the UI reads them back. Logging never locks nor
+ * allocates: a writer takes the next sequence number with one atomic add,
+ * which picks its slot, then claims the slot by marking it as being written
+ * (odd), formats its message straight into it and publishes it (even). A
+ * record costs the same however many there were before, and however many
+ * threads are logging.
+ *
+ * Readers never take anything out of the ring. They read a record by its
+ * sequence number, and check the slot still had it once copied, so a record
+ * overwritten meanwhile is skipped rather than torn. Records are formatted
+ * aside and copied in and out of their slot a word at a time with atomics,
+ * so a reader racing a writer is well defined, if pointless. A writer which finds
+ * its slot still being written a lap behind drops its record instead of
+ * waiting for it, which takes LOG_CAPACITY records logged during one write.
+ */
+
+#define LOG_WORDS (sizeof(struct log_record) / sizeof(uint64_t))
+
+struct log_slot {
+  uint64_t seq;               // 2 * n + 2 once record n is in, 2 * n + 1 while it's written
+  uint64_t record[LOG_WORDS]; // The struct log_record, in words read and written atomically
+};
+
+static_assert(sizeof(struct log_record) % sizeof(uint64_t) == 0, "Log records must be whole words");
+static_assert(sizeof(struct log_slot) == LOG_SLOT, "Log slot layout mismatch");
+static_assert((LOG_CAPACITY & (LOG_CAPACITY - 1)) == 0, "Log capacity must be a power of two");
+
+static struct log_slot ring[LOG_CAPACITY] __attribute__((aligned(64)));
+static uint64_t head    __attribute__((aligned(64))) = 0; // Records ever logged
+static uint64_t dropped = 0;                               // Records given up on
+static __thread const char* source = NULL;
+
+/* Name the records logged from now on by the calling thread, must outlive them */
+void log_thread(const char* name) {
+  source = name;
+}
+
+static uint64_t wall_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Log a message, printf style, truncated to fit a record */
+void log_write(enum levels level, const char* fmt, ...) {
+  uint64_t time = wall_us();
+  uint64_t n = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+  struct log_slot* slot = &ring[n & (LOG_CAPACITY - 1)];
+
+  struct log_record record;
+  memset(&record, 0, sizeof(record));
+  record.time   = time;
+  record.source = source;
+  record.level  = level;
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(record.message, sizeof(record.message), fmt, args);
+  va_end(args);
+  uint64_t words[LOG_WORDS];
+  memcpy(words, &record, sizeof(record));
+
+  /* Claim the slot, unless a writer a lap behind is still at it, or one a lap ahead got it */
+  uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+  do {
+    if ((seq & 1) || seq > 2 * n) {
+      __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  } while (!__atomic_compare_exchange_n(&slot->seq, &seq, 2 * n + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)); // The words go after
+  for (size_t i = 0; i < LOG_WORDS; i++) __atomic_store_n(&slot->record[i], words[i], __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+}
+
+/* Records logged so far, the next one will have this sequence number */
+uint64_t log_count() {
+  return __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+}
+
+/* Sequence number of the oldest record the ring may still have */
+uint64_t log_first() {
+  uint64_t count = log_count();
+  return count > LOG_CAPACITY ? count - LOG_CAPACITY : 0;
+}
+
+/* Records dropped because their slot was busy */
+uint64_t log_dropped() {
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+/**
+ * Copy a record by sequence number, returns false if it isn't in the ring,
+ * because it's been overwritten already or isn't done being written yet.
+ */
+bool log_read(uint64_t n, struct log_record* out) {
+  const struct log_slot* slot = &ring[n & (LOG_CAPACITY - 1)];
+  uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+  if (seq != 2 * n + 2) return false;
+  uint64_t words[LOG_WORDS];
+  for (size_t i = 0; i < LOG_WORDS; i++) words[i] = __atomic_load_n(&slot->record[i], __ATOMIC_ACQUIRE); // Before the check below
+  if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) return false;
+  memcpy(out, words, sizeof(struct log_record));
+  out->message[sizeof(out->message) - 1] = '\0';
+  return true;
+}
@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "curl/curl.h"
+#include "cJSON/cJSON.h"
+#include "nprofilerlib.h"
+
+/**
+ * Download metrics.
+ *
+ * Every finished transfer is timed by cURL, and its timings are split into
+ * spans: resolving the host, connecting, the TLS handshake (those three only
+ * on new connections), waiting for the server to answer, receiving the body,
+ * and the whole request. Decoding the response is timed by us. Each span
+ * goes to a histogram with HIST_STEPS log buckets per power of two of
+ * microseconds, so a percentile is off by a quarter of its power of two at
+ * worst, and recording one costs the same however long the download.
+ *
+ * Alongside are counters of events, of failures by kind and of responses by
+ * HTTP status, the bytes received, and the boards and bytes of the last
+ * RATE_SECONDS seconds for the throughput gauges. They're only written by
+ * the downloading thread, and every field is read and written atomically, so
+ * the UI can take a copy of them while the download goes on.
+ */
+
+#define STEP_BITS 2 // log2(HIST_STEPS)
+
+static_assert(1 << STEP_BITS == HIST_STEPS, "Histogram steps must be 1 << STEP_BITS");
+
+static const char* span_names[]    = { "dns", "connect", "tls", "wait", "body", "total", "parse" };
+static const char* event_names[]   = { "requests", "boards", "connects", "retries", "exhausted", "inactive", "holdoffs" };
+static const char* failure_names[] = { "server", "timeout", "network", "parse", "client" };
+
+static_assert(sizeof(span_names) / sizeof(*span_names) == SPAN_COUNT, "A name per span");
+static_assert(sizeof(event_names) / sizeof(*event_names) == EVENT_COUNT, "A name per event");
+static_assert(sizeof(failure_names) / sizeof(*failure_names) == FAIL_COUNT, "A name per failure");
+
+/* Monotonic microseconds, which unlike clock() keep going while we wait on the network */
+uint64_t now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Only the downloading thread writes, so these don't need to be read-modify-writes */
+static void add32(uint32_t* counter, uint32_t n) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static void add64(uint64_t* counter, uint64_t n) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static uint32_t get32(const uint32_t* counter) { return __atomic_load_n(counter, __ATOMIC_RELAXED); }
+static uint64_t get64(const uint64_t* counter) { return __atomic_load_n(counter, __ATOMIC_RELAXED); }
+static void set32(uint32_t* counter, uint32_t n) { __atomic_store_n(counter, n, __ATOMIC_RELAXED); }
+static void set64(uint64_t* counter, uint64_t n) { __atomic_store_n(counter, n, __ATOMIC_RELAXED); }
+
+/* Bucket of a latency: exact below HIST_STEPS, then HIST_STEPS per power of two */
+static unsigned int bucket(uint64_t us) {
+  if (us < HIST_STEPS) return us;
+  unsigned int power = 63 - __builtin_clzll(us);
+  unsigned int step  = (us >> (power - STEP_BITS)) & (HIST_STEPS - 1);
+  unsigned int index = (power - STEP_BITS + 1) * HIST_STEPS + step;
+  return index < HIST_POWERS * HIST_STEPS ? index : HIST_POWERS * HIST_STEPS - 1;
+}
+
+/* Largest latency of a bucket */
+static uint64_t bucket_top(unsigned int index) {
+  if (index < HIST_STEPS) return index;
+  unsigned int power = index / HIST_STEPS + STEP_BITS - 1;
+  uint64_t step = index % HIST_STEPS;
+  return ((HIST_STEPS + step + 1) << (power - STEP_BITS)) - 1;
+}
+
+/* Copy metrics which may be being written, e.g., to show them */
+void metrics_copy(struct metrics* dest, const struct metrics* src) {
+  dest->start = __atomic_load_n(&src->start, __ATOMIC_ACQUIRE);
+  dest->end   = __atomic_load_n(&src->end, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < SPAN_COUNT; i++) {
+    const struct histogram* from = &src->spans[i];
+    struct histogram* to = &dest->spans[i];
+    for (int k = 0; k < HIST_POWERS * HIST_STEPS; k++) to->buckets[k] = get32(&from->buckets[k]);
+    to->count = get64(&from->count);
+    to->sum   = get64(&from->sum);
+    to->max   = get64(&from->max);
+  }
+  for (int i = 0; i < EVENT_COUNT; i++) dest->events[i] = get32(&src->events[i]);
+  for (int i = 0; i < FAIL_COUNT; i++) dest->failures[i] = get32(&src->failures[i]);
+  for (int i = 0; i < HTTP_STATUS; i++) dest->status[i] = get32(&src->status[i]);
+  dest->bytes = get64(&src->bytes);
+  for (int i = 0; i < RATE_SECONDS; i++) {
+    dest->rate_second[i] = get64(&src->rate_second[i]);
+    dest->rate_bytes[i]  = get64(&src->rate_bytes[i]);
+    dest->rate_boards[i] = get32(&src->rate_boards[i]);
+  }
+}
+
+/* Start measuring a new download, field by field since the UI may be copying them */
+void metrics_reset(struct metrics* metrics) {
+  set64(&metrics->end, 0);
+  for (int i = 0; i < SPAN_COUNT; i++) {
+    struct histogram* h = &metrics->spans[i];
+    for (int k = 0; k < HIST_POWERS * HIST_STEPS; k++) set32(&h->buckets[k], 0);
+    set64(&h->count, 0);
+    set64(&h->sum, 0);
+    set64(&h->max, 0);
+  }
+  for (int i = 0; i < EVENT_COUNT; i++) set32(&metrics->events[i], 0);
+  for (int i = 0; i < FAIL_COUNT; i++) set32(&metrics->failures[i], 0);
+  for (int i = 0; i < HTTP_STATUS; i++) set32(&metrics->status[i], 0);
+  set64(&metrics->bytes, 0);
+  for (int i = 0; i < RATE_SECONDS; i++) {
+    set64(&metrics->rate_second[i], 0);
+    set64(&metrics->rate_bytes[i], 0);
+    set32(&metrics->rate_boards[i], 0);
+  }
+  __atomic_store_n(&metrics->start, now_us(), __ATOMIC_RELEASE);
+}
+
+/* The download is over, so its duration and throughput stop moving */
+void metrics_done(struct metrics* metrics) {
+  __atomic_store_n(&metrics->end, now_us(), __ATOMIC_RELEASE);
+}
+
+void metrics_event(struct metrics* metrics, enum events event) {
+  add32(&metrics->events[event], 1);
+}
+
+void metrics_failure(struct metrics* metrics, enum failures failure) {
+  add32(&metrics->failures[failure], 1);
+}
+
+void metrics_span(struct metrics* metrics, enum spans span, uint64_t us) {
+  struct histogram* h = &metrics->spans[span];
+  add32(&h->buckets[bucket(us)], 1);
+  add64(&h->count, 1);
+  add64(&h->sum, us);
+  if (us > get64(&h->max)) __atomic_store_n(&h->max, us, __ATOMIC_RELAXED);
+}
+
+/* Bucket of the throughput gauges for the current second, emptied if it held an older one */
+static unsigned int rate_bucket(struct metrics* metrics) {
+  uint64_t second = now_us() / 1000000;
+  unsigned int i = second % RATE_SECONDS;
+  if (get64(&metrics->rate_second[i]) != second) {
+    __atomic_store_n(&metrics->rate_bytes[i], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&metrics->rate_boards[i], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&metrics->rate_second[i], second, __ATOMIC_RELAXED);
+  }
+  return i;
+}
+
+/* Take the timings, status and size of a finished transfer from its handle */
+void metrics_transfer(struct metrics* metrics, CURL* curl, CURLcode code) {
+  long status = 0, connects = 0;
+  curl_off_t dns = 0, connect = 0, tls = 0, pretransfer = 0, start = 0, total = 0, size = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+  curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+  curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+  curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+  curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+  curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+  curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &start);
+  curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+  curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &size);
+
+  add32(&metrics->status[status > 0 && status < HTTP_STATUS ? status : 0], 1);
+  if (connects > 0 && connect > 0) { // A reused connection was set up by an earlier request
+    metrics_event(metrics, EVENT_CONNECT);
+    metrics_span(metrics, SPAN_DNS, dns);
+    metrics_span(metrics, SPAN_CONNECT, connect - dns);
+    if (tls > 0) metrics_span(metrics, SPAN_TLS, tls - connect);
+  }
+  if (code == CURLE_OK && start > 0) {
+    metrics_span(metrics, SPAN_WAIT, start - pretransfer);
+    metrics_span(metrics, SPAN_BODY, total - start);
+  }
+  metrics_span(metrics, SPAN_TOTAL, total);
+  add64(&metrics->bytes, size);
+  add64(&metrics->rate_bytes[rate_bucket(metrics)], size);
+}
+
+/* Account for a response replayed from a cache, as it was when recorded */
+void metrics_replay(struct metrics* metrics, long status, uint64_t latency, size_t size) {
+  add32(&metrics->status[status > 0 && status < HTTP_STATUS ? status : 0], 1);
+  metrics_span(metrics, SPAN_TOTAL, latency);
+  add64(&metrics->bytes, size);
+  add64(&metrics->rate_bytes[rate_bucket(metrics)], size);
+}
+
+/* A board was downloaded */
+void metrics_board(struct metrics* metrics) {
+  metrics_event(metrics, EVENT_BOARD);
+  add32(&metrics->rate_boards[rate_bucket(metrics)], 1);
+}
+
+/* Seconds the download took, or has taken so far */
+double metrics_seconds(const struct metrics* metrics) {
+  uint64_t start = __atomic_load_n(&metrics->start, __ATOMIC_ACQUIRE);
+  uint64_t end   = __atomic_load_n(&metrics->end, __ATOMIC_ACQUIRE);
+  if (start == 0) return 0;
+  return (double) ((end > 0 ? end : now_us()) - start) / 1000000;
+}
+
+/**
+ * Bytes and boards per second, over the last RATE_SECONDS seconds while
+ * the download goes on, and over all of it once it's done.
+ */
+void metrics_rates(const struct metrics* metrics, double* bytes, double* boards) {
+  double seconds = metrics_seconds(metrics);
+  *bytes  = 0;
+  *boards = 0;
+  if (seconds <= 0) return;
+  if (__atomic_load_n(&metrics->end, __ATOMIC_ACQUIRE) > 0) {
+    *bytes  = get64(&metrics->bytes) / seconds;
+    *boards = get32(&metrics->events[EVENT_BOARD]) / seconds;
+    return;
+  }
+
+  /* The buckets of the last RATE_SECONDS seconds, the current one being partial */
+  uint64_t now = now_us(), second = now / 1000000;
+  for (unsigned int i = 0; i < RATE_SECONDS; i++) {
+    if (get64(&metrics->rate_second[i]) + RATE_SECONDS <= second) continue;
+    *bytes  += get64(&metrics->rate_bytes[i]);
+    *boards += get32(&metrics->rate_boards[i]);
+  }
+  double window = RATE_SECONDS - 1 + (double) (now % 1000000) / 1000000;
+  if (window > seconds) window = seconds;
+  *bytes  /= window;
+  *boards /= window;
+}
+
+/* Latency under which a fraction of the samples are, to the top of its bucket */
+uint64_t histogram_percentile(const struct histogram* histogram, double fraction) {
+  uint64_t count = get64(&histogram->count), max = get64(&histogram->max);
+  if (count == 0) return 0;
+  uint64_t target = (uint64_t) (fraction * count + 0.5), seen = 0;
+  if (target < 1) target = 1;
+  for (unsigned int i = 0; i < HIST_POWERS * HIST_STEPS; i++) {
+    seen += get32(&histogram->buckets[i]);
+    if (seen >= target) return bucket_top(i) < max ? bucket_top(i) : max;
+  }
+  return max;
+}
+
+static cJSON* histogram_json(const struct histogram* histogram) {
+  cJSON* json = cJSON_CreateObject();
+  uint64_t count = get64(&histogram->count);
+  cJSON_AddNumberToObject(json, "count",   count);
+  cJSON_AddNumberToObject(json, "mean_us", count > 0 ? (double) get64(&histogram->sum) / count : 0);
+  cJSON_AddNumberToObject(json, "p50_us",  histogram_percentile(histogram, 0.50));
+  cJSON_AddNumberToObject(json, "p90_us",  histogram_percentile(histogram, 0.90));
+  cJSON_AddNumberToObject(json, "p99_us",  histogram_percentile(histogram, 0.99));
+  cJSON_AddNumberToObject(json, "max_us",  get64(&histogram->max));
+
+  /* Non-empty buckets, as [top microseconds, count] */
+  cJSON* buckets = cJSON_AddArrayToObject(json, "buckets");
+  for (unsigned int i = 0; i < HIST_POWERS * HIST_STEPS; i++) {
+    uint32_t n = get32(&histogram->buckets[i]);
+    if (n == 0) continue;
+    cJSON* pair = cJSON_CreateArray();
+    cJSON_AddItemToArray(pair, cJSON_CreateNumber(bucket_top(i)));
+    cJSON_AddItemToArray(pair, cJSON_CreateNumber(n));
+    cJSON_AddItemToArray(buckets, pair);
+  }
+  return json;
+}
+
+/* Every metric as JSON, to be freed with free() */
+char* metrics_json(const struct metrics* metrics) {
+  cJSON* json = cJSON_CreateObject();
+  double bytes, boards;
+  metrics_rates(metrics, &bytes, &boards);
+  cJSON_AddNumberToObject(json, "seconds", metrics_seconds(metrics));
+  cJSON_AddBoolToObject(json, "done", __atomic_load_n(&metrics->end, __ATOMIC_ACQUIRE) > 0);
+  cJSON_AddNumberToObject(json, "bytes", get64(&metrics->bytes));
+  cJSON_AddNumberToObject(json, "bytes_per_second", bytes);
+  cJSON_AddNumberToObject(json, "boards_per_second", boards);
+
+  cJSON* events = cJSON_AddObjectToObject(json, "events");
+  for (int i = 0; i < EVENT_COUNT; i++) cJSON_AddNumberToObject(events, event_names[i], get32(&metrics->events[i]));
+  cJSON* failures = cJSON_AddObjectToObject(json, "failures");
+  for (int i = 0; i < FAIL_COUNT; i++) cJSON_AddNumberToObject(failures, failure_names[i], get32(&metrics->failures[i]));
+  cJSON* status = cJSON_AddObjectToObject(json, "status");
+  for (int i = 0; i < HTTP_STATUS; i++) {
+    uint32_t n = get32(&metrics->status[i]);
+    if (n == 0) continue;
+    char code[8];
+    snprintf(code, sizeof(code), "%d", i); // 0 for no response
+    cJSON_AddNumberToObject(status, code, n);
+  }
+  cJSON* spans = cJSON_AddObjectToObject(json, "spans");
+  for (int i = 0; i < SPAN_COUNT; i++) cJSON_AddItemToObject(spans, span_names[i], histogram_json(&metrics->spans[i]));
+
+  char* text = cJSON_Print(json);
+  cJSON_Delete(json);
+  return text;
+}
@@ -22,9 +22,6 @@
 #define DATE_S 24 // Characters to store a date
 #define TIME_S 12 // Characters to store a time
 
-enum logtypes { INFO, WARN, ERROR };
-char* logbuf;
-
 // Win32 exceptions
 #if defined(_MSC_VER) && (_MSC_VER >= 1900) && !defined(IMGUI_DISABLE_WIN32_FUNCTIONS)
 #pragma comment(lib, "legacy_stdio_definitions")
@@ -47,33 +44,6 @@ void npp_time(char* dest, time_t t = 0, bool date = true) {
   dest[datebuf_s - 1] = 0;
 }
 
-void log(char** logbuf, const char* msg, enum logtypes type) {
-  // Retrieve and format time
-  char datebuf[TIME_S];
-  npp_time(datebuf, 0, false);
-
-  // Log type
-  char typebuf[9];
-  switch(type) {
-    case INFO:
-      sprintf(typebuf, "[INFO]  ");
-      break;
-    case WARN:
-      sprintf(typebuf, "[WARN]  ");
-      break;
-    case ERROR:
-      sprintf(typebuf, "[ERROR] ");
-      break;
-  }
-
-  // Concatenate new msg to existing log
-  *logbuf = (char*) realloc(*logbuf, strlen(*logbuf) + strlen(datebuf) + strlen(typebuf) + strlen(msg) + 1 + 1);
-  strcat(*logbuf, datebuf);
-  strcat(*logbuf, typebuf);
-  strcat(*logbuf, msg);
-  strcat(*logbuf, "\n");
-}
-
 static void Tooltip(const char* desc) {
   if (ImGui::IsItemHovered()) {
     ImGui::BeginTooltip();
@@ -131,91 +101,243 @@ static void make_table(const char* name, int rows, int cols, const char** row_he
   }
 }
 
-static void make_list(const char* name, const char** headers) {
-  ImGuiTableFlags flags = ImGuiTableFlags_Resizable | ImGuiTableFlags_BordersOuter | ImGuiTableFlags_RowBg;
+// Rows of a ranking, spread or list, only recomputed when what they depend on changes
+struct list {
+  struct row*  rows;
+  unsigned int count;
+  unsigned int cap;
+  int          key[8]; // Stats revision and filters they were computed with
+};
+
+static bool list_stale(struct list* list, const int key[8], unsigned int cap) {
+  if (list->rows != NULL && memcmp(list->key, key, sizeof(list->key)) == 0) return false;
+  memcpy(list->key, key, sizeof(list->key));
+  if (cap > list->cap) {
+    free(list->rows);
+    list->rows = (struct row*) calloc(cap, sizeof(struct row));
+    list->cap  = cap;
+  }
+  return true;
+}
+
+static void make_list(const char* name, const char** headers, const struct list* list, const char* fmt) {
+  ImGuiTableFlags flags = ImGuiTableFlags_Resizable | ImGuiTableFlags_BordersOuter | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY;
   if (ImGui::BeginTable(name, 3, flags, ImVec2(0, ImGui::GetTextLineHeightWithSpacing() * 21))) {
+    ImGui::TableSetupScrollFreeze(0, 1);
     ImGui::TableSetupColumn(headers[0], ImGuiTableColumnFlags_WidthFixed);
     ImGui::TableSetupColumn(headers[1], ImGuiTableColumnFlags_WidthStretch);
     ImGui::TableSetupColumn(headers[2], ImGuiTableColumnFlags_WidthFixed);
     ImGui::TableHeadersRow();
-    for (int i = 0; i < 20; i++) {
-      ImGui::TableNextRow();
-      ImGui::TableNextColumn();
-      ImGui::Text("%d", i);
-      ImGui::TableNextColumn();
-      ImGui::Text("%.25s", "-");
-      ImGui::TableNextColumn();
-      ImGui::Text("%.3f", 0.0f);;
+    ImGuiListClipper clipper;
+    clipper.Begin(list->count);
+    while (clipper.Step()) {
+      for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+        const struct row* row = &list->rows[i];
+        const char* player = row->player != NULL && row->player->name != NULL ? row->player->name : "-";
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", i);
+        ImGui::TableNextColumn();
+        if (row->block != NULL) {
+          ImGui::Text("%-10s %.25s", row->block->name, row->player != NULL ? player : "");
+        } else {
+          ImGui::Text("%.25s", player);
+        }
+        ImGui::TableNextColumn();
+        ImGui::Text(fmt, row->value);
+      }
     }
     ImGui::EndTable();
   }
 }
 
-static void make_leaderboard(const char* name, struct block* block) {
-  ImGuiTableFlags flags = ImGuiTableFlags_Resizable | ImGuiTableFlags_BordersOuter | ImGuiTableFlags_RowBg;
+static void make_leaderboard(const char* name, struct env* env, unsigned int index) {
+  ImGuiTableFlags flags = ImGuiTableFlags_Resizable | ImGuiTableFlags_BordersOuter | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY;
   if (ImGui::BeginTable(name, 3, flags, ImVec2(0, ImGui::GetTextLineHeightWithSpacing() * 21))) {
+    ImGui::TableSetupScrollFreeze(0, 1);
     ImGui::TableSetupColumn("Rank",   ImGuiTableColumnFlags_WidthFixed);
     ImGui::TableSetupColumn("Player", ImGuiTableColumnFlags_WidthStretch);
     ImGui::TableSetupColumn("Score",  ImGuiTableColumnFlags_WidthFixed);
     ImGui::TableHeadersRow();
-    bool has_scores = block != NULL && block->scores != NULL;
-    const char* name = NULL;
-    unsigned int score = -1;
-    for (int i = 0; i < 20; i++) {
-      if (has_scores) {
-        score = block->scores[i].score;
-        struct player* p = block->scores[i].player;
-        if (p != NULL) name = p->name;
+
+    /* Deep leaderboards are read a screenful of ranks at a time */
+    bool has_scores = index < env->bcount && env->blocks[index].tab->online;
+    unsigned int size = has_scores ? leaderboard_size(env, index) : 0;
+    ImGuiListClipper clipper;
+    clipper.Begin(size > BOARD_SIZE ? size : BOARD_SIZE);
+    while (clipper.Step()) {
+      struct standing page[64];
+      unsigned int count = 0;
+      for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+        unsigned int k = (i - clipper.DisplayStart) % 64;
+        if (k == 0) count = has_scores ? leaderboard_read(env, index, i, 64, page) : 0;
+        const char* player = k < count && page[k].player != NULL ? page[k].player->name : NULL;
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", i);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.25s", player == NULL ? "-" : player);
+        ImGui::TableNextColumn();
+        ImGui::Text("%10.3f", k >= count ? 0.0f : (float) page[k].score / 1000);
+      }
+    }
+    ImGui::EndTable();
+  }
+}
+
+/* Log records, the oldest ones first, kept scrolled to the newest unless scrolled up */
+static void make_log(float width, float height) {
+  static const ImVec4 colors[] = { ImVec4(0.8f, 0.8f, 0.8f, 1.0f), ImVec4(1.0f, 0.8f, 0.3f, 1.0f), ImVec4(1.0f, 0.4f, 0.4f, 1.0f) };
+  static const char* levels[]  = { "[INFO]  ", "[WARN]  ", "[ERROR] " };
+  static uint64_t shown = 0;
+  if (ImGui::BeginChild("##log", ImVec2(width, height), true)) {
+    uint64_t first = log_first(), count = log_count();
+    bool bottom = ImGui::GetScrollY() >= ImGui::GetScrollMaxY();
+    ImGuiListClipper clipper;
+    clipper.Begin((int) (count - first));
+    while (clipper.Step()) {
+      for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+        struct log_record record;
+        if (!log_read(first + i, &record)) { // Overwritten, or still being written
+          ImGui::TextUnformatted("");
+          continue;
+        }
+        char datebuf[TIME_S];
+        npp_time(datebuf, record.time / 1000000, false);
+        ImGui::TextUnformatted(datebuf);
+        ImGui::SameLine(0, 0);
+        ImGui::TextColored(colors[record.level], "%s", levels[record.level]);
+        ImGui::SameLine(0, 0);
+        ImGui::TextDisabled("%-9s", record.source != NULL ? record.source : "-");
+        ImGui::SameLine(0, 0);
+        ImGui::TextUnformatted(record.message);
       }
+    }
+    if (count != shown && bottom) ImGui::SetScrollHereY(1.0f);
+    shown = count;
+  }
+  ImGui::EndChild();
+}
+
+/* Latencies, counters and throughput of the last download, live while it goes on */
+static void make_metrics(const struct metrics* metrics) {
+  static const char* spans[]    = { "DNS", "Connect", "TLS", "Wait", "Body", "Total", "Parse" };
+  static const char* events[]   = { "Requests", "Boards", "Connections", "Retries", "Out of attempts", "Inactive ID", "Holdoffs" };
+  static const char* failures[] = { "Server", "Timeout", "Network", "Parse", "Client" };
+  double bytes, boards;
+  metrics_rates(metrics, &bytes, &boards);
+  ImGui::Text("%s %.1f s, %.1f boards/s, %.1f KB/s, %.1f MB received", metrics->end > 0 ? "Took" : "Running for",
+    metrics_seconds(metrics), boards, bytes / 1024, (double) metrics->bytes / (1024 * 1024));
+
+  ImGuiTableFlags flags = ImGuiTableFlags_BordersOuter | ImGuiTableFlags_RowBg;
+  if (ImGui::BeginTable("spans", 7, flags)) {
+    const char* headers[] = { "Span (ms)", "Count", "Mean", "p50", "p90", "p99", "Max" };
+    for (int i = 0; i < 7; i++) ImGui::TableSetupColumn(headers[i], i == 0 ? ImGuiTableColumnFlags_WidthStretch : ImGuiTableColumnFlags_WidthFixed);
+    ImGui::TableHeadersRow();
+    for (int i = 0; i < SPAN_COUNT; i++) {
+      const struct histogram* h = &metrics->spans[i];
       ImGui::TableNextRow();
-      ImGui::TableNextColumn();
-      ImGui::Text("%d", i);
-      ImGui::TableNextColumn();
-      char buf[25];
-      snprintf(buf, 25, "%s", name);
-      ImGui::Text("%.25s", name == NULL ? "-" : buf);
-      ImGui::TableNextColumn();
-      ImGui::Text("%10.3f", score == -1 ? 0.0f : (float) score / 1000);
+      ImGui::TableNextColumn(); ImGui::Text("%s", spans[i]);
+      ImGui::TableNextColumn(); ImGui::Text("%6lu", (unsigned long) h->count);
+      ImGui::TableNextColumn(); ImGui::Text("%8.2f", h->count > 0 ? (double) h->sum / h->count / 1000 : 0.0);
+      ImGui::TableNextColumn(); ImGui::Text("%8.2f", (double) histogram_percentile(h, 0.50) / 1000);
+      ImGui::TableNextColumn(); ImGui::Text("%8.2f", (double) histogram_percentile(h, 0.90) / 1000);
+      ImGui::TableNextColumn(); ImGui::Text("%8.2f", (double) histogram_percentile(h, 0.99) / 1000);
+      ImGui::TableNextColumn(); ImGui::Text("%8.2f", (double) h->max / 1000);
+    }
+    ImGui::EndTable();
+  }
+
+  /* Request latencies, from the fastest bucket to the slowest */
+  const struct histogram* total = &metrics->spans[SPAN_TOTAL];
+  int lo = HIST_POWERS * HIST_STEPS, hi = 0;
+  for (int i = 0; i < HIST_POWERS * HIST_STEPS; i++) {
+    if (total->buckets[i] == 0) continue;
+    if (i < lo) lo = i;
+    hi = i + 1;
+  }
+  float counts[HIST_POWERS * HIST_STEPS];
+  for (int i = lo; i < hi; i++) counts[i - lo] = total->buckets[i];
+  ImGui::PlotHistogram("", counts, hi > lo ? hi - lo : 0, 0, "Request latency, log scale", 0, FLT_MAX, ImVec2(ImGui::GetContentRegionAvail().x, 80));
+
+  if (ImGui::BeginTable("counters", 2, flags)) {
+    ImGui::TableNextRow();
+    ImGui::TableNextColumn();
+    for (int i = 0; i < EVENT_COUNT; i++) ImGui::Text("%-16s %6u", events[i], metrics->events[i]);
+    ImGui::TableNextColumn();
+    for (int i = 0; i < FAIL_COUNT; i++) ImGui::Text("%-8s failures %6u", failures[i], metrics->failures[i]);
+    for (int i = 0; i < HTTP_STATUS; i++) {
+      if (metrics->status[i] == 0) continue;
+      if (i == 0) ImGui::Text("No response      %6u", metrics->status[i]);
+      else ImGui::Text("HTTP %3d         %6u", i, metrics->status[i]);
     }
     ImGui::EndTable();
   }
 }
 
-static void download_scores(struct env* env, clock_t time, char* currdate)
+/* Concurrency limit of the downloads and its last rounds, with its settings, which apply right away */
+static void make_pacing(struct pacing* live) {
+  static struct pacing pacing;
+  pace_copy(&pacing, live);
+  ImGui::Text("%u of %u transfers at once, %u up, %u down, last %s. Latency %.1f ms, healthy %.1f ms",
+    pace_limit(&pacing), pacing.window, pacing.increases, pacing.decreases, pace_reason((enum paces) pacing.reason),
+    (double) pacing.latency / 1000, (double) pacing.baseline / 1000);
+
+  bool adaptive = pacing.adaptive;
+  if (ImGui::Checkbox("Adaptive", &adaptive)) __atomic_store_n(&live->adaptive, adaptive, __ATOMIC_RELAXED);
+  ImGui::SameLine();
+  int rate = pacing.rate;
+  if (ImGui::SliderInt("Requests/s (0 for no cap)", &rate, 0, 500)) __atomic_store_n(&live->rate, (uint32_t) rate, __ATOMIC_RELAXED);
+
+  /* Limit after each of the last rounds, oldest first */
+  unsigned int count = pacing.rounds < PACE_HISTORY ? pacing.rounds : PACE_HISTORY;
+  float limits[PACE_HISTORY];
+  for (unsigned int i = 0; i < count; i++) limits[i] = pacing.history[(pacing.rounds - count + 1 + i) % PACE_HISTORY];
+  ImGui::PlotLines("", limits, count, 0, "Transfers at once, by round", 0, (float) pacing.window, ImVec2(ImGui::GetContentRegionAvail().x, 60));
+}
+
+static void download_scores(struct env* env)
 {
-  /* Initialize variables */
+  /* Initialize variables, the loaded scores are cleared by the UI when it sees the new download */
+  log_thread("download");
   int* flags = (int*) &env->flags;
+  struct feed* feed = env->feed;
   sflag(flags, DownloadFlags_Busy);
   cflag(flags, DownloadFlags_Complete);
   sflag(flags, DownloadFlags_Download);
   cflag(flags, DownloadFlags_Paused);
-  env->lcount = 0;
   unsigned int obcount = 0;
   int ret_code;
   for (int i = 0; i < env->tcount; i++) {
     if (env->tabs[i].online) obcount += env->tabs[i].size;
     for (int j = 0; j < env->tabs[i].size; j++) {
-      env->tabs[i].blocks[j].updated   = false;
-      env->tabs[i].blocks[j].score     = -1;
-      env->tabs[i].blocks[j].rank      = -1;
-      env->tabs[i].blocks[j].tied_rank = -1;
-      env->tabs[i].blocks[j].copy->updated   = false;
-      env->tabs[i].blocks[j].copy->score     = -1;
-      env->tabs[i].blocks[j].copy->rank      = -1;
-      env->tabs[i].blocks[j].copy->tied_rank = -1;
-// TODO: Initialize scores as well
+      env->tabs[i].blocks[j].updated = false;
+      env->tabs[i].blocks[j].retries = 0;
     }
   }
-  while (env->lcount < obcount) {
+  retry_reset(env->curl);
+  metrics_reset(&env->curl->metrics);
+  pace_reset(&env->curl->pacing);
+  feed_reset(feed);
+
+  /* Pick up where an interrupted download left off */
+  struct journal journal;
+  int resumed = journal_open(&journal, env);
+  env->journal = &journal;
+  if (resumed > 0) {
+    feed_publish(feed, false);
+    log_write(LOG_INFO, "Resumed %d leaderboards from the last download.", resumed);
+  }
+  while (feed->count < obcount) {
     if (!gflag(flags, DownloadFlags_Download)) break;
     if (gflag(flags, DownloadFlags_Paused)) {
       std::this_thread::sleep_for(std::chrono::seconds(PAUSED));
       continue;
     }
-    for (int i = 0; i < env->tcount; i++)
-      for (int j = 0; j < env->tabs[i].size; j++)
-        env->tabs[i].blocks[j].retries = 0;
+    retry_failed(env->curl); // Another round for the blocks that ran out of attempts
     ret_code = update_scores(env);
+    feed_publish(feed, false);
+    journal_flush(&journal, true);
     if (ret_code == -1) {
       sflag(flags, DownloadFlags_PopupInactive);
       sflag(flags, DownloadFlags_Paused);
@@ -226,19 +348,26 @@ static void download_scores(struct env* env, clock_t time, char* currdate)
       sflag(flags, DownloadFlags_Paused);
       continue;
     }
+    if (feed->count < obcount && !gflag(flags, DownloadFlags_Paused) && gflag(flags, DownloadFlags_Download)) {
+      /* Nothing left to try yet some blocks are missing, ask rather than spin */
+      log_write(LOG_WARN, "Download ended with %u of %u leaderboards.", feed->count, obcount);
+      sflag(flags, DownloadFlags_PopupFailed);
+      sflag(flags, DownloadFlags_Paused);
+    }
   }
-  if (env->lcount == obcount) {
+  feed_publish(feed, feed->count == obcount);
+  metrics_done(&env->curl->metrics);
+  env->journal = NULL;
+  journal_close(&journal, feed->count == obcount); // Kept to resume a cancelled download
+  if (feed->count == obcount) {
     sflag(flags, DownloadFlags_Complete);
-    char buf[64];
-    sprintf(buf, "Downloaded scores successfully in %.3f seconds.", ((float)(clock() - time)) / CLOCKS_PER_SEC);
-    log(&logbuf, (const char*) buf, INFO);
-    npp_time(currdate);
+    log_write(LOG_INFO, "Downloaded scores successfully in %.3f seconds.", metrics_seconds(&env->curl->metrics));
   } else {
     cflag(flags, DownloadFlags_Complete);
     if (gflag(flags, DownloadFlags_Download)) {
-      log(&logbuf, "Scores failed to download completely.", ERROR);
+      log_write(LOG_ERROR, "Scores failed to download completely.");
     } else {
-      log(&logbuf, "Scores download cancelled.", INFO);
+      log_write(LOG_INFO, "Scores download cancelled.");
     }
   }
   cflag(flags, DownloadFlags_Busy);
@@ -306,81 +435,53 @@ int main(int, char**)
   // Background
   ImVec4 clear_color = ImVec4(0.0586f, 0.0586f, 0.0586f, 0.9375f);
 
-  /* Logging */
-  logbuf = (char*) calloc(80, sizeof(char));
-  log(&logbuf, "Initialized program.", INFO);
+  /* Logging, from the main thread */
+  log_thread("main");
+  log_write(LOG_INFO, "Initialized program.");
 
   /* Prepare main variables */
-  unsigned int bcount  = L_COUNT + E_COUNT; // Block count
+  unsigned int bcount  = BLOCK_COUNT;       // Block count
   unsigned int tcount  = TAB_COUNT;         // Tab count
   unsigned int obcount = 0;                 // Count of blocks to be downloaded
-  unsigned int pcount  = 0;                 // Player count
   unsigned int scount  = 0;                 // Score count
   unsigned int lcount  = 0;                 // Leaderboard count
 
   struct profile* profile  = (struct profile*) calloc(1,            sizeof(struct profile));
-  struct block* blocks_raw = (struct block*)   calloc(bcount,       sizeof(struct block));
+  struct block* blocks     = (struct block*)   calloc(bcount,       sizeof(struct block));
   struct tab* tabs         = (struct tab*)     calloc(tcount,       sizeof(struct tab));
   create_tabs(tabs);
 
   for (int i = 0; i < tcount; i++) if (tabs[i].online) obcount += tabs[i].size;
-  struct score* scores     = (struct score*)   calloc(20 * obcount, sizeof(struct score));
-  struct player* players   = (struct player*)  calloc(PLAYER_MAX, sizeof(struct player));
+  struct registry* players = (struct registry*) calloc(1, sizeof(struct registry));
+  registry_init(players);
 
   /* Initialize program and load configuration. */
   initialize();
-  struct config* config = parse_config(players, &pcount);
-  log(&logbuf, "Read configuration file.", INFO);
+  struct config* config = parse_config(players);
+  log_write(LOG_INFO, "Read configuration file.");
 
   /* Initialize cURL */
   struct curl* curl = (struct curl*) calloc(1, sizeof(struct curl));
   if (curlinit(curl) != 0) {
     puterr("cURL could not be initialized.");
-    log(&logbuf, "cURL could not be initialized.", ERROR);
+    log_write(LOG_ERROR, "cURL could not be initialized.");
     kill(1);
   }
 
-  /* Read nprofile */
-  unsigned char *f;
-  int size = read(&f, FILENAME);
+  /* Map nprofile */
+  struct mapping savefile;
+  int size = savefile_open(&savefile, FILENAME);
   if (size == 0) {
     puterr("Error reading nprofile");
-    log(&logbuf, "Error reading nprofile", ERROR);
+    log_write(LOG_ERROR, "Error reading nprofile");
     kill(1);
   }
   if (size != FILESIZE) {
     puterr("Incorrect nprofile size");
-    log(&logbuf, "Incorrect nprofile size, information may be incorrect.", WARN);
+    log_write(LOG_WARN, "Incorrect nprofile size, information may be incorrect.");
     kill(1);
   }
 
-  /* Parse nprofile */
-  fill_blocks(tabs, tcount, blocks_raw, scores);
-  parse_tabs(f, tabs);
-  parse_profile(f, profile);
-  log(&logbuf, "Parsed savefile.", INFO);
-
-  /* Create block duplicate, which will be used for reordering in place, printing... */
-  struct block* blocks = (struct block*) calloc(bcount, sizeof(struct block));
-  memcpy(blocks, blocks_raw, bcount * sizeof(struct block));
-  for (int i = 0; i < bcount; i++) {
-    blocks_raw[i].copy = &blocks[i];
-    blocks[i].copy = &blocks[i];
-  }
-
-  /* Other state variables */
-  static int board_index     = 0;
-  static bool busy           = false;   // Are we downloading or loading scores?
-  static bool refresh        = false;   // Refresh rankings, etc on this frame
-  static bool complete       = false;   // Whether the currently downloaded scores are complete or not
-  static bool popup_inactive = false;   // Show the "Inactive Steam ID" popup
-  static bool popup_failed   = false;   // Show the "Failed download" popup
-  static bool download       = false;   // Download the scores
-  static bool paused         = false;   // Pause download of scores
-  static clock_t time        = clock(); // Current time, for benchmarking
-  char* currdate = (char*) calloc(DATE_S, sizeof(char)); // For displaying in the currently loaded scores
-  strcpy(currdate, "None");
-
   /* Store everything inside the working environment */
   struct env env = (struct env) {
     config,
@@ -389,17 +490,52 @@ int main(int, char**)
     tabs,
     blocks,
     players,
-    scores,
+    {},
+    {},
     tcount,
     bcount,
-    pcount,
     scount,
     lcount,
     (DownloadFlags) 0
   };
+  store_init(&env.store, bcount);
+  entries_init(&env.entries, bcount);
+
+  /* Parse nprofile */
+  fill_blocks(tabs, tcount, blocks, &env.store);
+  parse_tabs(savefile.data, &env);
+  parse_profile(savefile.data, profile);
+  log_write(LOG_INFO, "Parsed savefile.");
 
-  /* Free memory storing nprofile */
-  free(f);
+  /* Rows of the main table, as block indices in display order */
+  unsigned int* perm = (unsigned int*) calloc(bcount, sizeof(unsigned int));
+  for (int i = 0; i < bcount; i++) perm[i] = i;
+
+  /* Other state variables */
+  static int board_index     = 0;
+  static bool busy           = false;   // Are we downloading or loading scores?
+  static bool refresh        = false;   // Refresh rankings, etc on this frame
+  static bool complete       = false;   // Whether the currently downloaded scores are complete or not
+  static bool popup_inactive = false;   // Show the "Inactive Steam ID" popup
+  static bool popup_failed   = false;   // Show the "Failed download" popup
+  static bool download       = false;   // Download the scores
+  static bool paused         = false;   // Pause download of scores
+  static struct stats stats  = {};      // Per-player aggregates for the global stats
+  char* currdate = (char*) calloc(DATE_S, sizeof(char)); // For displaying in the currently loaded scores
+  strcpy(currdate, "None");
+
+  /* Downloads are published by the download thread and applied at the start of each frame */
+  struct feed feed;
+  struct reader reader;
+  feed_init(&feed, bcount);
+  reader_init(&reader, 0, bcount);
+  env.feed = &feed;
+
+  /* Unmap nprofile, and watch it for the game's saves */
+  savefile_close(&savefile);
+  struct watcher watcher;
+  if (watch_open(&watcher, &env, FILENAME) != 0) log_write(LOG_WARN, "Can't watch nprofile, restart to see new saves.");
+  bool reload = false; // A save couldn't be applied, nprofile is loaded again once no download runs
 
   /* Do things */
   //compute_tab(tabs);      // Calculate total SI level score
@@ -438,6 +574,23 @@ int main(int, char**)
     int win3_w = WIDTH;
     int win3_h = HEIGHT - win1_h;
     int* dflags = (int*) &env.flags;
+
+    /* Pick up the boards downloaded since last frame, stats follow the scores */
+    if (feed_sync(&feed, &reader, &env) && reader.complete) npp_time(currdate, config->time);
+    stats_update(&stats, &env);
+
+    /* Pick up the blocks changed by the game's last save, the leaderboards and stats don't depend on them */
+    int polled = watch_poll(&watcher, &env);
+    bool saved = polled > 0;
+    if (polled < 0) reload = true;
+    if (reload && !gflag(dflags, DownloadFlags_Busy)) { // Not while a download reads the block IDs
+      watch_close(&watcher);
+      if (watch_open(&watcher, &env, FILENAME) != 0) log_write(LOG_WARN, "Can't watch nprofile, restart to see new saves.");
+      watcher.count  = env.bcount;
+      watcher.orders = -1;
+      saved  = true;
+      reload = false;
+    }
     {
       /* Header */
       create_window("scores", win1_x, win1_y, win1_w, win1_h);
@@ -492,8 +645,7 @@ int main(int, char**)
         if (gflag(dflags, DownloadFlags_Busy)) {
           ImGui::OpenPopup("Busy");
         } else {
-          time     = clock();
-          std::thread downloader(download_scores, &env, time, currdate);
+          std::thread downloader(download_scores, &env);
           downloader.detach();
         }
       }
@@ -700,7 +852,7 @@ int main(int, char**)
         ImGui::SameLine(ImGui::GetWindowWidth() / 2 - 60);
         if (ImGui::Button("OK", ImVec2(120, 0))) {
           // TODO: Update env->config here
-          // TODO: Also update env->players and therefore env->blocks and env->scores, wherever players are referenced
+          // TODO: Also update env->players and therefore env->entries, wherever players are referenced
           for (int i = 0; i < hacker_count; i++) {
             free(hacker_names[i]);
             free(hacker_ids[i]);
@@ -751,11 +903,11 @@ int main(int, char**)
         ImGui::TableSetupColumn(NULL, ImGuiTableColumnFlags_WidthFixed);
         ImGui::TableNextRow();
         ImGui::TableNextColumn();
-        ImGui::InputTextMultiline("##log", logbuf, IM_ARRAYSIZE(logbuf), ImVec2(ImGui::GetWindowWidth() - 100, ImGui::GetTextLineHeightWithSpacing() * 4), ImGuiInputTextFlags_ReadOnly);
+        make_log(ImGui::GetWindowWidth() - 100, ImGui::GetTextLineHeightWithSpacing() * 4);
         ImGui::TableNextColumn();
         ImGui::Text("Database:");
         ImGui::Text("Boards  - %5d", env.lcount);
-        ImGui::Text("Players - %5d", env.pcount);
+        ImGui::Text("Players - %5d", env.players->count);
         ImGui::Text("Scores  - %5d", env.scount);
         ImGui::EndTable();
       }
@@ -831,51 +983,58 @@ int main(int, char**)
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text("Type"); ImGui::TableNextColumn();
               static int leaderboard_type = 0;
-              ImGui::RadioButton("Level", &leaderboard_type, 0); ImGui::SameLine();
-              ImGui::RadioButton("Episode", &leaderboard_type, 1); ImGui::SameLine();
-              ImGui::RadioButton("Story", &leaderboard_type, 2);
+              bool picked = false;
+              picked |= ImGui::RadioButton("Level", &leaderboard_type, 0); ImGui::SameLine();
+              picked |= ImGui::RadioButton("Episode", &leaderboard_type, 1); ImGui::SameLine();
+              picked |= ImGui::RadioButton("Story", &leaderboard_type, 2);
 
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text("Tab"); ImGui::TableNextColumn();
               static int leaderboard_tab = 0;
-              ImGui::RadioButton("SI", &leaderboard_tab, 0); ImGui::SameLine();
-              ImGui::RadioButton("S",  &leaderboard_tab, 1); ImGui::SameLine();
-              ImGui::RadioButton("SU", &leaderboard_tab, 2); ImGui::SameLine();
-              ImGui::RadioButton("SL", &leaderboard_tab, 3); ImGui::SameLine();
-              ImGui::RadioButton("?",  &leaderboard_tab, 4); ImGui::SameLine();
-              ImGui::RadioButton("!",  &leaderboard_tab, 5);
+              picked |= ImGui::RadioButton("SI", &leaderboard_tab, 0); ImGui::SameLine();
+              picked |= ImGui::RadioButton("S",  &leaderboard_tab, 1); ImGui::SameLine();
+              picked |= ImGui::RadioButton("SU", &leaderboard_tab, 2); ImGui::SameLine();
+              picked |= ImGui::RadioButton("SL", &leaderboard_tab, 3); ImGui::SameLine();
+              picked |= ImGui::RadioButton("?",  &leaderboard_tab, 4); ImGui::SameLine();
+              picked |= ImGui::RadioButton("!",  &leaderboard_tab, 5);
 
               // TODO: Disable this if we're on stories
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text("Row"); ImGui::TableNextColumn();
               static int leaderboard_row = 0;
-              ImGui::RadioButton("A", &leaderboard_row, 0); ImGui::SameLine();
-              ImGui::RadioButton("B", &leaderboard_row, 1); ImGui::SameLine();
-              ImGui::RadioButton("C", &leaderboard_row, 2); ImGui::SameLine();
-              ImGui::RadioButton("D", &leaderboard_row, 3); ImGui::SameLine();
-              ImGui::RadioButton("E", &leaderboard_row, 4); ImGui::SameLine();
-              ImGui::RadioButton("X", &leaderboard_row, 5);
+              picked |= ImGui::RadioButton("A", &leaderboard_row, 0); ImGui::SameLine();
+              picked |= ImGui::RadioButton("B", &leaderboard_row, 1); ImGui::SameLine();
+              picked |= ImGui::RadioButton("C", &leaderboard_row, 2); ImGui::SameLine();
+              picked |= ImGui::RadioButton("D", &leaderboard_row, 3); ImGui::SameLine();
+              picked |= ImGui::RadioButton("E", &leaderboard_row, 4); ImGui::SameLine();
+              picked |= ImGui::RadioButton("X", &leaderboard_row, 5);
 
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text("Column"); ImGui::TableNextColumn();
               static int leaderboard_col = 0;
               ImGui::PushButtonRepeat(true);
-              if (ImGui::ArrowButton("##left", ImGuiDir_Left) && leaderboard_col > 0) leaderboard_col--;
+              if (ImGui::ArrowButton("##left", ImGuiDir_Left) && leaderboard_col > 0) { leaderboard_col--; picked = true; }
               ImGui::SameLine();
               ImGui::Text("%02d", leaderboard_col);
               ImGui::SameLine();
-              if (ImGui::ArrowButton("##right", ImGuiDir_Right) && leaderboard_col < 19) leaderboard_col++;
+              if (ImGui::ArrowButton("##right", ImGuiDir_Right) && leaderboard_col < 19) { leaderboard_col++; picked = true; }
               ImGui::PopButtonRepeat();
 
               // TODO: Disable this if we're on episodes or stories
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text("Level"); ImGui::TableNextColumn();
               static int leaderboard_level = 0;
-              ImGui::RadioButton("00", &leaderboard_level, 0); ImGui::SameLine();
-              ImGui::RadioButton("01", &leaderboard_level, 1); ImGui::SameLine();
-              ImGui::RadioButton("02", &leaderboard_level, 2); ImGui::SameLine();
-              ImGui::RadioButton("03", &leaderboard_level, 3); ImGui::SameLine();
-              ImGui::RadioButton("04", &leaderboard_level, 4);
+              picked |= ImGui::RadioButton("00", &leaderboard_level, 0); ImGui::SameLine();
+              picked |= ImGui::RadioButton("01", &leaderboard_level, 1); ImGui::SameLine();
+              picked |= ImGui::RadioButton("02", &leaderboard_level, 2); ImGui::SameLine();
+              picked |= ImGui::RadioButton("03", &leaderboard_level, 3); ImGui::SameLine();
+              picked |= ImGui::RadioButton("04", &leaderboard_level, 4);
+
+              /* Jump to the block picked, if there's one there */
+              if (picked) {
+                int found = catalogue_find((enum types) leaderboard_type, (enum tabs) leaderboard_tab, leaderboard_row, leaderboard_col, leaderboard_level);
+                if (found >= 0) board_index = found;
+              }
 
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text(" ");
@@ -884,8 +1043,8 @@ int main(int, char**)
 
               ImGui::EndTable();
             }
-            int tab_offset = &blocks_raw[board_index] - &blocks_raw[board_index].tab->blocks[0];
-            int tab_size = blocks_raw[board_index].tab->size;
+            int tab_offset = &blocks[board_index] - &blocks[board_index].tab->blocks[0];
+            int tab_size = blocks[board_index].tab->size;
             ImGui::Text(" "); ImGui::SameLine(ImGui::GetContentRegionAvail().x * 0.35f);
             ImGui::PushButtonRepeat(true);
             if (ImGui::ArrowButton("##left", ImGuiDir_Left)) {
@@ -896,7 +1055,7 @@ int main(int, char**)
               }
             }
             ImGui::SameLine();
-            ImGui::Text("%10s", blocks_raw[board_index].name); ImGui::SameLine();
+            ImGui::Text("%10s", blocks[board_index].name); ImGui::SameLine();
             if (ImGui::ArrowButton("##right", ImGuiDir_Right)) {
               if (tab_offset < tab_size - 1) {
                 board_index++;
@@ -907,14 +1066,17 @@ int main(int, char**)
             ImGui::PopButtonRepeat();
             ImGui::PopStyleVar();
 
-            make_leaderboard("leaderboards", &blocks_raw[board_index]);
+            make_leaderboard("leaderboards", &env, board_index);
             ImGui::EndTabItem();
           }
           if (ImGui::BeginTabItem("Rankings")) {
+            static bool tabs[6] = { true, true, true, true, true, true };
+            static bool types[3] = { true, true, false };
+            static int ranking = 0;
+            static int ranking_rank = 3;
+            static int ranking_ties = 0;
             ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(2, 0));
             if (ImGui::BeginTable("g_rankings", 2, ImGuiTableFlags_SizingPolicyFixedX | ImGuiTableFlags_BordersInnerV)) {
-              static bool tabs[6] = { true, true, true, true, true, true };
-              static bool types[3] = { true, true, false };
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text("Types"); ImGui::TableNextColumn();
               ImGui::Checkbox("Levels",   &types[0]); ImGui::SameLine();
@@ -932,8 +1094,6 @@ int main(int, char**)
 
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text("Ranking"); ImGui::TableNextColumn();
-              static int ranking = 0;
-              static int ranking_rank = 3;
               ImGui::RadioButton("0ths",           &ranking, 0); ImGui::SameLine();
               ImGui::RadioButton("Top20s",         &ranking, 1); ImGui::SameLine();
               ImGui::RadioButton("Top10s",         &ranking, 2); ImGui::SameLine();
@@ -946,7 +1106,6 @@ int main(int, char**)
 
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text("Ties"); ImGui::TableNextColumn();
-              static int ranking_ties = 0;
               ImGui::RadioButton("Yes", &ranking_ties, 0); ImGui::SameLine();
               ImGui::RadioButton("No",  &ranking_ties, 1);
 
@@ -958,15 +1117,27 @@ int main(int, char**)
               ImGui::EndTable();
             }
             ImGui::PopStyleVar();
-            const char* col_headers3[3] = { "Rank", "Player", "Count" };
-            make_list("rankings", col_headers3);
+            static struct list list = {};
+            static const unsigned int cutoffs[8] = { 1, 20, 10, 5, 0, 0, 0, 0 };
+            static const enum rankings rankings[8] = { TOPS, TOPS, TOPS, TOPS, TOTAL_SCORE, POINTS, AVG_POINTS, TOPS };
+            unsigned int mask = stats_mask(&env, types, tabs);
+            unsigned int cutoff = ranking == 7 ? ranking_rank : cutoffs[ranking];
+            int key[8] = { (int) stats.revision, (int) mask, ranking, (int) cutoff, ranking_ties };
+            if (list_stale(&list, key, stats.pcount)) {
+              list.count = stats_ranking(&stats, &env, rankings[ranking], mask, cutoff, ranking_ties == 0, list.rows);
+            }
+            const char* col_headers3[3] = { "Rank", "Player", ranking == 4 || ranking == 6 ? "Value" : "Count" };
+            make_list("rankings", col_headers3, &list, ranking == 4 || ranking == 6 ? "%.3f" : "%.0f");
             ImGui::EndTabItem();
           }
           if (ImGui::BeginTabItem("Spreads")) {
+            static bool tabs[6] = { true, true, true, true, true, true };
+            static bool types[3] = { true, true, false };
+            static int spread_order = 0;
+            static int spread_range_inf = 0;
+            static int spread_range_sup = 19;
             ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(2, 0));
             if (ImGui::BeginTable("g_spreads", 2, ImGuiTableFlags_SizingPolicyFixedX | ImGuiTableFlags_BordersInnerV)) {
-              static bool tabs[6] = { true, true, true, true, true, true };
-              static bool types[3] = { true, true, false };
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text("Types"); ImGui::TableNextColumn();
               ImGui::Checkbox("Levels",   &types[0]); ImGui::SameLine();
@@ -984,14 +1155,11 @@ int main(int, char**)
 
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text("Order"); ImGui::TableNextColumn();
-              static int spread_order = 0;
               ImGui::RadioButton("Biggest", &spread_order, 0); ImGui::SameLine();
               ImGui::RadioButton("Smallest",  &spread_order, 1);
 
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text("Range"); ImGui::TableNextColumn();
-              static int spread_range_inf = 0;
-              static int spread_range_sup = 19;
               ImGui::Text("From "); ImGui::SameLine();
               RangeInt(&spread_range_inf, 2, 0, 19, ""); ImGui::SameLine();
               ImGui::Text(" to "); ImGui::SameLine();
@@ -1009,15 +1177,26 @@ int main(int, char**)
               ImGui::EndTable();
             }
             ImGui::PopStyleVar();
+            static struct list list = {};
+            unsigned int mask = stats_mask(&env, types, tabs);
+            int key[8] = { (int) stats.revision, (int) mask, spread_order, spread_range_inf, spread_range_sup };
+            if (list_stale(&list, key, env.bcount)) {
+              list.count = stats_spreads(&env, mask, spread_range_inf, spread_range_sup, spread_order == 1, list.rows);
+            }
             const char* col_headers3[3] = { "Rank", "Player", "Time" };
-            make_list("spreads", col_headers3);
+            make_list("spreads", col_headers3, &list, "%.3f");
             ImGui::EndTabItem();
           }
           if (ImGui::BeginTabItem("Lists")) {
+            static bool tabs[6] = { true, true, true, true, true, true };
+            static bool types[3] = { true, true, false };
+            static int list = 0;
+            static int list_rank = 3;
+            static int list_range_inf = 0;
+            static int list_range_sup = 19;
+            static int ranking_ties = 0;
             ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(2, 0));
             if (ImGui::BeginTable("g_lists", 2, ImGuiTableFlags_SizingPolicyFixedX | ImGuiTableFlags_BordersInnerV)) {
-              static bool tabs[6] = { true, true, true, true, true, true };
-              static bool types[3] = { true, true, false };
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text("Types"); ImGui::TableNextColumn();
               ImGui::Checkbox("Levels",   &types[0]); ImGui::SameLine();
@@ -1035,8 +1214,6 @@ int main(int, char**)
 
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text("List"); ImGui::TableNextColumn();
-              static int list = 0;
-              static int list_rank = 3;
               if (ImGui::BeginTable("g_lists_internal", 2, ImGuiTableFlags_SizingPolicyFixedX)) {
                 ImGui::TableNextRow(); ImGui::TableNextColumn();
                 ImGui::RadioButton("Top20s",         &list, 0); ImGui::TableNextColumn();
@@ -1053,8 +1230,6 @@ int main(int, char**)
                 ImGui::EndTable();
               }
               ImGui::RadioButton("Other:",         &list, 8); ImGui::SameLine();
-              static int list_range_inf = 0;
-              static int list_range_sup = 19;
               ImGui::Text("From "); ImGui::SameLine();
               RangeInt(&list_range_inf, 2, 0, 19, ""); ImGui::SameLine();
               ImGui::Text(" to "); ImGui::SameLine();
@@ -1062,15 +1237,30 @@ int main(int, char**)
 
               ImGui::TableNextRow(); ImGui::TableNextColumn();
               ImGui::Text("Ties"); ImGui::TableNextColumn();
-              static int ranking_ties = 0;
               ImGui::RadioButton("Yes", &ranking_ties, 0); ImGui::SameLine();
               ImGui::RadioButton("No",  &ranking_ties, 1);
 
               ImGui::EndTable();
             }
             ImGui::PopStyleVar();
-            const char* col_headers4[3] = { "Rank", "Player", "Score" };
-            make_list("lists", col_headers4);
+            static struct list list_rows = {};
+            static const int ranges[8][2] = { { 0, 19 }, { 0, 19 }, { 0, 9 }, { 0, 9 }, { 0, 4 }, { 0, 4 }, { 0, 0 }, { 0, 0 } };
+            unsigned int mask = stats_mask(&env, types, tabs);
+            int inf = list == 8 ? list_range_inf : ranges[list][0];
+            int sup = list == 8 ? list_range_sup : ranges[list][1];
+            int key[8] = { (int) stats.revision, (int) mask, list, inf, sup, ranking_ties };
+            if (list_stale(&list_rows, key, env.bcount)) {
+              list_rows.count = stats_lists(&env, mask, inf, sup, list < 8 && list % 2 == 1, ranking_ties == 0, list_rows.rows);
+            }
+            const char* col_headers4[3] = { "Rank", "Level", "Score" };
+            make_list("lists", col_headers4, &list_rows, "%.3f");
+            ImGui::EndTabItem();
+          }
+          if (ImGui::BeginTabItem("Downloads")) {
+            static struct metrics metrics;
+            metrics_copy(&metrics, &curl->metrics);
+            make_pacing(&curl->pacing);
+            make_metrics(&metrics);
             ImGui::EndTabItem();
           }
           ImGui::EndTabBar();
@@ -1089,24 +1279,11 @@ int main(int, char**)
       static bool modes[4]    = { true, false, false, false };
       static bool orders[7]   = { true, false, false, false, false, false, false };
       static bool rev_order   = false;
-      static int block_count  = 0;
-      static int scored_count = 0;
-      static int ranked_count = 0;
-      static int total_atts   = 0;
-      static int total_vics   = 0;
-      static int total_gold   = 0;
-      static int total_score  = 0;
-      static int total_rank   = 0;
-      static float avg_atts   = -1;
-      static float avg_vics   = -1;
-      static float avg_gold   = -1;
-      static float avg_score  = -1;
-      static float avg_rank   = -1;
       const char* titles[4]   = { "Tabs", "Types", "Modes", "States" };
       const char* s_states[3] = { "Locked", "Unlocked", "Completed" };
       const char* headers[7]  = { "ID", "State", "Attempts", "Victories", "Gold", "Score", "Rank" };
       int table_lines         = 28;
-      static bool reorder     = true; // Detect if checkboxes has been pressed to change filters
+      static struct view view = {};   // Filtered rows and footer, rebuilt when filters, order or scores change
 
       /* Header */
       create_window("savefile", win2_x, win2_y, win2_w, win2_h);
@@ -1130,20 +1307,19 @@ int main(int, char**)
       ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(2, 0));
       ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(2, 0));
       for (int i = 0; i < 6; i++) {
-                   reorder |= ImGui::Checkbox(s_tabs[i],   &tabs[i]);   ImGui::NextColumn();
-        if (i < 3) reorder |= ImGui::Checkbox(s_types[i],  &types[i]);  ImGui::NextColumn();
-        if (i < 4) reorder |= ImGui::Checkbox(s_modes[i],  &modes[i]);  ImGui::NextColumn();
-        if (i < 3) reorder |= ImGui::Checkbox(s_states[i], &states[i]);
-        if (i == 5) ImGui::Text("         Results: %d", block_count);
+                   view.dirty |= ImGui::Checkbox(s_tabs[i],   &tabs[i]);   ImGui::NextColumn();
+        if (i < 3) view.dirty |= ImGui::Checkbox(s_types[i],  &types[i]);  ImGui::NextColumn();
+        if (i < 4) view.dirty |= ImGui::Checkbox(s_modes[i],  &modes[i]);  ImGui::NextColumn();
+        if (i < 3) view.dirty |= ImGui::Checkbox(s_states[i], &states[i]);
+        if (i == 5) ImGui::Text("         Results: %u", view.count);
         ImGui::NextColumn();
       }
-      reorder = true;
       ImGui::PopStyleVar(2);
       ImGui::Columns(1);
       ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Note: To obtain scores and ranks, download the scores and provide your Steam ID.");
 
       /* Table */
-      static ImGuiTableFlags table_flags = ImGuiTableFlags_Resizable  | ImGuiTableFlags_RowBg | ImGuiTableFlags_Sortable
+      static ImGuiTableFlags table_flags = ImGuiTableFlags_Resizable  | ImGuiTableFlags_RowBg | ImGuiTableFlags_Sortable | ImGuiTableFlags_MultiSortable
             | ImGuiTableFlags_BordersOuter | ImGuiTableFlags_BordersV | ImGuiTableFlags_ScrollY;
       if (ImGui::BeginTable("blocks", 7, table_flags, ImVec2(0, ImGui::GetTextLineHeightWithSpacing() * table_lines), 0.0f)) {
         /* Create columns */
@@ -1157,11 +1333,17 @@ int main(int, char**)
         ImGui::TableSetupScrollFreeze(0, 1); // Header always visible after scrolling
 
         /* Sort data */
+        static unsigned int sorted = 1u << ID;                                     // Orders sorted by, 1 << enum orders
+        if (saved) view.dirty = true;                                              // Refilter the rows, states or footer may have changed
         if (ImGuiTableSortSpecs* sorts_specs = ImGui::TableGetSortSpecs()) {       // Try to obtain table sorting specs
+          if (saved && (watcher.orders & sorted)) sorts_specs->SpecsDirty = true;  // Resort only if the save changed a sorted column
           if (sorts_specs->SpecsDirty) {                                           // Detect if sorting is required
-            if (sorts_specs->SpecsCount > 0) {                                     // At least one column needs sorting
+            sorted = 0;
+            struct sort_key keys[7];                                               // Columns to sort by, in priority order
+            int kcount = 0;
+            for (int k = 0; k < sorts_specs->SpecsCount && kcount < 7; k++) {
+              const ImGuiTableSortSpecsColumn* sort_spec = &sorts_specs->Specs[k];
               enum orders order = ID;
-              const ImGuiTableSortSpecsColumn* sort_spec = &sorts_specs->Specs[0]; // Obtain sorting specs of one column
               switch(sort_spec->ColumnIndex) {                                     // Determine which column it is
                 case 0:
                   order = ID;
@@ -1184,52 +1366,31 @@ int main(int, char**)
                 default:
                   order = ID;
               }
-              bool reverse = sort_spec->SortDirection == ImGuiSortDirection_Descending;
-              blksort(blocks, bcount, order, reverse);                             // Perform the sort
+              keys[kcount++] = (struct sort_key) { order, sort_spec->SortDirection == ImGuiSortDirection_Descending };
+              sorted |= 1u << order;
             }
+            sort_blocks(&env.store, bcount, keys, kcount, perm);                 // Sort the rows, blocks stay in place
+            view.dirty = true;
             sorts_specs->SpecsDirty = false;
           }
         }
 
-        /* Display data */
-        if (reorder) {
-          block_count  = 0;
-          scored_count = 0;
-          ranked_count = 0;
-          total_atts   = 0;
-          total_vics   = 0;
-          total_gold   = 0;
-          total_score  = 0;
-          total_rank   = 0;
-        }
+        /* Display only the visible rows */
+        view_update(&view, &env, perm, tabs, types, modes, states);
         ImGui::TableHeadersRow();
-        for (int i = 0; i < bcount; i++) {
-          if (types[blocks[i].tab->type] && modes[blocks[i].tab->mode] && tabs[blocks[i].tab->tab] && states[blocks[i].state]) {
-            if (reorder) {
-              block_count++;
-              total_atts  += blocks[i].attempts;
-              total_vics  += blocks[i].victories + blocks[i].victories_ep;
-              total_gold  += blocks[i].gold;
-              if (blocks[i].score < 1000 * MAX_SCORE) {
-                scored_count++;
-                total_score += blocks[i].score;
-              }
-              if (blocks[i].rank < 20) {
-                ranked_count++;
-                total_rank += blocks[i].rank;
-              }
-            }
+        ImGuiListClipper clipper;
+        clipper.Begin(view.count);
+        while (clipper.Step()) {
+          for (int r = clipper.DisplayStart; r < clipper.DisplayEnd; r++) {
+            int i = view.rows[r];
             ImGui::TableNextRow(); ImGui::TableNextColumn();
-            char buf[10];
-            sprintf(buf, "%s", blocks[i].name);
-            ImGui::Selectable(buf, false, ImGuiSelectableFlags_SpanAllColumns);
-            if (ImGui::IsItemClicked()) {
-              for (int j = 0; j < bcount; j++) {
-                if (blocks_raw[j].tab == blocks[i].tab && blocks_raw[j].id == blocks[i].id) board_index = j;
-              }
-            }
+            ImGui::PushID(i);
+            ImGui::Selectable(blocks[i].name, false, ImGuiSelectableFlags_SpanAllColumns);
+            if (ImGui::IsItemClicked()) board_index = i;
+            ImGui::PopID();
             ImGui::TableNextColumn();
-            switch(blocks[i].state) {
+            const struct store* st = &env.store;
+            switch(st->state[i]) {
               case 0:
                 ImGui::Text("Locked");
                 break;
@@ -1243,30 +1404,15 @@ int main(int, char**)
                 ImGui::Text("Unknown");
             }
             ImGui::TableNextColumn();
-            ImGui::Text("%d", blocks[i].attempts);                           ImGui::TableNextColumn();
-            ImGui::Text("%d", blocks[i].victories + blocks[i].victories_ep); ImGui::TableNextColumn();
-            ImGui::Text("%d", blocks[i].gold);                               ImGui::TableNextColumn();
-            blocks[i].score > 1000 * MAX_SCORE ? ImGui::Text("-") : ImGui::Text("%.3f", (float) blocks[i].score / 1000); ImGui::TableNextColumn();
-            blocks[i].rank > 19 ? ImGui::Text("-") : ImGui::Text("%d", blocks[i].rank);
+            ImGui::Text("%d", st->attempts[i]);                        ImGui::TableNextColumn();
+            ImGui::Text("%d", st->victories[i] + st->victories_ep[i]); ImGui::TableNextColumn();
+            ImGui::Text("%d", st->gold[i]);                            ImGui::TableNextColumn();
+            st->score[i] > 1000 * MAX_SCORE ? ImGui::Text("-") : ImGui::Text("%.3f", (float) st->score[i] / 1000); ImGui::TableNextColumn();
+            st->rank[i] == (uint32_t) -1 ? ImGui::Text("-") : ImGui::Text("%d", st->rank[i]);
           }
         }
         ImGui::EndTable();
       }
-      if (reorder) {
-        if (block_count > 0) {
-          avg_atts  = (float) total_atts  / block_count;
-          avg_vics  = (float) total_vics  / block_count;
-          avg_gold  = (float) total_gold  / block_count;
-          avg_score = scored_count > 0 ? (float) total_score / scored_count : -1;
-          avg_rank  = ranked_count > 0 ? (float) total_rank  / ranked_count : -1;
-        } else {
-          avg_atts  = -1;
-          avg_vics  = -1;
-          avg_gold  = -1;
-          avg_score = -1;
-          avg_rank  = -1;
-        }
-      }
 
       /* Table footer */
       static ImGuiTableFlags footer_flags = ImGuiTableFlags_Resizable | ImGuiTableFlags_BordersOuter;
@@ -1282,20 +1428,20 @@ int main(int, char**)
         ImGui::TableNextRow();
         ImGui::TableNextColumn();
         ImGui::Text("Total"); ImGui::TableNextColumn(); ImGui::TableNextColumn();
-        ImGui::Text("%d", total_atts); ImGui::TableNextColumn();
-        ImGui::Text("%d", total_vics); ImGui::TableNextColumn();
-        ImGui::Text("%d", total_gold); ImGui::TableNextColumn();
-        scored_count > 0 ? ImGui::Text("%.3f", (float) total_score / 1000) : ImGui::Text("-"); ImGui::TableNextColumn();
-        ranked_count > 0 ? ImGui::Text("%d", total_rank) : ImGui::Text("-");
+        ImGui::Text("%u", view.atts); ImGui::TableNextColumn();
+        ImGui::Text("%u", view.vics); ImGui::TableNextColumn();
+        ImGui::Text("%u", view.gold); ImGui::TableNextColumn();
+        view.scored > 0 ? ImGui::Text("%.3f", (double) view.score / 1000) : ImGui::Text("-"); ImGui::TableNextColumn();
+        view.ranked > 0 ? ImGui::Text("%u", view.rank) : ImGui::Text("-");
 
         ImGui::TableNextRow(); ImGui::TableNextColumn();
         ImGui::Text("Avg."); ImGui::TableNextColumn(); ImGui::TableNextColumn();
-        if (block_count > 0) {
-          ImGui::Text("%.3f", avg_atts);  ImGui::TableNextColumn();
-          ImGui::Text("%.3f", avg_vics);  ImGui::TableNextColumn();
-          ImGui::Text("%.3f", avg_gold);  ImGui::TableNextColumn();
-          avg_score >= 0 ? ImGui::Text("%.3f", avg_score / 1000) : ImGui::Text("-"); ImGui::TableNextColumn();
-          avg_rank >= 0 ? ImGui::Text("%.3f", avg_rank) : ImGui::Text("-");
+        if (view.count > 0) {
+          ImGui::Text("%.3f", (float) view.atts / view.count);  ImGui::TableNextColumn();
+          ImGui::Text("%.3f", (float) view.vics / view.count);  ImGui::TableNextColumn();
+          ImGui::Text("%.3f", (float) view.gold / view.count);  ImGui::TableNextColumn();
+          view.scored > 0 ? ImGui::Text("%.3f", (double) view.score / view.scored / 1000) : ImGui::Text("-"); ImGui::TableNextColumn();
+          view.ranked > 0 ? ImGui::Text("%.3f", (float) view.rank / view.ranked) : ImGui::Text("-");
         } else {
           for (int i = 0; i < 5; i++) {
             ImGui::Text("-");
@@ -1306,7 +1452,6 @@ int main(int, char**)
         ImGui::EndTable();
       }
 
-      reorder = false;
       ImGui::End();
     }
 
@@ -1330,16 +1475,35 @@ int main(int, char**)
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
     glfwSwapBuffers(window);
+
+    /* The save is on screen now */
+    if (saved) {
+      watch_shown(&watcher);
+      log_write(LOG_INFO, "Savefile changed %u blocks, shown %.1f ms after saving.", watcher.count, ((double) watcher.shown - watcher.saved) / 1000);
+    }
   }
 
+  /* Stop the download thread before freeing what it uses */
+  int* dflags = (int*) &env.flags;
+  cflag(dflags, DownloadFlags_Download);
+  while (gflag(dflags, DownloadFlags_Busy)) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
   /* Free memory */
+  watch_close(&watcher);
   free(currdate);
+  reader_free(&reader);
+  feed_free(&feed);
+  stats_free(&stats);
+  map_close(&env.map);
   curldestroy(curl);
   free(curl);
-  free(scores);
+  store_free(&env.store);
+  entries_free(&env.entries);
   free(tabs);
-  playerdealloc(&players, pcount);
+  registry_free(players);
+  free(players);
   blockdealloc(&blocks, bcount);
+  free(perm);
   free(profile);
 
   /* Cleanup */
@@ -4,34 +4,40 @@
 #include <string.h>
 #include <limits.h>
 #include <stdbool.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "curl/curl.h"
-#include "cJSON/cJSON.h"
 #include "nprofilerlib.h"
 
 #ifdef _MSC_VER
 #define strdup(p) _strdup(p)
 #endif
 
-/* Global variables (I know, ugly!) */
-enum orders mainorder = ID;    // Order to sort main table (used in blkcmp and blksort)
-bool mainorder_rev    = false; // Sort main table in reverse order
-
-// Buffer to store the last error msg, function to print an error msg.
-char* errbuffer;
-void seterr(const char* msg) { memcpy(errbuffer, msg, ERRBUF_SIZE); }
-void puterr(const char* msg) { printf("[ERROR] %s: %s.\n", msg, errbuffer); }
+// Last error msg of the thread, function to log and print an error msg.
+static __thread char errbuffer[ERRBUF_SIZE + 1];
+void seterr(const char* msg) { snprintf(errbuffer, sizeof(errbuffer), "%s", msg); }
+void puterr(const char* msg) {
+  log_write(LOG_ERROR, "%s: %s.", msg, errbuffer);
+  printf("[ERROR] %s: %s.\n", msg, errbuffer);
+}
 
-// Buffer to store the last log msg, function to print a log msg.
-char* logbuffer;
-void setlog(const char* msg) { memcpy(logbuffer, msg, LOGBUF_SIZE); }
-void putlog(const char* msg) { printf("[INFO] %s: %s.\n", msg, logbuffer); }
+// Last log msg of the thread, function to log and print a log msg.
+static __thread char logbuffer[LOGBUF_SIZE + 1];
+void setlog(const char* msg) { snprintf(logbuffer, sizeof(logbuffer), "%s", msg); }
+void putlog(const char* msg) {
+  log_write(LOG_INFO, "%s: %s.", msg, logbuffer);
+  printf("[INFO] %s: %s.\n", msg, logbuffer);
+}
 
 // Initialize program
 void initialize() {
-  // Create error and log buffers
-  errbuffer = (char*) calloc(ERRBUF_SIZE + 1, sizeof(char));
-  logbuffer = (char*) calloc(LOGBUF_SIZE + 1, sizeof(char));
+  // Records logged from here on come from the main thread
+  log_thread("main");
 }
 
 // Exit the program, 0 for success.
@@ -131,6 +137,41 @@ void* arradd(char* arr, char* elm, int* count, int sz, int i) {
   return arr;
 }
 
+// Growable buffer, capacity doubles so appending n bytes costs O(n) overall
+void buffer_init(struct buffer* buf, size_t cap) {
+  buf->data = (char*) malloc(cap + 1);
+  buf->data[0] = 0;
+  buf->len = 0;
+  buf->cap = cap;
+}
+
+bool buffer_append(struct buffer* buf, const char* data, size_t len) {
+  if (buf->len + len > buf->cap) {
+    size_t cap = buf->cap > 0 ? buf->cap : BUFFER_SIZE;
+    while (cap < buf->len + len) cap *= 2;
+    char* grown = (char*) realloc(buf->data, cap + 1);
+    if (grown == NULL) return false;
+    buf->data = grown;
+    buf->cap  = cap;
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  buf->data[buf->len] = 0;
+  return true;
+}
+
+void buffer_clear(struct buffer* buf) {
+  buf->len = 0;
+  if (buf->data != NULL) buf->data[0] = 0;
+}
+
+void buffer_free(struct buffer* buf) {
+  free(buf->data);
+  buf->data = NULL;
+  buf->len  = 0;
+  buf->cap  = 0;
+}
+
 // Auxiliar functions to concatenate memory
 void memcat(unsigned char* dest, unsigned char* src, unsigned int sz, unsigned int* offset) {
   if (src != NULL) memcpy((void*) (dest + *offset), src, sz);
@@ -150,21 +191,10 @@ void memcatul(unsigned char* dest, uint64_t src, unsigned int* offset) {
   memcat(dest, (unsigned char*) &src, sizeof(uint64_t), offset);
 }
 
-void playerdealloc(struct player** players, size_t sz) {
-  for (int i = 0; i < sz; i++) {
-    if ((*players)[i].name != NULL) {
-      free((void*) (*players)[i].name);
-      (*players)[i].name = NULL;
-    }
-  }
-  free(*players);
-  *players = NULL;
-}
-
 bool is_hacker(struct config* config, struct player* player) {
   if (!player || !config) return false;
   for (int i = 0; i < config->hacker_count; i++) {
-    if (config->hackers[i].id == player->id || (player->name != NULL && config->cheaters[i].name != NULL && strcmp(config->hackers[i].name, player->name) == 0)) return true;
+    if (config->hackers[i].id == player->id || (player->name != NULL && config->hackers[i].name != NULL && strcmp(config->hackers[i].name, player->name) == 0)) return true;
   }
   return false;
 }
@@ -177,15 +207,12 @@ bool is_cheater(struct config* config, struct player* player) {
   return false;
 }
 
-/* Adds player in place or, if left by default, initializes values */
-// TODO: Allocate more space if it's needed here (we'll have to change the arguments)
-void add_player(struct config* config, struct player* player, unsigned int id = -1, const char* name = NULL) {
-  player->id      = id;
-  player->name    = name != NULL ? strdup(name) : NULL;
-  player->count   = 0;
-  player->scores  = NULL;
+/* Adds a new player to the registry, which grows as needed */
+struct player* add_player(struct registry* reg, struct config* config, unsigned int id, const char* name) {
+  struct player* player = registry_insert(reg, id, name);
   player->cheater = is_cheater(config, player);
   player->hacker  = is_hacker(config, player);
+  return player;
 }
 
 // Save config file
@@ -216,7 +243,7 @@ int save_config(struct config* config) {
 }
 
 // Read config file
-struct config* parse_config(struct player* players, unsigned int* pcount) {
+struct config* parse_config(struct registry* players) {
   /* Initialize struct */
   struct config* config = (struct config*) calloc(1, sizeof(struct config));
 
@@ -267,23 +294,14 @@ struct config* parse_config(struct player* players, unsigned int* pcount) {
     115572, // Mishu
     201322  // dimitry008
   };
-  // TODO: Use add_player here
   for (int i = 0; i < cheater_count; i++) {
-    players[*pcount].name    = strdup(cheater_names[i]);
-    players[*pcount].id      = cheater_ids[i];
-    players[*pcount].hacker  = false;
-    players[*pcount].cheater = true;
-    (*pcount)++;
+    add_player(players, NULL, cheater_ids[i], cheater_names[i])->cheater = true;
     cheaters[i].name    = strdup(cheater_names[i]);
     cheaters[i].id      = cheater_ids[i];
     cheaters[i].cheater = true;
   }
   for (int i = 0; i < hacker_count; i++) {
-    players[*pcount].name   = strdup(hacker_names[i]);
-    players[*pcount].id     = hacker_ids[i];
-    players[*pcount].hacker  = true;
-    players[*pcount].cheater = false;
-    (*pcount)++;
+    add_player(players, NULL, hacker_ids[i], hacker_names[i])->hacker = true;
     hackers[i].name       = strdup(hacker_names[i]);
     hackers[i].id         = hacker_ids[i];
     hackers[i].hacker     = true;
@@ -317,392 +335,177 @@ struct config* parse_config(struct player* players, unsigned int* pcount) {
   return config;
 }
 
-// TODO: Change "putlog" by actual modal windows
-int parse_scores(struct env* env) {
-  /* Attempt to read the file */
+/**
+ * Map a file read-only, so only the pages we actually touch are ever loaded
+ * in memory. Falls back to reading the whole file where mmap is not available.
+ * Returns the size of the file, 0 on error.
+ */
+int map_open(struct mapping* map, const char* filename) {
+  map->data   = NULL;
+  map->size   = 0;
+  map->mapped = false;
+#ifdef _WIN32
   unsigned char* f;
-  int fsize = read(&f, SCORES);
-  if (fsize == 0) { // Generic error, e.g., file doesn't exist
-    putlog("Failed to load scores");
-    return 1;
-  }
-
-  /* Make rutinary checks */
-  if (fsize < 24) { // Not enough bytes to contain main header
-    putlog("Scores file is corrupt");
-    return 1;
-  }
-  if (memcmp(f, &MAGIC, 4) != 0) { // First 4 bytes are not magic number
-    putlog("Not an N++CC file");
-    return 1;
-  }
-  if (f[4] != 1) { // File is not of the correct type
-    putlog("Not a scores file");
-    return 1;
-  }
-
-  /* Parse header */
-  unsigned int psize = *(unsigned int*)(f +  8); // Player count (4B)
-  unsigned int tsize = *(unsigned int*)(f + 12); // Tab count (4B)
-  env->config->time  = *(time_t*)      (f + 16); // UNIX timestamp (8B)
-
-  /* Initialize variables */
-  unsigned int offset = 24;
-  fsize -= 24;
-  unsigned int pmax = PLAYER_MAX >= psize ? PLAYER_MAX : psize;
-  playerdealloc(&env->players, env->pcount);
-  env->players = (struct player*) calloc(pmax, sizeof(struct player));
-  env->pcount = 0;
-  for (int i = 0; i < pmax; i++) {
-    add_player(env->config, env->players + i);
+  int size = read(&f, filename);
+  if (size == 0) return 0;
+  map->data = f;
+  map->size = size;
+  return size;
+#else
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    seterr("Error opening file");
+    return 0;
   }
-  env->scount = 0;
-  env->lcount = 0;
-
-  /* Parse players */
-  for (int i = 0; i < psize; i++) {
-    if (fsize < sizeof(int) + 1) { // Not enough bytes to contain another player (id + null char)
-      putlog("Scores file is corrupt");
-      return 1;
-    }
-    unsigned int id = *(unsigned int*)(f + offset);
-    const char* name = (const char*)(f + offset + sizeof(int));
-    add_player(env->config, env->players + i, id, name);
-    offset += sizeof(int) + strlen(name) + 1;
-    fsize  -= sizeof(int) + strlen(name) + 1;
-    env->pcount++;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    seterr("Error reading file");
+    close(fd);
+    return 0;
   }
-
-  /* Parse scores */
-  for (int i = 0; i < tsize; i++) {
-    /* Tab header */
-    if (fsize < 8) { // Not enough bytes to contain tab header
-      putlog("Scores file is corrupt");
-      return 1;
-    }
-    char t_platform     =         *(char*)(f + offset);
-    char t_mode         =         *(char*)(f + offset + 1);
-    char t_type         =         *(char*)(f + offset + 2);
-    char t_tab          =         *(char*)(f + offset + 3);
-    unsigned int t_size = *(unsigned int*)(f + offset + 4);
-    int stride = t_size * (4 * sizeof(int) + 20 * 3 * sizeof(int)); // Theoretical size of tab info in scores file
-    printf("stride %d\n", 8 + stride);
-    offset += 8;
-    fsize  -= 8;
-
-    /* Find tab */
-    struct tab* tab = NULL;
-    for (int j = 0; j < env->tcount; j++) {
-      struct tab* t = &env->tabs[j];
-      if (t->platform == t_platform && t->mode == t_mode && t->type == t_type && t->tab == t_tab && t->size == t_size && t->online) tab = t;
-    }
-    if (tab == NULL) { // Tab not found, not parsing
-      offset += stride;
-      fsize  -= stride;
-      if (fsize < 0) {  // Not enough bytes to contain tab scores
-        putlog("Scores file is corrupt");
-        return 1;
-      } else {
-        continue;
-      }
-    }
-    fsize -= stride;
-    if (fsize < 0) { // Not enough bytes to contain tab scores
-      putlog("Scores file is corrupt");
-      return 1;
-    }
-
-    /* Tab scores */
-    struct block* block    = NULL;
-    struct block* bcopy    = NULL;
-    struct score* scores   = NULL;
-    struct score* cscores  = NULL;
-    struct player* player  = NULL;
-    unsigned int index     = -1;
-    unsigned int replay_id = -1;
-    unsigned int score     = -1;
-    unsigned int curscore  = -1;
-    unsigned int rank      = -1;
-    unsigned int tied_rank = -1;
-    bool hacker            = false;
-    bool cheater           = false;
-    for (int j = 0; j < tab->size; j++) {
-      /* Main block info */
-      block = &tab->blocks[j];
-      bcopy = block->copy;
-      block->rank      = *(unsigned int*)(f + offset + 0 * sizeof(int));
-      block->tied_rank = *(unsigned int*)(f + offset + 1 * sizeof(int));
-      block->replay    = *(unsigned int*)(f + offset + 2 * sizeof(int));
-      block->score     = *(unsigned int*)(f + offset + 3 * sizeof(int));
-      bcopy->rank      = block->rank;
-      bcopy->tied_rank = block->tied_rank;
-      bcopy->replay    = block->replay;
-      bcopy->score     = block->score;
-      offset += 4 * sizeof(int);
-
-      /* 20 leaderboard scores */
-      scores    = block->scores;
-      cscores   = bcopy->scores;
-      rank      = -1;
-      tied_rank = -1;
-      env->lcount++;
-      for (int k = 0; k < 20; k++) {
-        /* Discard empty scores */
-        index     = *(unsigned int*)(f + offset + 0 * sizeof(int));
-        replay_id = *(unsigned int*)(f + offset + 1 * sizeof(int));
-        score     = *(unsigned int*)(f + offset + 2 * sizeof(int));
-        if (index == -1 && replay_id == -1 && score == -1) {
-          offset += 3 * sizeof(int);
-          continue;
-        }
-
-        /* Ignore hackers and cheaters if necessary */
-        if (index != -1) {
-          player  = env->players + index;
-          hacker  = player != NULL ? player->hacker  : false;
-          cheater = player != NULL ? player->cheater : false;
-          int* flags = (int*) &env->config->flags;
-          if (hacker && gflag(flags, HackerFlags_RemoveScores) || cheater && gflag(flags, CheaterFlags_RemoveScores)) {
-            offset += 3 * sizeof(int);
-            continue;
-          }
-        }
-
-        /* Parse values */
-        rank++;
-        if (score != curscore) {
-          tied_rank++;
-          curscore = score;
-        }
-        scores[rank].score      = score;
-        scores[rank].player     = player;
-        scores[rank].replay_id  = replay_id;
-        scores[rank].rank       = rank;
-        scores[rank].tied_rank  = tied_rank;
-        cscores[rank].score     = score;
-        cscores[rank].player    = player;
-        cscores[rank].replay_id = replay_id;
-        cscores[rank].rank      = rank;
-        cscores[rank].tied_rank = tied_rank;
-        env->scount++;
-        offset += 3 * sizeof(int);
-      }
-
-      /* Fill remaining empty spots (due to hackers and cheaters) with initialized scores */
-      while (++rank < 20) {
-        scores[rank].score      = -1;
-        scores[rank].player     = NULL;
-        scores[rank].replay_id  = -1;
-        scores[rank].rank       = -1;
-        scores[rank].tied_rank  = -1;
-        cscores[rank].score     = -1;
-        cscores[rank].player    = NULL;
-        cscores[rank].replay_id = -1;
-        cscores[rank].rank      = -1;
-        cscores[rank].tied_rank = -1;
-      }
-    }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // The mapping keeps its own reference to the file
+  if (data == MAP_FAILED) {
+    seterr("Error mapping file");
+    return 0;
   }
+  map->data   = (const unsigned char*) data;
+  map->size   = st.st_size;
+  map->mapped = true;
+  return st.st_size;
+#endif
+}
 
-  /* Cleanup */
-  free(f);
-  putlog("Loaded scores file");
-  return 0;
+void map_close(struct mapping* map) {
+  if (map->data == NULL) return;
+#ifndef _WIN32
+  if (map->mapped) munmap((void*) map->data, map->size);
+  else free((void*) map->data);
+#else
+  free((void*) map->data);
+#endif
+  map->data = NULL;
+  map->size = 0;
+}
+
+/* Tell the kernel which part of a mapping we're about to read */
+void map_advise(struct mapping* map, size_t offset, size_t size, bool sequential) {
+#ifndef _WIN32
+  if (!map->mapped || offset >= map->size) return;
+  size_t page  = sysconf(_SC_PAGESIZE);
+  size_t start = offset & ~(page - 1);
+  size_t end   = offset + size < map->size ? offset + size : map->size;
+  madvise((char*) map->data + start, end - start, sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+#endif
 }
 
-int save_scores(struct env* env) {
-  size_t sz = 3 * sizeof(int) + 4 * sizeof(char) + sizeof(uint64_t); // Main header + Player count + Tab count + UNIX time
-  for (int i = 0; i < env->pcount; i++) sz += sizeof(int) + strlen(env->players[i].name) + 1; // ID + Name + Null char
-  for (int i = 0; i < env->tcount; i++) {
-    sz += 4 * sizeof(char) + sizeof(int);           // Tab header
-    sz += 4 * sizeof(int) * env->tabs[i].size;      // Block info (rank, tied rank, replay id, score)
-    sz += 3 * sizeof(int) * 20 * env->tabs[i].size; // Scores (player, replay id, rank)
+/**
+ * Open the savefile for reading. We only read the header and a few scattered
+ * block regions of its 70 MB, so those are prefetched and nothing else.
+ */
+int savefile_open(struct mapping* sf, const char* filename) {
+  int size = map_open(sf, filename);
+  if (size == 0) return 0;
+#ifndef _WIN32
+  if (sf->mapped) madvise((void*) sf->data, sf->size, MADV_RANDOM);
+#endif
+  for (int i = 0; i < TAB_COUNT; i++) { // The regions of the tabs, which have gaps between them
+    map_advise(sf, catalogue.items[catalogue.first[i]].offset, catalogue.tabs[i].size * BLOCK_SIZE, false);
   }
-  unsigned char* data = (unsigned char*) calloc(sz, sizeof(unsigned char));
-  unsigned int offset = 0;
+  return size;
+}
 
-  /* Header */
-  memcat(data, (unsigned char*) MAGIC, 4, &offset); // Magic number
-  memcatc(data,     1, &offset);                    // Filetype (0 for config, 1 for scores)
-  memcatc(data, MAJOR, &offset);                    // Major version of the program
-  memcatc(data, MINOR, &offset);                    // Minor version
-  memcatc(data, PATCH, &offset);                    // Patch version
-  memcati(data, (int) env->pcount, &offset);        // Player count
-  memcati(data, (int) env->tcount, &offset);        // Tab count
-  memcatul(data, (uint64_t) time(NULL), &offset);   // UNIX time
-
-  /* Players */
-  for (int i = 0; i < env->pcount; i++) {
-    memcati(data, env->players[i].id,   &offset);
-    memcats(data, env->players[i].name, &offset);
-  }
+void savefile_close(struct mapping* sf) {
+  map_close(sf);
+}
 
-  /* Tabs w/ scores */
-  struct tab* tab       = NULL;
-  struct block* block   = NULL;
-  struct score* scores  = NULL;
-  struct player* player = NULL;
-  for (int i = 0; i < env->tcount; i++) {
-    tab = &env->tabs[i];
-    memcatc(data, (char) tab->platform, &offset);
-    memcatc(data, (char) tab->mode,     &offset);
-    memcatc(data, (char) tab->type,     &offset);
-    memcatc(data, (char) tab->tab,      &offset);
-    memcati(data, tab->size, &offset);
-    for (int j = 0; j < tab->size; j++) {
-      block = &tab->blocks[j];
-      memcati(data, block->rank,      &offset);
-      memcati(data, block->tied_rank, &offset);
-      memcati(data, block->replay,    &offset);
-      memcati(data, block->score,     &offset);
-      scores = block->scores;
-      for (int k = 0; k < 20; k++) {
-        player = scores[k].player;
-        memcati(data, player != NULL ? player - env->players : -1, &offset);
-        memcati(data, scores[k].replay_id,                         &offset);
-        memcati(data, scores[k].score,                             &offset);
-      }
-    }
-  }
+/* Typed views of the savefile regions */
+const struct record* savefile_records(const unsigned char* f, enum types type) {
+  unsigned int offset = type == LEVEL ? L_OFFSET : (type == EPISODE ? E_OFFSET : S_OFFSET);
+  return (const struct record*) (f + offset);
+}
 
-  /* Save scores file */
-  unsigned int result = save(data, offset, SCORES);
-  free(data);
-  putlog("Saved scores file");
-  return result;
+const struct header* savefile_header(const unsigned char* f) {
+  return (const struct header*) (f + NPP_USER_ID);
 }
 
-void parse_profile(unsigned char* f, struct profile* profile) {
+void parse_profile(const unsigned char* f, struct profile* profile) {
+  const struct header* header = savefile_header(f);
   char* username = (char*) calloc(NPP_USERNAME_SIZE + 1, sizeof(char));
-  strncpy(username, (const char*) (f + NPP_USERNAME), NPP_USERNAME_SIZE);
+  strncpy(username, header->username, NPP_USERNAME_SIZE - 1);
 
-  profile->id       = *(uint32_t*) (f + NPP_USER_ID);
-  profile->username = username;
+  profile->id         = header->id;
+  profile->palette_id = header->palette_id;
+  profile->username   = username;
 }
 
 void blockdealloc(struct block** blocks,  int sz) {
-  for (int i = 0; i < sz; i++) {
-    if ((*blocks)[i].name != NULL) {
-      free((void*) (*blocks)[i].name);
-      (*blocks)[i].name = NULL;
-    }
-  }
   free(*blocks);
   *blocks = NULL;
 }
 
-/* Generate the name (e.g. SU-A-03-04) based on the ID */
-// TODO: This doesn't support stories yet
-const char* generate_id(struct tab* tab, int i) {
-  char* name = (char*) calloc(ID_LENGTH + 1, sizeof(char));
-  const char* key = "ABCDEX";
-  char num[3] = {0, 0, 0}; // Temporary storage for the numbers
-  bool epcond = tab->type != LEVEL || tab->tab == SS || tab->tab == SS2; // Is episode or secret level
-
-  /* Tab prefix */
-  strcpy(name, tab->prefix);
-  strcat(name, "-");
-
-  /* Compute row */
-  bool xcond = tab->x ? i < 5 * tab->size / 6 : true;             // Determines whether we are in X row range
-  int keyi = epcond ? i % 5 : (i / 5) % 5;                        // Determines key index
-  strncat(name, xcond ? (const char*) &key[keyi] : (const char*) &key[5], 1);
-  strcat(name, "-");
-
-  /* Compute ep number */
-  int a = epcond ? i / 5 : i / 25;                                // Value when not in X row
-  int b = epcond ? i - 5 * tab->size / 6 : i / 5 - tab->size / 6; // Value when in X row
-  snprintf(num, 3, "%02d", xcond ? a : b);
-  strcat(name, num);
-
-  /* Compute lvl number */
-  if (!epcond) {
-    strcat(name, "-");
-    snprintf(num, 3, "%02d", i % 5);
-    strcat(name, num);
-  }
-
-  return (const char*) name;
-}
-
+/* Tabs of the catalogue, their blocks are set by fill_blocks() */
 void create_tabs(struct tab* tabs) {
-  tabs[0] = (struct tab) { PC, SOLO, LEVEL, SI,  "SI",  L_OFFSET_SI,  L_COUNT_SI,  NULL, false, true };
-  tabs[1] = (struct tab) { PC, SOLO, LEVEL, S,   "S",   L_OFFSET_S,   L_COUNT_S,   NULL, true,  true };
-  tabs[2] = (struct tab) { PC, SOLO, LEVEL, SU,  "SU",  L_OFFSET_SU,  L_COUNT_SU,  NULL, true,  true };
-  tabs[3] = (struct tab) { PC, SOLO, LEVEL, SL,  "SL",  L_OFFSET_SL,  L_COUNT_SL,  NULL, true,  true };
-  tabs[4] = (struct tab) { PC, SOLO, LEVEL, SS,  "?",   L_OFFSET_SS,  L_COUNT_SS,  NULL, true,  true };
-  tabs[5] = (struct tab) { PC, SOLO, LEVEL, SS2, "!",   L_OFFSET_SS2, L_COUNT_SS2, NULL, true,  true };
-
-  tabs[6] = (struct tab) { PC, SOLO, EPISODE, SI, "SI", E_OFFSET_SI, E_COUNT_SI, NULL, false, true };
-  tabs[7] = (struct tab) { PC, SOLO, EPISODE, S,  "S",  E_OFFSET_S,  E_COUNT_S,  NULL, true,  true };
-  tabs[8] = (struct tab) { PC, SOLO, EPISODE, SU, "SU", E_OFFSET_SU, E_COUNT_SU, NULL, true,  true };
-  tabs[9] = (struct tab) { PC, SOLO, EPISODE, SL, "SL", E_OFFSET_SL, E_COUNT_SL, NULL, true,  true };
+  memcpy(tabs, catalogue.tabs, sizeof(catalogue.tabs));
 }
 
-void fill_blocks(struct tab* tabs, size_t tab_count, struct block* blocks, struct score* scores) {
+/* Point the blocks at their tabs and names, which are the catalogue's */
+void fill_blocks(struct tab* tabs, size_t tab_count, struct block* blocks, struct store* store) {
   unsigned int index = 0;
-  unsigned int index_online = 0;
   for (int i = 0; i < tab_count; i++) {
     tabs[i].blocks = blocks + index;
     for (int j = 0; j < tabs[i].size; j++) {
-      blocks[index].name      = generate_id(&tabs[i], j);
-      blocks[index].tab       = &tabs[i];
-      blocks[index].orig      = &blocks[index];
-      blocks[index].copy      = &blocks[index];
-      blocks[index].updated   = false;
-      blocks[index].retries   = 0;
-      blocks[index].score     = -1;
-      blocks[index].rank      = -1;
-      blocks[index].tied_rank = -1;
-      blocks[index].replay    = -1;
-      if (tabs[i].online) {
-        struct score* entries = scores + 20 * index_online;
-        blocks[index].scores = entries;
-        for (int k = 0; k < 20; k++) {
-          entries[k] = (struct score) {
-            (unsigned int) -1,   // score
-            (unsigned int) NULL, // player
-            (unsigned int) -1,   // replay_id
-            (unsigned int) -1,   // rank
-            (unsigned int) -1    //tied_rank
-          };
-        }
-        index_online++;
-      } else {
-        blocks[index].scores = NULL;
-      }
+      blocks[index].name    = catalogue.items[index].name;
+      blocks[index].tab     = &tabs[i];
+      blocks[index].updated = false;
+      blocks[index].retries = 0;
+      store->type[index]    = tabs[i].type;
+      store->mode[index]    = tabs[i].mode;
+      store->tab[index]     = tabs[i].tab;
       index++;
     }
   }
 }
 
-void parse_tab(unsigned char* f, struct tab* tab) {
-  unsigned int offset = (tab->type == LEVEL ? L_OFFSET : E_OFFSET) + BLOCK_SIZE * tab->offset;
-  for (int i = 0; i < tab->size; i++) {
-    unsigned char* block = f + offset;
-//    unsigned int score = *(unsigned int *) (block + 36);
-//    unsigned int rank = *(unsigned int*) (block + 40);
-//    bool valid = score <= MAX_SCORE * 1000;
-
-//    tab->blocks[i].valid           = valid;
-    tab->blocks[i].id              = *(unsigned int*) block;
-    tab->blocks[i].attempts        = *(unsigned int*) (block +  4);
-    tab->blocks[i].deaths          = *(unsigned int*) (block +  8);
-    tab->blocks[i].victories       = *(unsigned int*) (block + 12);
-    tab->blocks[i].victories_ep    = *(unsigned int*) (block + 16);
-    tab->blocks[i].state           = *(unsigned int*) (block + 20);
-    tab->blocks[i].gold            = *(unsigned int*) (block + 24);
-    tab->blocks[i].score_deathless = *(unsigned int*) (block + 32);
-//    tab->blocks[i].score           = valid ? score : -1;
-//    tab->blocks[i].rank            = rank <= 19 ? rank : -1;
-    tab->blocks[i].replay          = *(unsigned int*) (block + 44);
-    offset += BLOCK_SIZE;
-  }
-}
-
-void parse_tabs(unsigned char* f, struct tab* tabs) {
+/**
+ * Allocate a standalone env with its own tabs, blocks, scores and players, but
+ * no cURL nor profile, e.g., to load another scores snapshot on the side.
+ */
+void env_init(struct env* env, struct config* config) {
+  memset(env, 0, sizeof(struct env));
+  env->config = config;
+  env->tcount = TAB_COUNT;
+  env->bcount = BLOCK_COUNT;
+  env->tabs   = (struct tab*)   calloc(env->tcount, sizeof(struct tab));
+  env->blocks = (struct block*) calloc(env->bcount, sizeof(struct block));
+  create_tabs(env->tabs);
+  store_init(&env->store, env->bcount);
+  entries_init(&env->entries, env->bcount);
+
+  env->players = (struct registry*) calloc(1, sizeof(struct registry));
+  registry_init(env->players);
+  fill_blocks(env->tabs, env->tcount, env->blocks, &env->store);
+}
+
+void env_free(struct env* env) {
+  map_close(&env->map);
+  registry_free(env->players);
+  free(env->players);
+  blockdealloc(&env->blocks, env->bcount);
+  free(env->tabs);
+  store_free(&env->store);
+  entries_free(&env->entries);
+  env->players = NULL;
+  env->tabs    = NULL;
+}
+
+void parse_tab(const unsigned char* f, struct env* env, struct tab* tab) {
+  decode_records(savefile_records(f, tab->type) + tab->offset, tab->size, &env->store, tab->blocks - env->blocks);
+}
+
+void parse_tabs(const unsigned char* f, struct env* env) {
   for (int i = 0; i < TAB_COUNT; i++) {
-    parse_tab(f, tabs + i);
+    parse_tab(f, env, env->tabs + i);
   }
 }
 
@@ -715,21 +518,6 @@ struct tab* find_tab(struct tab* tabs, int sz, enum modes mode, enum types type,
   return NULL;
 }
 
-struct player* find_player_by_id(struct player* players, unsigned int pcount, unsigned int id) {
-  for (int i = 0; i < pcount; i++) {
-    if (players[i].id == id) return &players[i];
-  }
-  return NULL;
-}
-
-struct player* find_player_by_name(struct player* players, unsigned int pcount, const char* name) {
-  if (name == NULL) return NULL;
-  for (int i = 0; i < pcount; i++) {
-    if (players[i].name != NULL && strcmp(players[i].name, name) == 0) return &players[i];
-  }
-  return NULL;
-}
-
 /**
  * cURL internal callback method to store result of transfer.
  *
@@ -738,67 +526,85 @@ struct player* find_player_by_name(struct player* players, unsigned int pcount,
  * @param Number of chunks of data
  * @param Cumulative destination where data is being stored
  */
-size_t curlwrite(char* data, size_t size, size_t nmemb, char** res) {
-  if (*res == NULL) return 0;
-  size_t newsz = strlen(*res) + size * nmemb;
-  *res = (char*) realloc(*res, newsz + 1);
-  strncat(*res, data, size * nmemb);
-  (*res)[newsz] = 0;
+size_t curlwrite(char* data, size_t size, size_t nmemb, struct buffer* res) {
+  if (res->data == NULL) return 0;
+  if (!buffer_append(res, data, size * nmemb)) return 0;
   return size * nmemb;
 }
 
-int curlinit(struct curl* curl) {
-  /* Initialize cURL global functionality */
-  curl_global_init(CURL_GLOBAL_DEFAULT);
-
-  /* Try to initialize cURL easy interface and other struct members */
-  curl->curl   = curl_easy_init();
-  curl->code   = CURLE_OK;
-  curl->error  = (char*) calloc(CURL_ERROR_SIZE, sizeof(char));
-  curl->res    = (char*) calloc(1, sizeof(char));
-  curl->safe   = true;
-  curl->active = true;
-  curl->count  = 0;
-  if (!curl->curl) {
-    puterr("cURL didn't initialize properly.");
-    return 1;
-  }
-
+/* Set the options shared by every easy handle we create */
+int curlsetup(struct curl* curl, CURL* handle, char* error, struct buffer* res) {
   /* Try to set cURL error buffer */
-  SETOPT(curl_easy_setopt(curl->curl, CURLOPT_ERRORBUFFER, curl->error), "Error: cURL failed to set error buffer.");
+  SETOPT(curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, error), "Error: cURL failed to set error buffer.");
 
   /* Try to set cURL redirect option */
-  SETOPT(curl_easy_setopt(curl->curl, CURLOPT_FOLLOWLOCATION, 1L), "Error: cURL failed to set redirect option.");
+  SETOPT(curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L), "Error: cURL failed to set redirect option.");
 
   /* Try to set cURL writer function */
-  SETOPT(curl_easy_setopt(curl->curl, CURLOPT_WRITEFUNCTION, curlwrite), "Error: cURL failed to set writer function.");
+  SETOPT(curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, curlwrite), "Error: cURL failed to set writer function.");
 
   /* Try to set cURL write data */
-  SETOPT(curl_easy_setopt(curl->curl, CURLOPT_WRITEDATA, &curl->res), "Error: cURL failed to set write data.");
+  SETOPT(curl_easy_setopt(handle, CURLOPT_WRITEDATA, res), "Error: cURL failed to set write data.");
+
+  /* Try to set cURL timeout, so a stalled transfer fails instead of holding its slot */
+  SETOPT(curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, (long) TIMEOUT), "Error: cURL failed to set timeout.");
 
   if (!curl->safe) {
     /* Try to skip certificate verification */
-    SETOPT(curl_easy_setopt(curl->curl, CURLOPT_SSL_VERIFYPEER, 0L), "Error: cURL failed to skip certificate verification.");
+    SETOPT(curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 0L), "Error: cURL failed to skip certificate verification.");
 
     /* Try to skip hostname verification */
-    SETOPT(curl_easy_setopt(curl->curl, CURLOPT_SSL_VERIFYHOST, 0L), "Error: cURL failed to skip hostname verification.");
+    SETOPT(curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 0L), "Error: cURL failed to skip hostname verification.");
   }
 
   return 0;
 }
 
-int curldownload(struct curl* curl, const char* url) {
-  /* Reinitialize response */
-  free(curl->res);
-  curl->res = (char*) calloc(1, sizeof(char));
+int curlinit(struct curl* curl, unsigned int window) {
+  /* Initialize cURL global functionality */
+  curl_global_init(CURL_GLOBAL_DEFAULT);
 
-  /* Perform GET request */
-  curl_easy_setopt(curl->curl, CURLOPT_URL, url);
-  curl->code = curl_easy_perform(curl->curl);
-  if (curl->code != CURLE_OK) {
-    printf("[ERROR] cURL GET request not successful: %s.\n", curl_easy_strerror(curl->code));
+  /* Initialize struct members */
+  curl->code   = CURLE_OK;
+  curl->safe   = true;
+  curl->active = true;
+  curl->count  = 0;
+  curl->window = window > 0 ? window : 1;
+  curl->host   = HOST;
+  curl->queue  = NULL;
+  curl->failed = NULL;
+  curl->qcount = curl->qcap = 0;
+  curl->fcount = curl->fcap = 0;
+  curl->seed   = 0;
+  curl->cache  = NULL;
+  retry_reset(curl);
+  metrics_reset(&curl->metrics);
+  pace_init(&curl->pacing, curl->window);
+  curl->multi  = curl_multi_init();
+  curl->slots  = (struct transfer*) calloc(curl->window, sizeof(struct transfer));
+  if (!curl->multi) {
+    puterr("cURL didn't initialize properly.");
     return 1;
   }
+
+  /* Create one reusable easy handle per slot, so connections are kept alive */
+  for (int i = 0; i < curl->window; i++) {
+    struct transfer* slot = &curl->slots[i];
+    slot->curl  = curl_easy_init();
+    slot->error = (char*) calloc(CURL_ERROR_SIZE, sizeof(char));
+    buffer_init(&slot->res);
+    slot->block = NULL;
+    if (!slot->curl) {
+      puterr("cURL didn't initialize properly.");
+      return 1;
+    }
+    if (curlsetup(curl, slot->curl, slot->error, &slot->res) != 0) return 1;
+    SETOPT(curl_easy_setopt(slot->curl, CURLOPT_PRIVATE, slot), "Error: cURL failed to set private data.");
+  }
+
+  /* Don't open more connections to the server than we have slots */
+  curl_multi_setopt(curl->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) curl->window);
+
   return 0;
 }
 
@@ -809,163 +615,206 @@ void curlinfo(struct curl* curl) {
 
 void curldestroy(struct curl* curl) {
   /* Perform cURL's local and global cleanup */
-  curl_easy_cleanup(curl->curl);
+  for (int i = 0; i < curl->window; i++) {
+    struct transfer* slot = &curl->slots[i];
+    if (slot->block != NULL && !slot->replayed) curl_multi_remove_handle(curl->multi, slot->curl);
+    curl_easy_cleanup(slot->curl);
+    if (slot->error != NULL) free(slot->error);
+    buffer_free(&slot->res);
+  }
+  free(curl->slots);
+  curl_multi_cleanup(curl->multi);
   curl_global_cleanup();
 
   /* Free allocated memory */
-  if (curl->error != NULL) free(curl->error);
-  if (curl->res != NULL) free(curl->res);
+  retry_free(curl);
 }
 
-int parse_json(struct env* env, struct block* block) {
-  /* Parse json file */
-  cJSON* json = cJSON_Parse(env->curl->res);
-  if (json == NULL) { // Incorrect JSON format
-    cJSON_Delete(json);
-    return 1;
-  }
+/* Fill a block with a decoded leaderboard, resolving its players, it replaces any deep entries */
+void apply_board(struct env* env, struct block* block, const struct board* board) {
+  struct store* store     = &env->store;
+  struct entries* entries = &env->entries;
+  unsigned int b          = block - env->blocks;
+  size_t first            = (size_t) b * BOARD_SIZE;
+
+  env->scount -= entries->depth[b];
+  deep_clear(entries, b, 1);
 
   /* Read user info */
-  const cJSON* userInfo = cJSON_GetObjectItemCaseSensitive(json, "userInfo");
-  unsigned int user_score  = -1;
-  unsigned int user_rank   = -1;
-  unsigned int user_replay = -1;
-  const char*  user_name   = NULL;
-  if (userInfo != NULL && cJSON_IsObject(userInfo)) {
-    const cJSON* score  = cJSON_GetObjectItemCaseSensitive(userInfo, "my_score");
-    const cJSON* rank   = cJSON_GetObjectItemCaseSensitive(userInfo, "my_rank");
-    const cJSON* replay = cJSON_GetObjectItemCaseSensitive(userInfo, "my_replay_id");
-    const cJSON* name   = cJSON_GetObjectItemCaseSensitive(userInfo, "my_display_name");
-    user_score  = score  != NULL && cJSON_IsNumber(score)  ? score->valueint   : -1;
-    user_rank   = rank   != NULL && cJSON_IsNumber(rank)   ? rank->valueint    : -1;
-    user_replay = replay != NULL && cJSON_IsNumber(replay) ? replay->valueint  : -1;
-    user_name   = name   != NULL && cJSON_IsString(name)   ? name->valuestring : NULL;
-    block->score     = user_score;
-    block->replay    = user_replay;
-    block->rank      = user_rank;
-    block->tied_rank = -1;
-    block->copy->score     = user_score;
-    block->copy->replay    = user_replay;
-    block->copy->rank      = user_rank;
-    block->copy->tied_rank = -1;
+  const char* user_name = board->has_user_name ? board->user_name : NULL;
+  if (board->has_user) {
+    store->score[b]     = board->user_score;
+    store->replay[b]    = board->user_replay;
+    store->rank[b]      = board->user_rank;
+    store->tied_rank[b] = -1;
   }
 
   /* Read scores */
-  const cJSON* scores    = cJSON_GetObjectItemCaseSensitive(json, "scores");
-  const cJSON* token     = NULL;
   unsigned int rank      = -1;
   unsigned int tied_rank = -1;
   unsigned int curscore  = 0;
-  if (scores != NULL && cJSON_IsArray(scores)) {
-    cJSON_ArrayForEach(token, scores) {
-      /* Limit of scores reached, this should never really be triggered but
-         just in case the server returns over 20 scores */
-      if (rank == 19) break;
-
-      /* Retrieve JSON fields */
-      const cJSON* json_id     = cJSON_GetObjectItemCaseSensitive(token, "user_id");
-      const cJSON* json_score  = cJSON_GetObjectItemCaseSensitive(token, "score");
-      const cJSON* json_replay = cJSON_GetObjectItemCaseSensitive(token, "replay_id");
-      const cJSON* json_name   = cJSON_GetObjectItemCaseSensitive(token, "user_name");
-
-      /* Check validity of JSON fields and store values */
-      struct player* p    = NULL;
-      unsigned int id     = json_id     != NULL && cJSON_IsNumber(json_id)     ? json_id->valueint      : -1;
-      unsigned int score  = json_score  != NULL && cJSON_IsNumber(json_score)  ? json_score->valueint   : -1;
-      unsigned int replay = json_replay != NULL && cJSON_IsNumber(json_replay) ? json_replay->valueint  : -1;
-      const char*  name   = json_name   != NULL && cJSON_IsString(json_name)   ? json_name->valuestring : NULL;
-
-      /* Try to find player or create it otherwise */
-      if (!p && id != -1) p = find_player_by_id(env->players, env->pcount, id);
-      if (!p && name != NULL) p = find_player_by_name(env->players, env->pcount, name);
-      if (!p) {
-        env->players[env->pcount].id   = id;
-        env->players[env->pcount].name = strdup(name);
-        p = &env->players[env->pcount];
-        env->pcount++; // TODO: Put this in mutex
-      }
-
-      /* Fill in remaining general block info */
-      // TODO: Maybe do this by comparing against the user player pointer
-      if (user_name != NULL && p->name != NULL && strcmp(p->name, user_name) == 0) {
-        block->rank      = rank + 1;
-        block->tied_rank = curscore == score ? tied_rank : tied_rank + 1;
-        block->copy->rank      = rank + 1;
-        block->copy->tied_rank = curscore == score ? tied_rank : tied_rank + 1;
-      }
-
-      /* Ignore hackers and cheaters if necessary */
-      bool hacker  = p != NULL ? p->hacker  : false;
-      bool cheater = p != NULL ? p->cheater : false;
-      int* flags = (int*) &env->config->flags;
-      if (hacker && gflag(flags, HackerFlags_RemoveScores) || cheater && gflag(flags, CheaterFlags_RemoveScores)) continue;
-
-      /* Fill in block scores info */
-      // TODO: Fill in scores array for player, unless it slows down the process too much (benchmark!)
-      rank++;
-      if (score != curscore) {
-        tied_rank++;
-        curscore = score;
-      }
-      if (block->scores[rank].score == -1) env->scount++; // Increase score count if score is new
-      block->scores[rank].score     = score;
-      block->scores[rank].replay_id = replay;
-      block->scores[rank].rank      = rank;
-      block->scores[rank].tied_rank = tied_rank;
-      block->scores[rank].player    = p;
-      block->copy->scores[rank].score     = score;
-      block->copy->scores[rank].replay_id = replay;
-      block->copy->scores[rank].rank      = rank;
-      block->copy->scores[rank].tied_rank = tied_rank;
-      block->copy->scores[rank].player    = p;
+  for (int i = 0; i < board->count; i++) {
+    const struct entry* entry = &board->entries[i];
+    struct player* p    = NULL;
+    unsigned int id     = entry->id;
+    unsigned int score  = entry->score;
+    unsigned int replay = entry->replay;
+    const char*  name   = entry->has_name ? entry->name : NULL;
+
+    /* Try to find player or create it otherwise */
+    if (!p && id != -1) p = find_player_by_id(env->players, id);
+    if (!p && name != NULL) p = find_player_by_name(env->players, name);
+    if (!p) p = add_player(env->players, env->config, id, name);
+
+    /* Fill in remaining general block info */
+    // TODO: Maybe do this by comparing against the user player pointer
+    if (user_name != NULL && p->name != NULL && strcmp(p->name, user_name) == 0) {
+      store->rank[b]      = rank + 1;
+      store->tied_rank[b] = curscore == score ? tied_rank : tied_rank + 1;
+    }
 
+    /* Ignore hackers and cheaters if necessary */
+    bool hacker  = p != NULL ? p->hacker  : false;
+    bool cheater = p != NULL ? p->cheater : false;
+    int* flags = (int*) &env->config->flags;
+    if (hacker && gflag(flags, HackerFlags_RemoveScores) || cheater && gflag(flags, CheaterFlags_RemoveScores)) continue;
+
+    /* Fill in block scores info */
+    // TODO: Fill in scores array for player, unless it slows down the process too much (benchmark!)
+    rank++;
+    if (score != curscore) {
+      tied_rank++;
+      curscore = score;
     }
+    if (rank >= BOARD_SIZE || entries->score[first + rank] == -1) env->scount++; // Increase score count if score is new
+    leaderboard_put(env, b, p, score, replay, rank, tied_rank);
   }
 
-  /* Deallocate json tree */
-  cJSON_Delete(json);
+  env->revision++;
+}
+
+int parse_json(struct env* env, struct block* block, const char* res, size_t len) {
+  /* Decode response, falling back to cJSON for anything unexpected */
+  struct board board;
+  if (decode_scores(res, len, &board) != 0 && decode_scores_cjson(res, len, &board) != 0) return 1;
+  apply_board(env, block, &board);
   return 0;
 }
 
-/**
- * Return codes: -1 (Steam ID inactive), 0 (success), 1 (other error)
- */
-int download(struct env* env, struct block* block) {
-  if (block->updated || !block->tab->online) return 0;
+/* Queue the download of a block in an idle slot */
+void transfer_start(struct env* env, struct transfer* slot, struct block* block) {
   unsigned int type_id = block->tab->type;
   const char* type = type_id == LEVEL ? "level" : (type_id == EPISODE ? "episode" : "story");
-  char url[128]; // Too lazy to compute the necessary size
-  sprintf(url, URL, env->config->def_steam_id, type, block->id);
-  int success = 1;
-  for (int i = 0; i < RETRIES; i++) {
-    if (block->retries > RETRIES) return 1;
-    else block->retries++;
-    if (curldownload(env->curl, url) != 0) continue; // Request failed
-    long http_code = 0;
-    curl_easy_getinfo (env->curl->curl, CURLINFO_RESPONSE_CODE, &http_code);
-    if (http_code == 200 && env->curl->code != CURLE_ABORTED_BY_CALLBACK) { // Request succeeded
-      if (strcmp(env->curl->res, INVALID_RES) == 0) { // Steam ID inactive
-        env->curl->active = false;
-        block->retries--;
-        return -1;
-      }
-      else { // Steam ID active
-        env->curl->active = true;
-        if (parse_json(env, block) == 0) { // JSON parsing successful
-          block->updated = true;
-          env->lcount++;
-          return 0;
-        }
-        else { // JSON parsing unsuccessful
-          continue;
-        }
-      }
-    }
-    else { // Request failed, likely due to a 502 Bad Gateway
-      continue;
+  snprintf(slot->url, sizeof(slot->url), URL, env->curl->host, env->config->def_steam_id, type, env->store.id[block - env->blocks]);
+  slot->block = block;
+  block->retries++;
+
+  /* Reinitialize response, keeping its memory */
+  buffer_clear(&slot->res);
+
+  struct cache* cache = env->curl->cache;
+  slot->started  = now_us();
+  slot->replayed = cache != NULL && cache->mode == CACHE_REPLAY;
+  if (slot->replayed) { // Served once due, without touching the network
+    cache_fetch(cache, slot->url, &slot->res, &slot->status, &slot->code, &slot->latency);
+    slot->due = now_us() + (cache->timed ? slot->latency : 0);
+  } else {
+    curl_easy_setopt(slot->curl, CURLOPT_URL, slot->url);
+    curl_multi_add_handle(env->curl->multi, slot->curl);
+  }
+  metrics_event(&env->curl->metrics, EVENT_REQUEST);
+}
+
+/* Milliseconds until the next replayed response is due, -1 if none is in flight */
+long transfer_wait(struct curl* curl, uint64_t now) {
+  long wait = -1;
+  for (int i = 0; i < curl->window; i++) {
+    const struct transfer* slot = &curl->slots[i];
+    if (slot->block == NULL || !slot->replayed) continue;
+    long ms = slot->due > now ? (long) ((slot->due - now + 999) / 1000) : 0;
+    if (wait < 0 || ms < wait) wait = ms;
+  }
+  return wait;
+}
+
+/* Abort every transfer in flight and release the slots, their blocks go first next time */
+void transfer_abort(struct curl* curl) {
+  for (int i = 0; i < curl->window; i++) {
+    if (curl->slots[i].block == NULL) continue;
+    if (!curl->slots[i].replayed) curl_multi_remove_handle(curl->multi, curl->slots[i].curl);
+    curl->slots[i].block->retries--;
+    retry_now(curl, curl->slots[i].block);
+    curl->slots[i].block = NULL;
+  }
+}
+
+/**
+ * Handle a finished transfer, scheduling a retry if it failed.
+ * Return codes: -1 (Steam ID inactive), 0 (success), 1 (out of attempts), 2 (retry)
+ */
+int transfer_finish(struct env* env, struct transfer* slot, CURLcode code) {
+  struct block* block = slot->block;
+  struct curl* curl = env->curl;
+  long http_code = 0;
+  curl_off_t total = 0;
+  if (slot->replayed) {
+    metrics_replay(&curl->metrics, slot->status, slot->latency, slot->res.len);
+    http_code = slot->status;
+    total     = slot->latency;
+  } else {
+    curl_multi_remove_handle(curl->multi, slot->curl);
+    metrics_transfer(&curl->metrics, slot->curl, code);
+    curl_easy_getinfo(slot->curl, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_getinfo(slot->curl, CURLINFO_TOTAL_TIME_T, &total);
+    if (curl->cache != NULL) cache_store(curl->cache, slot->url, &slot->res, http_code, code, total); // Failures are part of the download too
+  }
+  bool congested = code != CURLE_OK || http_code >= 500 || http_code == 429;
+  pace_done(&curl->pacing, slot->started, total, congested, now_us());
+  if (code != CURLE_OK) { // Request failed
+    log_write(LOG_ERROR, "cURL GET request not successful: %s.", curl_easy_strerror(code));
+    return retry_push(curl, block, code == CURLE_OPERATION_TIMEDOUT ? FAIL_TIMEOUT : FAIL_NETWORK) ? 2 : 1;
+  }
+  if (http_code != 200) { // Request failed, likely due to a 502 Bad Gateway
+    bool client = http_code >= 400 && http_code < 500 && http_code != 429;
+    return retry_push(curl, block, client ? FAIL_CLIENT : FAIL_SERVER) ? 2 : 1;
+  }
+  if (slot->res.len == strlen(INVALID_RES) && memcmp(slot->res.data, INVALID_RES, slot->res.len) == 0) { // Steam ID inactive
+    env->curl->active = false;
+    block->retries--;
+    retry_now(curl, block); // The slot is freed right away, so it goes back first rather than being lost
+    metrics_event(&curl->metrics, EVENT_INACTIVE);
+    return -1;
+  }
+  env->curl->active = true;
+  struct board local;
+  struct board* board = env->feed != NULL ? feed_board(env->feed) : &local;
+  uint64_t parse = now_us();
+  bool decoded = decode_scores(slot->res.data, slot->res.len, board) == 0 || decode_scores_cjson(slot->res.data, slot->res.len, board) == 0;
+  metrics_span(&curl->metrics, SPAN_PARSE, now_us() - parse);
+  if (!decoded) return retry_push(curl, block, FAIL_PARSE) ? 2 : 1;
+  if (env->journal != NULL) journal_append(env->journal, block - env->blocks, env->store.id[block - env->blocks], board);
+  if (env->feed != NULL) { // The readers apply it once published
+    feed_put(env->feed, block - env->blocks);
+  } else {
+    apply_board(env, block, board);
+    env->lcount++;
+  }
+  retry_ok(curl);
+  metrics_board(&curl->metrics);
+  block->updated = true;
+  return 0;
+}
+
+/* Find the next block that was never tried, advancing the cursor */
+struct block* next_pending(struct env* env, unsigned int* tab, unsigned int* index) {
+  for (; *tab < env->tcount; (*tab)++, *index = 0) {
+    if (!env->tabs[*tab].online) continue;
+    while (*index < env->tabs[*tab].size) {
+      struct block* block = &env->tabs[*tab].blocks[(*index)++];
+      if (!block->updated && block->retries < RETRIES) return block;
     }
   }
-  return success;
+  return NULL;
 }
 
 void print_profile(struct profile* profile) {
@@ -973,79 +822,106 @@ void print_profile(struct profile* profile) {
   printf("User ID: %d\n", profile->id);
 }
 
+/**
+ * Hand a finished transfer to its block and free its slot.
+ * Return codes: -1 (Steam ID inactive), 0 (downloaded), 1 (retried or set aside)
+ */
+int transfer_collect(struct env* env, struct transfer* slot, CURLcode code) {
+  int* flags = (int*) &env->flags;
+  int ret = transfer_finish(env, slot, code);
+  slot->block = NULL;
+  if (ret == 0) sflag(flags, DownloadFlags_Refresh);
+  return ret < 0 ? -1 : (ret == 0 ? 0 : 1);
+}
+
+/**
+ * Download every pending block, keeping up to curl->window transfers in flight.
+ * Failed blocks are retried once their backoff is over, in between the others,
+ * and the next call picks up where this one left off.
+ * Return codes: -1 (Steam ID inactive), 0 (success), 1 (some blocks out of attempts)
+ */
 int update_scores(struct env* env) {
-  int ret_code;
-  bool err = false;
+  struct curl* curl = env->curl;
   int* flags = (int*) &env->flags;
-  for (int j = 0; j < env->tcount; j++) {
-    if (!env->tabs[j].online) continue;
-    for (int i = 0; i < env->tabs[j].size; i++) {
-      if (!gflag(flags, DownloadFlags_Download)) return 0;
-      if (!env->tabs[j].blocks[i].updated) {
-        ret_code = download(env, &env->tabs[j].blocks[i]);
-        if (ret_code == 1) err = true;
-        if (ret_code == -1) return -1;
+  unsigned int busy = 0;  // Slots in flight
+  int running = 0;
+  while (true) {
+    /* Cancelled: drop whatever is in flight */
+    if (!gflag(flags, DownloadFlags_Download)) {
+      transfer_abort(curl);
+      return 0;
+    }
+
+    /* Fill idle slots with due retries, then with new blocks, unless paused, in which case we just drain them */
+    bool paused = gflag(flags, DownloadFlags_Paused);
+    uint64_t now = now_ms();
+    long hold = retry_hold(curl, now);
+    unsigned int limit = retry_limit(curl);
+    long throttled = -1; // Milliseconds until the rate cap lets a waiting block start
+    for (int i = 0; i < curl->window && busy < limit && !paused && hold == 0; i++) {
+      if (curl->slots[i].block != NULL) continue;
+      if (!pace_ready(&curl->pacing, now_us())) { // Over the rate cap, if there's anything left to start
+        unsigned int tab = curl->tab, index = curl->index;
+        if (curl->qcount > 0 || next_pending(env, &tab, &index) != NULL) throttled = pace_wait(&curl->pacing, now_us());
+        break;
+      }
+      struct block* block = retry_pop(curl, now);
+      if (block == NULL) block = next_pending(env, &curl->tab, &curl->index);
+      if (block == NULL) break;
+      transfer_start(env, &curl->slots[i], block);
+      pace_take(&curl->pacing);
+      busy++;
+    }
+    long wait = hold > 0 ? hold : retry_wait(curl, now);
+    if (throttled >= 0 && (wait < 0 || throttled < wait)) wait = throttled;
+    if (busy == 0 && (wait < 0 || paused)) break;
+
+    /* Drive the transfers and wait for activity, or until the next retry, the end of a holdoff or a replayed response */
+    curl_multi_perform(curl->multi, &running);
+    long replay  = transfer_wait(curl, now_us());
+    long timeout = wait >= 0 && wait < POLL_TIMEOUT ? wait : POLL_TIMEOUT;
+    if (replay >= 0 && replay < timeout) timeout = replay;
+    if (running > 0 || busy == 0 || replay > 0) curl_multi_poll(curl->multi, NULL, 0, timeout, NULL);
+
+    /* Collect finished transfers, the slot is free for another block whether they're retried or not */
+    CURLMsg* msg;
+    int pending;
+    bool fresh = false;
+    while ((msg = curl_multi_info_read(curl->multi, &pending)) != NULL) {
+      if (msg->msg != CURLMSG_DONE) continue;
+      struct transfer* slot = NULL;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**) &slot);
+      int ret = transfer_collect(env, slot, msg->data.result);
+      if (ret < 0) {
+        transfer_abort(curl);
+        return -1;
+      }
+      fresh |= ret == 0;
+      busy--;
+    }
+    for (int i = 0; i < curl->window && replay >= 0; i++) { // And the replayed ones that are due
+      struct transfer* slot = &curl->slots[i];
+      if (slot->block == NULL || !slot->replayed || slot->due > now_us()) continue;
+      int ret = transfer_collect(env, slot, slot->code);
+      if (ret < 0) {
+        transfer_abort(curl);
+        return -1;
       }
-      if (j % 10 == 0) sflag(flags, DownloadFlags_Refresh);
-      else cflag(flags, DownloadFlags_Refresh);
+      fresh |= ret == 0;
+      busy--;
     }
+
+    /* Everything collected in this pass goes out in a single snapshot, and to the journal */
+    if (fresh && env->feed != NULL) feed_publish(env->feed, false);
+    if (fresh && env->journal != NULL) journal_flush(env->journal, false);
   }
-  return err ? 1 : 0;
+  return curl->fcount > 0 ? 1 : 0;
 }
 
-void compute_tab(struct tab* tab) {
+void compute_tab(struct env* env, struct tab* tab) {
+  const uint32_t* scores = env->store.score + (tab->blocks - env->blocks);
   int score = 0;
   for (int i = 0; i < tab->size; i++)
-      score += tab->blocks[i].score;
+    if (scores[i] != (unsigned int) -1) score += scores[i]; // Skip missing scores
   printf("Total %s Score: %.3f\n", tab->prefix, (float) score / 1000);
 }
-
-/* Sorting (uses global vars mainorder and mainorder_rev */
-int blkcmp(const void* b1, const void* b2) {
-  int r, s;
-  switch(mainorder) {
-    case ID:
-      r = (int)(((struct block*) b1)->id);
-      s = (int)(((struct block*) b2)->id);
-      break;
-    case ATTEMPTS:
-      r = (int)(((struct block*) b1)->attempts);
-      s = (int)(((struct block*) b2)->attempts);
-      break;
-    case VICTORIES:
-      r = (int)(((struct block*) b1)->victories) + (int)(((struct block*) b1)->victories_ep);
-      s = (int)(((struct block*) b2)->victories) + (int)(((struct block*) b2)->victories_ep);
-      break;
-    case GOLD:
-      r = (int)(((struct block*) b1)->gold);
-      s = (int)(((struct block*) b2)->gold);
-      break;
-    case SCORE:
-      r = (int)(((struct block*) b1)->score);
-      s = (int)(((struct block*) b2)->score);
-      break;
-    case RANK:
-      r = (int)(((struct block*) b1)->rank);
-      s = (int)(((struct block*) b2)->rank);
-      break;
-    default:
-      r = (int)(((struct block*) b1)->id);
-      s = (int)(((struct block*) b2)->id);
-  }
-  return mainorder_rev ? (r < s) - (r > s) : (r > s) - (r < s);
-}
-
-void blksort(struct block* blocks, size_t sz, enum orders order, bool reverse) {
-  /* Set table order */
-  mainorder     = order;
-  mainorder_rev = reverse;
-
-  /* Sort list in place using Quicksort (stdlib) */
-  qsort(blocks, sz, sizeof(struct block), blkcmp);
-
-  /* Update pointers */
-  for (int i = 0; i < sz; i++) {
-    blocks[i].orig->copy = &blocks[i];
-    blocks[i].copy = &blocks[i];
-  }
-}
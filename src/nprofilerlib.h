@@ -7,25 +7,50 @@
 
 // General program constant
 #define MAGIC          "NPRO"
-#define MAJOR          1
+#define MAJOR          2
 #define MINOR          0
 #define PATCH          0
 #define ERRBUF_SIZE    80
 #define LOGBUF_SIZE    80
-#define URL            "https://dojo.nplusplus.ninja/prod/steam/get_scores?steam_id=%lu&steam_auth=&%s_id=%d"
+#define LOG_CAPACITY   1024     // Records kept by the log, a power of two
+#define LOG_SLOT       256      // Bytes of a record in the log ring
+#define HIST_POWERS    32       // Powers of two of microseconds a latency histogram covers
+#define HIST_STEPS     4        // Buckets of a histogram per power of two
+#define HTTP_STATUS    600      // Statuses counted one by one, 0 for no response
+#define RATE_SECONDS   5        // Seconds the throughput gauges average over
+#define HOST           "https://dojo.nplusplus.ninja"
+#define URL            "%s/prod/steam/get_scores?steam_id=%lu&steam_auth=&%s_id=%d"
 #define RETRIES        50
+#define WINDOW         8        // Default number of concurrent transfers
+#define POLL_TIMEOUT   1000     // Milliseconds to wait for transfer activity
+#define TIMEOUT        20000    // Milliseconds before a transfer is given up as timed out
+#define PACE_HISTORY   256      // Rounds of transfers whose concurrency limit is kept
+#define BUFFER_SIZE    4096     // Initial capacity of a response buffer
 #define USERNAME       "EddyMataGallos"
 #define STEAM_ID       76561198031272062
 #define INVALID_RES    "-1337"
 #define FILENAME       "bin/nprofile"
 #define CONFIG         "bin/config"
 #define SCORES         "bin/scores"
-#define SETOPT(x,e)    curl->code=x;if(curl->code!=CURLE_OK){printf("%s\n%s\n",e,curl->error);return 1;}
+#define SCORES_VERSION 3        // Format of the scores files we write
+#define SCORES_ALIGN   8        // Alignment of every section of a scores file
+#define DELTA_DEPTH    64       // Longest chain of delta snapshots to follow
+#define FEED_READERS   4        // Threads that can read downloaded scores at once
+#define FEED_CHUNK     256      // Decoded boards per chunk of a download
+#define JOURNAL        "bin/journal"
+#define JOURNAL_BATCH  32       // Boards appended to the journal between syncs to disk
+#define JOURNAL_AGE    21600    // Seconds an unfinished download can be resumed for
+#define ARENA_CHUNK    65536    // Bytes per chunk of an arena
+#define WATCH_SETTLE   100      // Milliseconds without writes before a changed savefile is read
+#define PAGE_SIZE      256      // Bytes per page of deep leaderboard entries
+#define PAGE_CHUNK     256      // Pages per chunk of the page pool
+#define SETOPT(x,e)    curl->code=x;if(curl->code!=CURLE_OK){printf("%s\n%s\n",e,curl_easy_strerror(curl->code));return 1;}
 
 // General N++ constants
 #define FILESIZE           70501008
 #define MAX_SCORE          3000
-#define PLAYER_MAX         1000     // How many to allocate at the start
+#define PLAYER_MAX         1000     // How many to make room for at the start
+#define PLAYER_CHUNK       1024     // Players per chunk of the registry
 #define NPP_USER_ID        0xA04
 #define NPP_USERNAME       0xA08
 #define NPP_PALETTE_ID     0xA18
@@ -33,6 +58,11 @@
 #define NPP_GOLD           0x12BC
 #define NPP_USERNAME_SIZE  17
 #define ID_LENGTH          10
+#define NO_COORD           0xFF     // Row or level of a block that has none
+#define BOARD_SIZE         20       // Top scores of a leaderboard, any past them are paged
+#define NAME_SIZE          128      // Max bytes of a decoded player name
+#define JOURNAL_RECORD     (14 + NAME_SIZE + BOARD_SIZE * (12 + NAME_SIZE)) // Max bytes of a journaled board
+#define DEEP_ENTRY         15       // Max bytes of a coded deep entry, 3 varints
 
 // Level, episode and story offset and counts
 #define L_OFFSET       0x80D320
@@ -41,7 +71,8 @@
 #define L_COUNT        2165
 #define E_COUNT        385
 #define S_COUNT        65
-#define TAB_COUNT      10
+#define TAB_COUNT      14
+#define BLOCK_COUNT    (L_COUNT + E_COUNT + S_COUNT)
 #define BLOCK_SIZE     48
 
 #define L_OFFSET_SI    0
@@ -84,6 +115,13 @@ enum modes     { SOLO, COOP, RACE, HARDCORE };
 enum types     { LEVEL, EPISODE, STORY };
 enum tabs      { SI, S, SU, SL, SS, SS2 };
 enum orders    { ID, ATTEMPTS, VICTORIES, GOLD, SCORE, RANK };
+enum rankings  { TOPS, TOTAL_SCORE, POINTS, AVG_POINTS };
+enum failures  { FAIL_SERVER, FAIL_TIMEOUT, FAIL_NETWORK, FAIL_PARSE, FAIL_CLIENT, FAIL_COUNT };
+enum spans     { SPAN_DNS, SPAN_CONNECT, SPAN_TLS, SPAN_WAIT, SPAN_BODY, SPAN_TOTAL, SPAN_PARSE, SPAN_COUNT };
+enum events    { EVENT_REQUEST, EVENT_BOARD, EVENT_CONNECT, EVENT_RETRY, EVENT_EXHAUSTED, EVENT_INACTIVE, EVENT_HOLDOFF, EVENT_COUNT };
+enum decoders  { DECODE_SCALAR, DECODE_SSE2, DECODE_AVX2 };
+enum caching   { CACHE_RECORD, CACHE_REPLAY };
+enum paces     { PACE_START, PACE_UP, PACE_ERRORS, PACE_LATENCY };
 
 enum ConfigFlags {
   HackerFlags_DoNothing              = 1 << 0,
@@ -120,6 +158,24 @@ enum DownloadFlags {
 };
 inline DownloadFlags operator|(DownloadFlags a, DownloadFlags b) { return (DownloadFlags)((int) a | (int) b); }
 
+// Memory handed out from big chunks and freed all at once
+struct arena {
+  char** chunks;
+  size_t* sizes;            // Size of each chunk
+  unsigned int chunk_count;
+  unsigned int current;     // Chunk being filled
+  size_t used;              // Bytes used of the current chunk
+};
+
+// Set of interned strings, equal strings are the same pointer
+struct strings {
+  struct arena arena;       // Copies of the strings
+  const char** table;       // Hash table of the strings
+  uint32_t* hashes;         // Hash of each slot of the table
+  unsigned int capacity;    // Size of the hash table (power of 2)
+  unsigned int count;
+};
+
 // Struct to describe a particular tab
 struct tab {
   enum platforms platform;
@@ -138,30 +194,274 @@ struct tab {
 struct player {
   const char* name;
   unsigned int id;
-  struct score* scores;
+  unsigned int index;   // Position in the player registry
+  unsigned int* scores;  // Indices of its entries in env->entries
   unsigned int count;   // Length of scores array
   bool cheater;
   bool hacker;
 };
 
-// Struct to describe a particular score of the leaderboards
-struct score {
+// Struct to hold every known player, indexed by user ID and by name
+struct registry {
+  struct player** chunks;   // Chunks of PLAYER_CHUNK players, never moved
+  unsigned int chunk_count;
+  unsigned int count;       // Player count
+  unsigned int* ids;        // Hash table of player indices (+1) by user ID
+  unsigned int* names;      // Hash table of player indices (+1) by interned name
+  unsigned int capacity;    // Size of both hash tables (power of 2)
+  struct strings strings;   // Names of the players, interned
+};
+
+// Struct to hold one decoded leaderboard entry
+struct entry {
+  unsigned int id;
   unsigned int score;
-  struct player* player;
-  unsigned int replay_id;
-  unsigned int rank;
-  unsigned int tied_rank;
+  unsigned int replay;
+  char name[NAME_SIZE];
+  bool has_name;
+};
+
+// Struct to hold a decoded get_scores response, lives on the stack
+struct board {
+  bool has_user;            // Whether the response had a userInfo object
+  bool has_user_name;
+  unsigned int user_score;
+  unsigned int user_rank;
+  unsigned int user_replay;
+  char user_name[NAME_SIZE];
+  unsigned int count;       // Entries decoded
+  struct entry entries[BOARD_SIZE];
 };
 
-// Struct to describe a particular level, episode or story
+// Struct to describe a particular level, episode or story, its numbers are
+// in the columns of the store at the same index
 struct block {
   const char* name;
   struct tab* tab;
-  struct block* orig;   // A pointer to the original block
-  struct block* copy;   // A pointer to the copy which we maintain updated whenever we sort
   bool updated;         // Whether the block has been updated with online info
   unsigned int retries; // Number of redownload retries
+};
+
+// Fixed description of a block, see the catalogue
+struct item {
+  char name[ID_LENGTH + 1];
+  uint8_t tab;              // Index of its tab in the catalogue
+  uint8_t row;              // 0 to 4 for A to E, 5 for X, NO_COORD for stories
+  uint8_t column;
+  uint8_t level;            // 0 to 4 within its episode, NO_COORD unless it's a level
+  uint32_t offset;          // Offset of its record in the savefile
+};
 
+// Every tab and block of the game, generated at compile time
+struct catalogue {
+  struct tab tabs[TAB_COUNT];       // Tabs, without their blocks
+  unsigned int first[TAB_COUNT];    // Index of the first block of each tab
+  uint8_t find[3][6];               // Tab of each type and tab, NO_COORD if none
+  struct item items[BLOCK_COUNT];   // Blocks, in the order of env->blocks
+};
+
+// Every number of every block, one column per field indexed like env->blocks,
+// so a pass over the blocks only loads the fields it reads
+struct store {
+  /* Tab, copied so filters don't go through block->tab */
+  uint8_t*  type;
+  uint8_t*  mode;
+  uint8_t*  tab;
+
+  /* Savefile */
+  uint32_t* id;
+  uint32_t* attempts;
+  uint32_t* deaths;
+  uint32_t* victories;
+  uint32_t* victories_ep;
+  uint8_t*  state;          // Capped to 255, only 0 to 2 are known
+  uint32_t* gold;
+  uint32_t* score_deathless;
+
+  /* User's entry in the leaderboard */
+  uint32_t* score;
+  uint32_t* rank;
+  uint32_t* tied_rank;
+  uint32_t* replay;
+};
+
+// Page of the entries of a leaderboard past its top BOARD_SIZE, see depth.c
+struct page {
+  uint32_t next;        // Next page of the same leaderboard, -1 if it's the last
+  uint32_t rank;        // Rank, tied rank and score of its first entry
+  uint32_t tied_rank;
+  uint32_t score;
+  uint32_t back;        // Score of its last entry, the next one is coded against it
+  uint16_t count;       // Entries in it
+  uint16_t size;        // Bytes of data used
+  unsigned char data[PAGE_SIZE - 24];
+};
+static_assert(sizeof(struct page) == PAGE_SIZE, "Page layout mismatch");
+
+// Pages of every deep leaderboard, in chunks which are never moved
+struct pages {
+  struct page** chunks;     // Chunks of PAGE_CHUNK pages
+  unsigned int chunk_count;
+  unsigned int count;       // Pages handed out so far
+  uint32_t free;            // Free list of pages, through their next, -1 if empty
+};
+
+// Leaderboard entries, one column per field, BOARD_SIZE entries per block
+// starting at its index * BOARD_SIZE, -1 (or NULL) where empty. Entries
+// ranked past them are in pages, see depth.c
+struct entries {
+  uint32_t* score;
+  uint32_t* replay;
+  uint32_t* rank;
+  uint32_t* tied_rank;
+  struct player** player;
+
+  /* Deep entries */
+  uint32_t* depth;          // Entries past the top BOARD_SIZE, per block
+  uint32_t* first;          // First and last page of them, -1 if none
+  uint32_t* last;
+  struct pages pages;
+};
+
+// One entry of a leaderboard, as read from the columns or the pages
+struct standing {
+  struct player* player;
+  uint32_t index;           // Of the player in the registry, -1 if none
+  uint32_t score;
+  uint32_t replay;
+  uint32_t rank;
+  uint32_t tied_rank;
+};
+
+// Position in the deep entries of a block
+struct deep_cursor {
+  uint32_t page;            // Page of the next entry, -1 past the last one
+  unsigned int i;           // Index of the next entry in the page
+  unsigned int pos;         // and its offset in the data
+  uint32_t rank;            // Last entry read
+  uint32_t tied_rank;
+  uint32_t score;
+};
+
+// Struct to hold a response, grows geometrically and is reused across requests
+struct buffer {
+  char* data;  // Always NUL terminated
+  size_t len;  // Bytes used, not counting the terminator
+  size_t cap;  // Bytes allocated, not counting the terminator
+};
+
+// Struct to hold one slot of the concurrent download window
+struct transfer {
+  CURL* curl;          // Easy handle, reused by every request of this slot
+  char* error;         // Buffer to store CURL error message
+  struct buffer res;   // Response of transfer
+  struct block* block; // Block being downloaded, NULL if the slot is idle
+  char url[128];       // URL being downloaded
+
+  /* Response replayed from the cache instead */
+  bool replayed;
+  long status;
+  CURLcode code;
+  uint64_t latency;    // Microseconds it took when recorded
+  uint64_t due;        // now_us() it's served at
+
+  uint64_t started;    // now_us() it started at
+};
+
+// Struct to hold a failed block waiting to be downloaded again
+struct retry {
+  struct block* block;
+  uint64_t due;        // Monotonic milliseconds
+};
+
+// Latencies in log buckets, HIST_STEPS of them per power of two of microseconds
+struct histogram {
+  uint32_t buckets[HIST_POWERS * HIST_STEPS];
+  uint64_t count;
+  uint64_t sum;  // Microseconds
+  uint64_t max;
+};
+
+// Metrics of a download, written by the downloading thread and read by any
+// other, see metrics.c
+struct metrics {
+  uint64_t start;                        // Monotonic microseconds it started at
+  uint64_t end;                          // And ended at, 0 while it's going on
+  struct histogram spans[SPAN_COUNT];    // Time spent in each part of a request
+  uint32_t events[EVENT_COUNT];
+  uint32_t failures[FAIL_COUNT];         // Failed transfers by kind
+  uint32_t status[HTTP_STATUS];          // Responses by HTTP status
+  uint64_t bytes;                        // Received, as sent by the server
+  uint64_t rate_second[RATE_SECONDS];    // Second each throughput bucket holds
+  uint64_t rate_bytes[RATE_SECONDS];
+  uint32_t rate_boards[RATE_SECONDS];
+};
+
+// Adaptive concurrency and rate cap of the downloads, see pacing.c
+struct pacing {
+  /* Settings, changed from any thread */
+  bool adaptive;           // Whether the limit follows the server, else it's the whole window
+  uint32_t rate;           // Requests started per second at most, 0 for no cap
+
+  /* Token bucket */
+  double tokens;           // Requests that can start right away
+  uint64_t refilled;       // now_us() the tokens were counted at
+
+  /* Current round of transfers */
+  uint64_t cut;            // now_us() of the last decrease, transfers started before don't count
+  uint32_t done;           // Transfers finished in the round
+  uint32_t failed;         // Of which failed on the server side
+  uint64_t elapsed;        // Total latency of the others, microseconds
+
+  /* State, read from any thread */
+  uint32_t window;         // Slots, the highest limit
+  uint32_t limit;          // Transfers allowed in flight
+  uint32_t latency;        // Mean latency of the last round, microseconds
+  uint32_t baseline;       // Latency of a healthy round, the lowest seen
+  uint32_t reason;         // enum paces of the last change
+  uint32_t increases;
+  uint32_t decreases;
+  uint32_t rounds;         // The limit after round n > 0 is history[n % PACE_HISTORY]
+  uint32_t history[PACE_HISTORY];
+};
+
+// Struct to hold an HTTP transfer
+struct curl {
+  /* Internal cURL variables */
+  CURLcode code; // Return code of the last option set
+  bool safe;     // Perform safety checks
+
+  /* Concurrent transfers */
+  CURLM* multi;            // Multi handle driving all the slots
+  struct transfer* slots;  // One slot per concurrent transfer
+  unsigned int window;     // Number of slots (max transfers in flight)
+  const char* host;        // Server to download the scores from
+
+  /* Retry scheduling */
+  struct retry* queue;     // Failed blocks, min-heap by due time
+  unsigned int qcount;
+  unsigned int qcap;
+  struct block** failed;   // Blocks out of attempts, until retry_failed()
+  unsigned int fcount;
+  unsigned int fcap;
+  unsigned int tab;        // Cursor over the blocks never tried yet
+  unsigned int index;
+  unsigned int streak;     // Server side failures in a row
+  uint64_t holdoff;        // No transfer starts before this, after a storm of failures
+  uint32_t seed;           // State of the jitter generator
+  struct pacing pacing;    // How many transfers go at once, and how fast they start
+
+  /* Instrumentation */
+  struct metrics metrics;
+  struct cache* cache;     // Where responses are recorded or replayed from, if anywhere
+
+  /* Additional project variables */
+  bool active;   // Whether Steam ID is active
+  int count;     // How many blocks have been updated
+};
+
+// Layout of a block record in the savefile (BLOCK_SIZE bytes)
+struct record {
   uint32_t id;
   uint32_t attempts;
   uint32_t deaths;
@@ -169,27 +469,176 @@ struct block {
   uint32_t victories_ep;
   uint32_t state;
   uint32_t gold;
+  uint32_t unknown;
   uint32_t score_deathless;
+  uint32_t score;
+  uint32_t rank;
+  uint32_t replay;
+};
+static_assert(sizeof(struct record) == BLOCK_SIZE, "Savefile record layout mismatch");
 
-  unsigned int score;
-  unsigned int rank;
-  unsigned int tied_rank;
-  unsigned int replay;
-  struct score* scores;
+// Layout of the player info in the savefile header (starts at NPP_USER_ID)
+struct header {
+  uint32_t id;
+  char     username[NPP_USERNAME_SIZE - 1];
+  uint32_t palette_id;
 };
 
-// Struct to hold an HTTP transfer
-struct curl {
-  /* Internal cURL variables */
-  CURL *curl;    // CURL handle
-  CURLcode code; // Operation return code
-  char* error;   // Buffer to store CURL error message
-  char* res;     // Response of transfer
-  bool safe;     // Perform safety checks
+// Struct to hold a read-only view of a file, mapped when possible
+struct mapping {
+  const unsigned char* data;
+  size_t size;
+  bool mapped;  // Whether data is a memory mapping or a heap copy
+};
 
-  /* Additional project variables */
-  bool active;   // Whether Steam ID is active
-  int count;     // How many blocks have been updated
+// Columns of a v2 scores file, one value per block or per leaderboard entry
+enum columns {
+  COL_RANK,
+  COL_TIED_RANK,
+  COL_REPLAY,
+  COL_SCORE,
+  COL_ENTRY_PLAYER, // Index of the player in the file, -1 if none
+  COL_ENTRY_REPLAY,
+  COL_ENTRY_SCORE,
+  COL_COUNT
+};
+
+// Header of a download journal, followed by records
+struct journal_header {
+  char     magic[4];
+  uint8_t  filetype;
+  uint8_t  major;
+  uint8_t  minor;
+  uint8_t  patch;
+  uint32_t version;
+  uint32_t bcount;    // Block count, over all tabs
+  uint64_t steam_id;  // Whose scores were being downloaded
+  uint64_t time;      // UNIX timestamp of the start of the download
+};
+
+// Header of a journaled board, followed by size bytes of packed board
+struct journal_record {
+  uint32_t size;
+  uint32_t crc;       // CRC-32 of index, id and the packed board
+  uint32_t index;     // Global index of the block
+  uint32_t id;        // ID of the block, so a journal can't apply to the wrong one
+};
+
+// Open download journal
+struct journal {
+  FILE* file;             // NULL if journaling failed
+  const char* filename;
+  unsigned int pending;   // Records appended since the last sync to disk
+};
+
+// Header of a response cache, followed by entries
+struct cache_header {
+  char     magic[4];
+  uint8_t  filetype;
+  uint8_t  major;
+  uint8_t  minor;
+  uint8_t  patch;
+  uint32_t version;
+  uint32_t window;    // Concurrent transfers it was recorded with
+  uint64_t time;      // UNIX timestamp of the recording
+};
+
+// Header of a recorded response, followed by key_size bytes of URL and size
+// bytes of body
+struct cache_entry {
+  uint32_t size;
+  uint32_t latency;   // Microseconds the whole request took
+  uint16_t key_size;
+  uint16_t status;    // HTTP status, 0 if there was no response
+  uint16_t code;      // CURLcode of the transfer
+  uint16_t unused;
+};
+
+// Responses recorded to a file, or replayed from it, see cache.c
+struct cache {
+  enum caching mode;
+  bool timed;             // Replayed after the latency they were recorded with
+  const char* filename;
+  FILE* file;             // Recording to, NULL if recording failed
+  struct mapping map;     // Replaying from
+  uint32_t* offsets;      // Of each entry in the file, in recording order
+  uint32_t* next;         // Next entry of the same URL, -1 if none
+  uint32_t* table;        // First entry of each URL, by hash, -1 if empty
+  uint32_t* served;       // Entry the next request of each URL gets
+  unsigned int count;     // Entries
+  unsigned int size;      // Of the table, a power of two
+  unsigned int misses;    // Requests replayed without a recording
+};
+
+// Importance of a log record
+enum levels { LOG_INFO, LOG_WARN, LOG_ERROR };
+
+// One record of the log, see logger.c
+struct log_record {
+  uint64_t time;          // Wall clock microseconds
+  const char* source;     // Name of the thread it was logged from, see log_thread()
+  enum levels level;
+  char message[LOG_SLOT - 2 * sizeof(uint64_t) - sizeof(const char*) - sizeof(enum levels)];
+};
+
+// Savefile watched for the saves of the game
+struct watcher {
+  const char* filename;
+  const char* name;         // Part of the filename after its directory
+  int fd;                   // inotify instance, -1 when polling the file's status instead
+  uint64_t mtime;           // Modification time (microseconds) and size last seen
+  size_t size;
+  bool pending;             // Written since it was last read
+  bool closed;              // And the writer is done with it
+  uint64_t written;         // now_ms() of the last write
+  unsigned char* records;   // Block records as last decoded, in the order of env->blocks
+  unsigned int* changed;    // Blocks changed by the last update
+  unsigned int count;       // How many
+  unsigned int orders;      // Sort orders (1 << enum orders) whose columns they changed
+  bool states;              // Whether they changed any state
+  uint64_t saved;           // Wall clock microseconds at which the last update was saved,
+  uint64_t noticed;         // noticed,
+  uint64_t applied;         // applied to the store,
+  uint64_t shown;           // and shown (0 until it is)
+};
+
+// Header of a v2 scores file, offsets are from the start of the file
+struct scores_header {
+  char     magic[4];
+  uint8_t  filetype;
+  uint8_t  major;
+  uint8_t  minor;
+  uint8_t  patch;
+  uint32_t version;       // Format version, SCORES_VERSION
+  uint32_t pcount;        // Player count
+  uint32_t tcount;        // Tab count
+  uint32_t bcount;        // Block count, over all tabs
+  uint64_t time;          // UNIX timestamp
+  uint32_t directory;     // Tab directory, tcount entries
+  uint32_t players;       // Player IDs, pcount entries
+  uint32_t names;         // Offsets of player names in the string table, -1 if none
+  uint32_t strings;       // String table, NUL terminated names
+  uint32_t strings_size;
+  uint32_t columns[COL_COUNT];
+  uint32_t base;          // Deltas: offset of the base snapshot filename in the string table
+  uint32_t blocks;        // Deltas: global index of every stored block, bcount entries
+  uint64_t base_time;     // Deltas: timestamp of the base snapshot
+  uint32_t depths;        // v3: entries past the top BOARD_SIZE of every block, bcount entries
+  uint32_t offsets;       // v3: offset of those of every block in the deep entries, bcount entries
+  uint32_t deep;          // v3: deep entries, varint coded like the pages of a leaderboard
+  uint32_t deep_size;
+};
+static_assert(sizeof(struct scores_header) % SCORES_ALIGN == 0, "Scores header must keep alignment");
+
+// Entry of the tab directory of a v2 scores file
+struct scores_tab {
+  uint8_t  platform;
+  uint8_t  mode;
+  uint8_t  type;
+  uint8_t  tab;
+  uint32_t size;   // Block count
+  uint32_t first;  // Index of the first block in the columns
+  uint32_t reserved;
 };
 
 // Struct to describe the player
@@ -220,16 +669,105 @@ struct env {
   struct profile* profile;
   struct tab*     tabs;
   struct block*   blocks;
-  struct player*  players;
-  struct score*   scores;
+  struct registry* players;
+  struct store    store;   // Numbers of env->blocks
+  struct entries  entries; // Leaderboards of env->blocks
 
   unsigned int tcount; // Tab count
   unsigned int bcount; // Block count
-  unsigned int pcount; // Player count
   unsigned int scount; // Score count
   unsigned int lcount; // Leaderboard count
 
   DownloadFlags flags;
+  struct mapping map;     // Last loaded scores file, player names may point into it
+  unsigned int revision;  // Bumped whenever the loaded scores change
+  struct feed*  feed;     // Where downloads are published instead, if any
+  struct journal* journal; // Where downloads are recorded as they complete, if any
+};
+
+// Decoded boards of one download, in chunks which are never moved
+struct pool {
+  struct board** chunks;
+  unsigned int chunk_count;
+  unsigned int count;
+};
+
+// Immutable state of a download, published to the readers as a whole
+struct snapshot {
+  unsigned int version;        // Bumped by every publication
+  unsigned int generation;     // Bumped by every new download
+  unsigned int count;          // Boards downloaded so far
+  bool complete;               // Whether every board was downloaded
+  time_t time;                 // When it was published
+  const struct board** boards; // Board of each block, NULL if not downloaded yet
+  struct pool* pool;           // Boards freed along with it, set on the last snapshot of a download
+  struct snapshot* next;       // Next retired snapshot
+  uint64_t retired;            // Epoch it was retired at
+};
+
+// Downloaded boards going from one writer thread to the reader threads
+struct feed {
+  struct snapshot* current;          // Latest snapshot, swapped atomically
+  uint64_t epoch;                    // Bumped by every publication
+  uint64_t readers[FEED_READERS];    // Epoch each reader entered at, 0 if not reading
+
+  /* Writer only */
+  unsigned int bcount;
+  unsigned int count;                // Boards put in the working set
+  unsigned int version;
+  unsigned int generation;
+  const struct board** boards;       // Working set, published by copy
+  struct pool* pool;                 // Boards of the current download
+  struct pool* done;                 // Boards of the previous download, until its last snapshot is retired
+  struct snapshot* retired;          // Snapshots readers may still be using
+};
+
+// Reader side of a feed, owned by the reading thread
+struct reader {
+  unsigned int slot;             // Index in feed->readers
+  unsigned int version;          // Snapshot last applied
+  unsigned int generation;
+  bool complete;
+  const struct board** applied;  // Board applied to each block
+};
+
+// Per-player aggregates over every loaded leaderboard, rebuilt when scores change
+struct stats {
+  unsigned int revision;  // env->revision they were built from
+  unsigned int pcount;    // Players covered
+  unsigned int tcount;    // Tabs covered
+  unsigned int capacity;  // Players there is room for
+  uint16_t*    counts;    // Scores by player, tab and rank, [(player * tcount + tab) * BOARD_SIZE + rank]
+  uint16_t*    tied;      // Same, by tied rank
+  uint64_t*    totals;    // Score sums by player and tab, [player * tcount + tab]
+};
+
+// Column to sort blocks by
+struct sort_key {
+  enum orders order;
+  bool        reverse;
+};
+
+// Rows of the main table that pass the filters, and their footer totals
+struct view {
+  unsigned int* rows;     // Indices in the displayed blocks array, in display order
+  unsigned int  count;
+  unsigned int  revision; // env->revision it was built from
+  bool          dirty;    // Filters or order changed since it was built
+  unsigned int  scored;   // Rows with a score
+  unsigned int  ranked;   // Rows with a rank
+  unsigned int  atts;
+  unsigned int  vics;
+  unsigned int  gold;
+  unsigned int  rank;
+  uint64_t      score;
+};
+
+// Row of a ranking (player), spread or list (block)
+struct row {
+  struct player* player;
+  struct block*  block;
+  double         value;
 };
 
 //-----------------------------------------------------------------------------
@@ -241,51 +779,220 @@ void seterr(const char* msg);
 void puterr(const char* msg);
 void setlog(const char* msg);
 void putlog(const char* msg);
+void log_thread(const char* source);
+void log_write(enum levels level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+uint64_t log_count();
+uint64_t log_first();
+uint64_t log_dropped();
+bool log_read(uint64_t seq, struct log_record* out);
 
 // Basic I/O
 void kill(int status);
 void cls(int count);
 int read(unsigned char** buffer, const char* filename);
 int save(unsigned char* data, int size, const char* filename);
+int map_open(struct mapping* map, const char* filename);
+void map_close(struct mapping* map);
+void map_advise(struct mapping* map, size_t offset, size_t size, bool sequential);
 void arrdel(char* arr, int i, int* count, int sz, bool freeable = true);
 void* arradd(char* arr, char* elm, int* count, int sz, int i = -1);
+void buffer_init(struct buffer* buf, size_t cap = BUFFER_SIZE);
+bool buffer_append(struct buffer* buf, const char* data, size_t len);
+void buffer_clear(struct buffer* buf);
+void buffer_free(struct buffer* buf);
 
 // Flag manipulation
-inline void sflag(int* flags, int flag) { *flags |= flag; }       // Set flag
-inline void cflag(int* flags, int flag) { *flags &= ~flag; }      // Clear flag
-inline void tflag(int* flags, int flag) { *flags ^= flag; }       // Toggle flag
-inline bool gflag(int* flags, int flag) { return *flags & flag; } // Get flag
+// Flags are shared with the download thread, so they're atomic
+inline void sflag(int* flags, int flag) { __atomic_fetch_or(flags, flag, __ATOMIC_SEQ_CST); }        // Set flag
+inline void cflag(int* flags, int flag) { __atomic_fetch_and(flags, ~flag, __ATOMIC_SEQ_CST); }      // Clear flag
+inline void tflag(int* flags, int flag) { __atomic_fetch_xor(flags, flag, __ATOMIC_SEQ_CST); }       // Toggle flag
+inline bool gflag(int* flags, int flag) { return __atomic_load_n(flags, __ATOMIC_SEQ_CST) & flag; } // Get flag
 
 // Auxiliar
 void initialize();
 int save_config(struct config* config);
-struct config* parse_config(struct player* players, unsigned int* pcount);
-int parse_scores(struct env* env);
-int save_scores(struct env* env);
-void playerdealloc(struct player** players, size_t sz);
+struct config* parse_config(struct registry* players);
+bool is_hacker(struct config* config, struct player* player);
+bool is_cheater(struct config* config, struct player* player);
+
+// Scores files
+int parse_scores(struct env* env, const char* filename = SCORES);
+int save_scores(struct env* env, const char* filename = SCORES);
+int save_delta(struct env* env, const char* base, const char* filename);
+int compact_scores(struct env* env, const char* filename, const char* output);
+int merge_scores(struct env* env, const char* filename);
 void blockdealloc(struct block** blocks,  int sz);
 
+// Arenas and interned strings
+void arena_init(struct arena* arena);
+void* arena_alloc(struct arena* arena, size_t size);
+char* arena_strdup(struct arena* arena, const char* s);
+void arena_reset(struct arena* arena);
+void arena_free(struct arena* arena);
+void strings_init(struct strings* set);
+const char* strings_intern(struct strings* set, const char* s, bool copy = true);
+const char* strings_find(const struct strings* set, const char* s);
+void strings_clear(struct strings* set);
+void strings_free(struct strings* set);
+
+// Block catalogue
+extern const struct catalogue catalogue;
+int catalogue_find(enum types type, enum tabs tab, unsigned int row, unsigned int column, unsigned int level);
+int catalogue_lookup(const char* name);
+
+// Block store
+void store_init(struct store* store, unsigned int bcount);
+void store_free(struct store* store);
+void store_clear(struct store* store, unsigned int first, unsigned int count);
+void entries_init(struct entries* entries, unsigned int bcount);
+void entries_free(struct entries* entries);
+void entries_clear(struct entries* entries, unsigned int first, unsigned int count);
+
+// Deep leaderboards
+unsigned char* deep_encode(unsigned char* p, uint32_t player, uint32_t prev, uint32_t score, uint32_t replay);
+bool deep_decode(const unsigned char** p, const unsigned char* end, uint32_t* player, uint32_t* score, uint32_t* replay);
+void deep_init(struct entries* entries, unsigned int bcount);
+void deep_free(struct entries* entries);
+void deep_clear(struct entries* entries, unsigned int first, unsigned int count);
+void deep_append(struct entries* entries, unsigned int b, uint32_t player, uint32_t score, uint32_t replay, uint32_t rank, uint32_t tied_rank);
+void deep_seek(const struct entries* entries, unsigned int b, unsigned int rank, struct deep_cursor* c);
+bool deep_next(const struct entries* entries, struct registry* players, struct deep_cursor* c, struct standing* out);
+unsigned int leaderboard_size(const struct env* env, unsigned int b);
+void leaderboard_put(struct env* env, unsigned int b, struct player* player, uint32_t score, uint32_t replay, uint32_t rank, uint32_t tied_rank);
+unsigned int leaderboard_read(struct env* env, unsigned int b, unsigned int rank, unsigned int count, struct standing* out);
+
+// Player registry
+void registry_init(struct registry* reg, unsigned int capacity = PLAYER_MAX);
+void registry_clear(struct registry* reg);
+void registry_free(struct registry* reg);
+struct player* registry_get(struct registry* reg, unsigned int index);
+struct player* registry_insert(struct registry* reg, unsigned int id, const char* name, bool copy = true);
+struct player* add_player(struct registry* reg, struct config* config, unsigned int id = -1, const char* name = NULL);
+struct player* find_player_by_id(struct registry* reg, unsigned int id);
+struct player* find_player_by_name(struct registry* reg, const char* name);
+
 // Parsing nprofile
-void parse_profile(unsigned char* f, struct profile* profile);
-const char* generate_id(struct tab* tab, int i);
+int savefile_open(struct mapping* sf, const char* filename);
+void savefile_close(struct mapping* sf);
+const struct record* savefile_records(const unsigned char* f, enum types type);
+const struct header* savefile_header(const unsigned char* f);
+void parse_profile(const unsigned char* f, struct profile* profile);
 void create_tabs(struct tab* tabs);
-void fill_blocks(struct tab* tabs, size_t tab_count, struct block* blocks, struct score* scores);
-void parse_tab(unsigned char* f, struct tab* tab);
-void parse_tabs(unsigned char* f, struct tab* tabs);
+void fill_blocks(struct tab* tabs, size_t tab_count, struct block* blocks, struct store* store);
+void env_init(struct env* env, struct config* config);
+void env_free(struct env* env);
+void parse_tab(const unsigned char* f, struct env* env, struct tab* tab);
+void parse_tabs(const unsigned char* f, struct env* env);
 struct tab* find_tab(struct tab* tabs, int sz, enum modes mode, enum types type, enum tabs tab);
 
+// Decoding savefile records
+enum decoders decode_select(enum decoders best);
+void decode_records(const struct record* records, unsigned int count, struct store* store, unsigned int first);
+void decode_counters(const struct record* records, unsigned int count, struct store* store, unsigned int first);
+
+// Watching the savefile
+int watch_open(struct watcher* watcher, struct env* env, const char* filename);
+int watch_poll(struct watcher* watcher, struct env* env);
+void watch_shown(struct watcher* watcher);
+void watch_close(struct watcher* watcher);
+
 // cURL methods
-size_t curlwrite(char* data, size_t size, size_t nmemb, char** res);
-int curlinit(struct curl* curl);
-int curldownload(struct curl* curl, const char* url);
+size_t curlwrite(char* data, size_t size, size_t nmemb, struct buffer* res);
+int curlsetup(struct curl* curl, CURL* handle, char* error, struct buffer* res);
+int curlinit(struct curl* curl, unsigned int window = WINDOW);
 void curlinfo(struct curl* curl);
 void curldestroy(struct curl* curl);
 
+// Decoding get_scores responses
+int decode_scores(const char* res, size_t len, struct board* board);
+int decode_scores_cjson(const char* res, size_t len, struct board* board);
+void apply_board(struct env* env, struct block* block, const struct board* board);
+int parse_json(struct env* env, struct block* block, const char* res, size_t len);
+
 // Downloading scores
 int update_scores(struct env* env);
 
+// Retrying downloads
+uint64_t now_ms();
+bool retry_push(struct curl* curl, struct block* block, enum failures failure);
+void retry_now(struct curl* curl, struct block* block);
+void retry_ok(struct curl* curl);
+long retry_hold(struct curl* curl, uint64_t now);
+unsigned int retry_limit(struct curl* curl);
+struct block* retry_pop(struct curl* curl, uint64_t now);
+long retry_wait(struct curl* curl, uint64_t now);
+void retry_failed(struct curl* curl);
+void retry_reset(struct curl* curl);
+void retry_free(struct curl* curl);
+
+// Pacing downloads
+void pace_init(struct pacing* pacing, unsigned int window);
+void pace_reset(struct pacing* pacing);
+void pace_copy(struct pacing* dest, const struct pacing* src);
+unsigned int pace_limit(const struct pacing* pacing);
+bool pace_ready(struct pacing* pacing, uint64_t now);
+void pace_take(struct pacing* pacing);
+long pace_wait(struct pacing* pacing, uint64_t now);
+void pace_done(struct pacing* pacing, uint64_t started, uint64_t latency, bool congested, uint64_t now);
+const char* pace_reason(enum paces reason);
+
+// Download metrics
+uint64_t now_us();
+void metrics_reset(struct metrics* metrics);
+void metrics_copy(struct metrics* dest, const struct metrics* src);
+void metrics_done(struct metrics* metrics);
+void metrics_event(struct metrics* metrics, enum events event);
+void metrics_failure(struct metrics* metrics, enum failures failure);
+void metrics_span(struct metrics* metrics, enum spans span, uint64_t us);
+void metrics_transfer(struct metrics* metrics, CURL* curl, CURLcode code);
+void metrics_replay(struct metrics* metrics, long status, uint64_t latency, size_t size);
+void metrics_board(struct metrics* metrics);
+double metrics_seconds(const struct metrics* metrics);
+void metrics_rates(const struct metrics* metrics, double* bytes, double* boards);
+uint64_t histogram_percentile(const struct histogram* histogram, double fraction);
+char* metrics_json(const struct metrics* metrics);
+
+// Publishing downloads
+void feed_init(struct feed* feed, unsigned int bcount);
+void feed_free(struct feed* feed);
+void feed_reset(struct feed* feed);
+struct board* feed_board(struct feed* feed);
+void feed_put(struct feed* feed, unsigned int index);
+void feed_publish(struct feed* feed, bool complete);
+const struct snapshot* feed_enter(struct feed* feed, unsigned int slot);
+void feed_leave(struct feed* feed, unsigned int slot);
+void reader_init(struct reader* reader, unsigned int slot, unsigned int bcount);
+void reader_free(struct reader* reader);
+bool feed_sync(struct feed* feed, struct reader* reader, struct env* env);
+
+// Download journal
+int journal_open(struct journal* journal, struct env* env, const char* filename = JOURNAL);
+void journal_append(struct journal* journal, unsigned int index, uint32_t id, const struct board* board);
+void journal_flush(struct journal* journal, bool sync);
+void journal_close(struct journal* journal, bool done);
+
+// Response cache
+int cache_open(struct cache* cache, const char* filename, enum caching mode, unsigned int window);
+bool cache_fetch(struct cache* cache, const char* url, struct buffer* res, long* status, CURLcode* code, uint64_t* latency);
+void cache_store(struct cache* cache, const char* url, const struct buffer* res, long status, CURLcode code, uint64_t latency);
+void cache_close(struct cache* cache);
+
 // Printing info
 void print_profile(struct profile* profile);
-void compute_tab(struct tab* tab);
-int blkcmp(const void* b1, const void* b2);
-void blksort(struct block* blocks, size_t sz, enum orders order, bool reverse);
+void compute_tab(struct env* env, struct tab* tab);
+
+// Main table
+void sort_blocks(const struct store* store, unsigned int count, const struct sort_key* keys, unsigned int kcount, unsigned int* perm);
+bool view_update(struct view* view, struct env* env, const unsigned int* order, const bool tabs[6], const bool types[3], const bool modes[4], const bool states[3]);
+void view_free(struct view* view);
+
+// Stats
+unsigned int stats_mask(struct env* env, const bool types[3], const bool tabs[6]);
+bool stats_update(struct stats* stats, struct env* env);
+void stats_free(struct stats* stats);
+unsigned int stats_count(struct stats* stats, unsigned int player, unsigned int mask, unsigned int cutoff, bool ties);
+unsigned int stats_points(struct stats* stats, unsigned int player, unsigned int mask, bool ties);
+uint64_t stats_score(struct stats* stats, unsigned int player, unsigned int mask);
+unsigned int stats_ranking(struct stats* stats, struct env* env, enum rankings type, unsigned int mask, unsigned int cutoff, bool ties, struct row* rows);
+unsigned int stats_spreads(struct env* env, unsigned int mask, unsigned int inf, unsigned int sup, bool smallest, struct row* rows);
+unsigned int stats_lists(struct env* env, unsigned int mask, unsigned int inf, unsigned int sup, bool missing, bool ties, struct row* rows);
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "nprofilerlib.h"
+
+/**
+ * Pacing downloads.
+ *
+ * The server answers more requests at once up to a point, then makes them
+ * wait, then drops them with 502s, which is worse than not sending them: they
+ * cost a retry each, and a storm of them a holdoff. So how many transfers go
+ * at once isn't the window, but a limit which follows the server, AIMD style
+ * like TCP's congestion window: once a round of transfers (as many as the
+ * limit, PACE_ROUND at least) is in, the limit goes up by one if the round
+ * was healthy, and down to PACE_BETA of itself if too many of them failed on
+ * the server side, or their latency rose well above a healthy round's, which
+ * is the server queueing them. Until the first decrease, the limit doubles
+ * instead, so a download doesn't spend its first rounds far below it.
+ * Transfers started before a decrease don't count towards the next round,
+ * since they were sent at the old limit.
+ *
+ * On top of that, a token bucket caps how many requests start per second,
+ * for when the server wants less than it can take, with bursts of at most
+ * PACE_BURST seconds' worth.
+ *
+ * The settings and state are read and written with atomics, so the UI can
+ * show and change them while a download goes on.
+ */
+
+#define PACE_INITIAL 2     // Limit of a new download
+#define PACE_ROUND   16    // Fewest transfers a round takes, so one unlucky failure isn't too many
+#define PACE_BETA    0.7   // Of the limit kept on a decrease
+#define PACE_FAILED  0.1   // Most of a round that can fail on the server side while healthy
+#define PACE_SPIKE   1.5   // Latency of a round over the baseline's, above which it's queueing
+#define PACE_BURST   0.1   // Seconds' worth of requests which can start at once
+
+static uint32_t get32(const uint32_t* value) { return __atomic_load_n(value, __ATOMIC_RELAXED); }
+static void set32(uint32_t* value, uint32_t n) { __atomic_store_n(value, n, __ATOMIC_RELAXED); }
+
+/* Set up pacing for a window of slots, adaptive and without a rate cap */
+void pace_init(struct pacing* pacing, unsigned int window) {
+  memset(pacing, 0, sizeof(struct pacing));
+  pacing->adaptive = true;
+  pacing->window   = window > 0 ? window : 1;
+  pace_reset(pacing);
+}
+
+/* Start a new download from a small limit, keeping the settings */
+void pace_reset(struct pacing* pacing) {
+  pacing->tokens   = 1;
+  pacing->refilled = now_us();
+  pacing->cut      = 0;
+  pacing->done     = 0;
+  pacing->failed   = 0;
+  pacing->elapsed  = 0;
+  set32(&pacing->limit, PACE_INITIAL < pacing->window ? PACE_INITIAL : pacing->window);
+  set32(&pacing->latency, 0);
+  set32(&pacing->baseline, 0);
+  set32(&pacing->reason, PACE_START);
+  set32(&pacing->increases, 0);
+  set32(&pacing->decreases, 0);
+  __atomic_store_n(&pacing->rounds, 0, __ATOMIC_RELEASE);
+}
+
+/* Copy the state of a pacing which may be changing, e.g., to show it */
+void pace_copy(struct pacing* dest, const struct pacing* src) {
+  dest->adaptive  = __atomic_load_n(&src->adaptive, __ATOMIC_RELAXED);
+  dest->rate      = get32(&src->rate);
+  dest->window    = get32(&src->window);
+  dest->rounds    = __atomic_load_n(&src->rounds, __ATOMIC_ACQUIRE);
+  dest->limit     = get32(&src->limit);
+  dest->latency   = get32(&src->latency);
+  dest->baseline  = get32(&src->baseline);
+  dest->reason    = get32(&src->reason);
+  dest->increases = get32(&src->increases);
+  dest->decreases = get32(&src->decreases);
+  for (int i = 0; i < PACE_HISTORY; i++) dest->history[i] = get32(&src->history[i]);
+}
+
+/* How many transfers can be in flight */
+unsigned int pace_limit(const struct pacing* pacing) {
+  return __atomic_load_n(&pacing->adaptive, __ATOMIC_RELAXED) ? get32(&pacing->limit) : pacing->window;
+}
+
+static void refill(struct pacing* pacing, uint64_t now) {
+  uint32_t rate = get32(&pacing->rate);
+  double burst = rate * PACE_BURST > 1 ? rate * PACE_BURST : 1;
+  if (now > pacing->refilled) pacing->tokens += (double) rate * (now - pacing->refilled) / 1000000;
+  if (pacing->tokens > burst) pacing->tokens = burst;
+  pacing->refilled = now;
+}
+
+/* Whether a request can start now, under the rate cap */
+bool pace_ready(struct pacing* pacing, uint64_t now) {
+  if (get32(&pacing->rate) == 0) return true;
+  refill(pacing, now);
+  return pacing->tokens >= 1;
+}
+
+/* A request started */
+void pace_take(struct pacing* pacing) {
+  if (get32(&pacing->rate) > 0) pacing->tokens -= 1;
+}
+
+/* Milliseconds until a request can start under the rate cap, 0 if one can */
+long pace_wait(struct pacing* pacing, uint64_t now) {
+  uint32_t rate = get32(&pacing->rate);
+  if (rate == 0) return 0;
+  refill(pacing, now);
+  return pacing->tokens >= 1 ? 0 : (long) ((1 - pacing->tokens) * 1000 / rate) + 1;
+}
+
+/* Close a round of transfers, moving the limit by how it went */
+static void round_end(struct pacing* pacing, uint64_t now) {
+  uint32_t sent     = pace_limit(pacing);
+  uint32_t limit    = get32(&pacing->limit);
+  uint32_t baseline = get32(&pacing->baseline);
+  uint32_t ok       = pacing->done - pacing->failed;
+  uint32_t latency  = ok > 0 ? pacing->elapsed / ok : get32(&pacing->latency);
+  set32(&pacing->latency, latency);
+
+  enum paces reason = PACE_UP;
+  if (pacing->failed > PACE_FAILED * pacing->done) reason = PACE_ERRORS;
+  else if (ok > 0 && baseline > 0 && latency > PACE_SPIKE * baseline) reason = PACE_LATENCY;
+  if (!__atomic_load_n(&pacing->adaptive, __ATOMIC_RELAXED)) { // Fixed to the window, only the latency is followed
+    limit = pacing->window;
+  } else if (reason == PACE_UP) {
+    if (limit < pacing->window) {
+      limit = get32(&pacing->decreases) == 0 ? 2 * limit : limit + 1;
+      if (limit > pacing->window) limit = pacing->window;
+      set32(&pacing->limit, limit);
+      set32(&pacing->increases, get32(&pacing->increases) + 1);
+    }
+    set32(&pacing->reason, reason);
+  } else {
+    limit = limit * PACE_BETA > 1 ? limit * PACE_BETA : 1;
+    set32(&pacing->limit, limit);
+    set32(&pacing->decreases, get32(&pacing->decreases) + 1);
+    set32(&pacing->reason, reason);
+    pacing->cut = now;
+    log_write(LOG_INFO, "Pacing down to %u transfers at once: %s.", limit, pace_reason(reason));
+  }
+
+  /* Lowest latency seen, unless the server got slower: one transfer at a time, it's all the server's own */
+  if (ok > 0 && (baseline == 0 || latency < baseline || sent <= 1)) set32(&pacing->baseline, latency);
+
+  uint32_t rounds = get32(&pacing->rounds) + 1;
+  set32(&pacing->history[rounds % PACE_HISTORY], limit);
+  __atomic_store_n(&pacing->rounds, rounds, __ATOMIC_RELEASE);
+  pacing->done    = 0;
+  pacing->failed  = 0;
+  pacing->elapsed = 0;
+}
+
+/**
+ * Account for a finished transfer, started at the given now_us(), which took
+ * latency microseconds and whether it failed on the server side.
+ */
+void pace_done(struct pacing* pacing, uint64_t started, uint64_t latency, bool congested, uint64_t now) {
+  if (started < pacing->cut) return; // Sent at the limit before the last decrease
+  pacing->done++;
+  if (congested) pacing->failed++;
+  else pacing->elapsed += latency;
+  uint32_t limit = pace_limit(pacing);
+  if (pacing->done >= (limit > PACE_ROUND ? limit : PACE_ROUND)) round_end(pacing, now);
+}
+
+const char* pace_reason(enum paces reason) {
+  switch (reason) {
+    case PACE_START:   return "started";
+    case PACE_UP:      return "healthy";
+    case PACE_ERRORS:  return "server errors";
+    case PACE_LATENCY: return "latency spike";
+    default:           return "unknown";
+  }
+}
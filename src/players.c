@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "nprofilerlib.h"
+
+/**
+ * Player registry.
+ *
+ * Players live in fixed-size chunks which are never moved nor freed until the
+ * registry is destroyed, so the pointers stored in the entries stay valid as
+ * the registry grows. Two open addressing hash tables (linear probing) index
+ * the players by user ID and by name. Both store the player index + 1, so a
+ * zero slot is empty.
+ *
+ * Names are interned: players with the same name share one copy, and the
+ * table by name is keyed by that pointer, so a lookup hashes and compares the
+ * name once, against the interned strings, rather than once per probe. The
+ * copies live in an arena, which is rewound instead of freed name by name
+ * when the registry is cleared for the next scores file.
+ */
+
+#define EMPTY 0
+
+static uint32_t hash_id(unsigned int id) {
+  uint32_t h = id * 0x9E3779B1u; // Fibonacci hashing
+  return h ^ (h >> 16);
+}
+
+/* Interned names are hashed by address */
+static uint32_t hash_name(const char* name) {
+  uint64_t h = (uint64_t) (uintptr_t) name * 0x9E3779B97F4A7C15ull;
+  return (uint32_t) (h >> 32);
+}
+
+/* Insert an index in a table, assumes there is room */
+static void table_put(struct registry* reg, unsigned int* table, uint32_t hash, unsigned int index) {
+  unsigned int mask = reg->capacity - 1;
+  unsigned int i = hash & mask;
+  while (table[i] != EMPTY) i = (i + 1) & mask;
+  table[i] = index + 1;
+}
+
+/* Double the size of the hash tables and rehash every player */
+static void registry_grow(struct registry* reg) {
+  free(reg->ids);
+  free(reg->names);
+  reg->capacity *= 2;
+  reg->ids   = (unsigned int*) calloc(reg->capacity, sizeof(unsigned int));
+  reg->names = (unsigned int*) calloc(reg->capacity, sizeof(unsigned int));
+  for (unsigned int i = 0; i < reg->count; i++) {
+    struct player* p = registry_get(reg, i);
+    if (p->id != (unsigned int) -1) table_put(reg, reg->ids, hash_id(p->id), i);
+    if (p->name != NULL) table_put(reg, reg->names, hash_name(p->name), i);
+  }
+}
+
+void registry_init(struct registry* reg, unsigned int capacity) {
+  reg->count       = 0;
+  reg->chunk_count = 0;
+  reg->chunks      = NULL;
+  reg->capacity    = 16;
+  while (reg->capacity < 2 * capacity) reg->capacity *= 2;
+  reg->ids         = (unsigned int*) calloc(reg->capacity, sizeof(unsigned int));
+  reg->names       = (unsigned int*) calloc(reg->capacity, sizeof(unsigned int));
+  strings_init(&reg->strings);
+}
+
+/* Remove every player, but keep the memory around for reuse */
+void registry_clear(struct registry* reg) {
+  for (unsigned int i = 0; i < reg->count; i++) memset(registry_get(reg, i), 0, sizeof(struct player));
+  reg->count = 0;
+  memset(reg->ids,   0, reg->capacity * sizeof(unsigned int));
+  memset(reg->names, 0, reg->capacity * sizeof(unsigned int));
+  strings_clear(&reg->strings);
+}
+
+void registry_free(struct registry* reg) {
+  registry_clear(reg);
+  for (unsigned int i = 0; i < reg->chunk_count; i++) free(reg->chunks[i]);
+  free(reg->chunks);
+  free(reg->ids);
+  free(reg->names);
+  strings_free(&reg->strings);
+  reg->chunks      = NULL;
+  reg->ids         = NULL;
+  reg->names       = NULL;
+  reg->chunk_count = 0;
+  reg->capacity    = 0;
+}
+
+struct player* registry_get(struct registry* reg, unsigned int index) {
+  if (index >= reg->count) return NULL;
+  return &reg->chunks[index / PLAYER_CHUNK][index % PLAYER_CHUNK];
+}
+
+/**
+ * Append a new player. Lookups are not checked here. The name is interned,
+ * and copied if it's new, unless told otherwise, in which case it must
+ * outlive the player.
+ */
+struct player* registry_insert(struct registry* reg, unsigned int id, const char* name, bool copy) {
+  /* Keep both tables at most half full */
+  if (2 * (reg->count + 1) > reg->capacity) registry_grow(reg);
+
+  /* Allocate a new chunk when the current ones are full */
+  unsigned int index = reg->count;
+  if (index / PLAYER_CHUNK >= reg->chunk_count) {
+    reg->chunks = (struct player**) realloc(reg->chunks, (reg->chunk_count + 1) * sizeof(struct player*));
+    reg->chunks[reg->chunk_count++] = (struct player*) calloc(PLAYER_CHUNK, sizeof(struct player));
+  }
+
+  struct player* p = &reg->chunks[index / PLAYER_CHUNK][index % PLAYER_CHUNK];
+  p->id      = id;
+  p->name    = name != NULL ? strings_intern(&reg->strings, name, copy) : NULL;
+  p->index   = index;
+  p->count   = 0;
+  p->scores  = NULL;
+  p->cheater = false;
+  p->hacker  = false;
+  reg->count++;
+
+  if (id != (unsigned int) -1) table_put(reg, reg->ids, hash_id(id), index);
+  if (name != NULL) table_put(reg, reg->names, hash_name(p->name), index);
+  return p;
+}
+
+/* Lookups return the first player that was added with that ID / name */
+struct player* find_player_by_id(struct registry* reg, unsigned int id) {
+  if (reg->count == 0) return NULL;
+  unsigned int mask = reg->capacity - 1;
+  struct player* found = NULL;
+  for (unsigned int i = hash_id(id) & mask; reg->ids[i] != EMPTY; i = (i + 1) & mask) {
+    struct player* p = registry_get(reg, reg->ids[i] - 1);
+    if (p->id == id && (found == NULL || p->index < found->index)) found = p;
+  }
+  return found;
+}
+
+struct player* find_player_by_name(struct registry* reg, const char* name) {
+  if (name == NULL || reg->count == 0) return NULL;
+  name = strings_find(&reg->strings, name);
+  if (name == NULL) return NULL; // No player ever had it
+  unsigned int mask = reg->capacity - 1;
+  struct player* found = NULL;
+  for (unsigned int i = hash_name(name) & mask; reg->names[i] != EMPTY; i = (i + 1) & mask) {
+    struct player* p = registry_get(reg, reg->names[i] - 1);
+    if (p->name == name && (found == NULL || p->index < found->index)) found = p;
+  }
+  return found;
+}
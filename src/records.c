@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define RECORDS_X86
+#endif
+
+#include "nprofilerlib.h"
+
+/**
+ * Savefile record decoding.
+ *
+ * The records of a tab are an array of 48-byte structs in the savefile, and
+ * their fields go to the store, one column per field. Decoding is then a
+ * transpose: the SSE2 decoder loads 4 records as 12 vectors and transposes
+ * them 4x4 with unpacks, and the AVX2 one gathers each field of 8 records
+ * at once. Whatever's left at the end of a tab goes through the scalar
+ * decoder, which is also used on CPUs without either.
+ *
+ * The best decoder the CPU supports is picked on first use, and
+ * decode_select() can force a lesser one, e.g., to benchmark them.
+ */
+
+typedef void (*decoder)(const struct record* records, unsigned int count, struct store* store, unsigned int first);
+
+static void decode_scalar(const struct record* records, unsigned int count, struct store* store, unsigned int first) {
+  for (unsigned int i = 0; i < count; i++) {
+    const struct record* record = &records[i];
+    unsigned int b = first + i;
+    store->id[b]              = record->id;
+    store->attempts[b]        = record->attempts;
+    store->deaths[b]          = record->deaths;
+    store->victories[b]       = record->victories;
+    store->victories_ep[b]    = record->victories_ep;
+    store->state[b]           = record->state < 255 ? record->state : 255;
+    store->gold[b]            = record->gold;
+    store->score_deathless[b] = record->score_deathless;
+    store->replay[b]          = record->replay;
+  }
+}
+
+#ifdef RECORDS_X86
+/* Rows a, b, c, d become columns */
+static inline void transpose(__m128i* a, __m128i* b, __m128i* c, __m128i* d) {
+  __m128i ab_lo = _mm_unpacklo_epi32(*a, *b); // a0 b0 a1 b1
+  __m128i cd_lo = _mm_unpacklo_epi32(*c, *d); // c0 d0 c1 d1
+  __m128i ab_hi = _mm_unpackhi_epi32(*a, *b); // a2 b2 a3 b3
+  __m128i cd_hi = _mm_unpackhi_epi32(*c, *d); // c2 d2 c3 d3
+  *a = _mm_unpacklo_epi64(ab_lo, cd_lo);
+  *b = _mm_unpackhi_epi64(ab_lo, cd_lo);
+  *c = _mm_unpacklo_epi64(ab_hi, cd_hi);
+  *d = _mm_unpackhi_epi64(ab_hi, cd_hi);
+}
+
+static inline void store4(uint32_t* column, __m128i v) {
+  _mm_storeu_si128((__m128i*) column, v);
+}
+
+/* Store 4 states capped to 255, without SSE4.1's unsigned min */
+static inline void store4_state(uint8_t* column, __m128i v) {
+  __m128i small = _mm_cmpeq_epi32(_mm_andnot_si128(_mm_set1_epi32(255), v), _mm_setzero_si128());
+  v = _mm_or_si128(_mm_and_si128(small, v), _mm_andnot_si128(small, _mm_set1_epi32(255)));
+  v = _mm_packs_epi32(v, v);
+  v = _mm_packus_epi16(v, v);
+  uint32_t bytes = (uint32_t) _mm_cvtsi128_si32(v);
+  memcpy(column, &bytes, sizeof(bytes));
+}
+
+static void decode_sse2(const struct record* records, unsigned int count, struct store* store, unsigned int first) {
+  unsigned int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i* r = (const __m128i*) &records[i]; // 3 vectors per record
+    unsigned int b = first + i;
+
+    /* id, attempts, deaths, victories */
+    __m128i v0 = _mm_loadu_si128(r + 0), v1 = _mm_loadu_si128(r + 3), v2 = _mm_loadu_si128(r + 6), v3 = _mm_loadu_si128(r + 9);
+    transpose(&v0, &v1, &v2, &v3);
+    store4(store->id + b,        v0);
+    store4(store->attempts + b,  v1);
+    store4(store->deaths + b,    v2);
+    store4(store->victories + b, v3);
+
+    /* victories_ep, state, gold, unknown */
+    v0 = _mm_loadu_si128(r + 1), v1 = _mm_loadu_si128(r + 4), v2 = _mm_loadu_si128(r + 7), v3 = _mm_loadu_si128(r + 10);
+    transpose(&v0, &v1, &v2, &v3);
+    store4(store->victories_ep + b, v0);
+    store4_state(store->state + b,  v1);
+    store4(store->gold + b,         v2);
+
+    /* score_deathless, score, rank, replay */
+    v0 = _mm_loadu_si128(r + 2), v1 = _mm_loadu_si128(r + 5), v2 = _mm_loadu_si128(r + 8), v3 = _mm_loadu_si128(r + 11);
+    transpose(&v0, &v1, &v2, &v3);
+    store4(store->score_deathless + b, v0);
+    store4(store->replay + b,          v3);
+  }
+  decode_scalar(records + i, count - i, store, first + i);
+}
+
+#define GATHER(records, index, field) \
+  _mm256_i32gather_epi32((const int*) (records) + offsetof(struct record, field) / 4, index, 4)
+
+__attribute__((target("avx2")))
+static void decode_avx2(const struct record* records, unsigned int count, struct store* store, unsigned int first) {
+  const int stride = BLOCK_SIZE / 4;
+  const __m256i index = _mm256_setr_epi32(0, stride, 2 * stride, 3 * stride, 4 * stride, 5 * stride, 6 * stride, 7 * stride);
+  const __m256i bytes = _mm256_setr_epi8( // Byte 0 of each state to the bottom of its lane
+    0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  unsigned int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const struct record* r = &records[i];
+    unsigned int b = first + i;
+    _mm256_storeu_si256((__m256i*) (store->id + b),              GATHER(r, index, id));
+    _mm256_storeu_si256((__m256i*) (store->attempts + b),        GATHER(r, index, attempts));
+    _mm256_storeu_si256((__m256i*) (store->deaths + b),          GATHER(r, index, deaths));
+    _mm256_storeu_si256((__m256i*) (store->victories + b),       GATHER(r, index, victories));
+    _mm256_storeu_si256((__m256i*) (store->victories_ep + b),    GATHER(r, index, victories_ep));
+    _mm256_storeu_si256((__m256i*) (store->gold + b),            GATHER(r, index, gold));
+    _mm256_storeu_si256((__m256i*) (store->score_deathless + b), GATHER(r, index, score_deathless));
+    _mm256_storeu_si256((__m256i*) (store->replay + b),          GATHER(r, index, replay));
+
+    __m256i state = _mm256_shuffle_epi8(_mm256_min_epu32(GATHER(r, index, state), _mm256_set1_epi32(255)), bytes);
+    uint32_t lo = (uint32_t) _mm_cvtsi128_si32(_mm256_castsi256_si128(state));
+    uint32_t hi = (uint32_t) _mm_cvtsi128_si32(_mm256_extracti128_si256(state, 1));
+    memcpy(store->state + b,     &lo, sizeof(lo));
+    memcpy(store->state + b + 4, &hi, sizeof(hi));
+  }
+  decode_scalar(records + i, count - i, store, first + i);
+}
+#endif
+
+static decoder decode = NULL;
+
+/* Use the best decoder up to the one given that the CPU supports, returns which */
+enum decoders decode_select(enum decoders best) {
+  enum decoders chosen = DECODE_SCALAR;
+#ifdef RECORDS_X86
+  __builtin_cpu_init();
+  if (best >= DECODE_AVX2 && __builtin_cpu_supports("avx2")) chosen = DECODE_AVX2;
+  else if (best >= DECODE_SSE2 && __builtin_cpu_supports("sse2")) chosen = DECODE_SSE2;
+#endif
+  switch (chosen) {
+#ifdef RECORDS_X86
+    case DECODE_AVX2: decode = decode_avx2; break;
+    case DECODE_SSE2: decode = decode_sse2; break;
+#endif
+    default:          decode = decode_scalar; break;
+  }
+  return chosen;
+}
+
+/* Decode count records into the store columns, from the block at index first */
+void decode_records(const struct record* records, unsigned int count, struct store* store, unsigned int first) {
+  if (decode == NULL) decode_select(DECODE_AVX2);
+  decode(records, count, store, first);
+}
+
+/**
+ * Decode only the counters of count records, the columns the game changes as
+ * it's played. The IDs never change, and the replays may have been replaced
+ * by downloaded ones, so both are left alone, and a download reading them
+ * meanwhile is fine.
+ */
+void decode_counters(const struct record* records, unsigned int count, struct store* store, unsigned int first) {
+  for (unsigned int i = 0; i < count; i++) {
+    const struct record* record = &records[i];
+    unsigned int b = first + i;
+    store->attempts[b]        = record->attempts;
+    store->deaths[b]          = record->deaths;
+    store->victories[b]       = record->victories;
+    store->victories_ep[b]    = record->victories_ep;
+    store->state[b]           = record->state < 255 ? record->state : 255;
+    store->gold[b]            = record->gold;
+    store->score_deathless[b] = record->score_deathless;
+  }
+}
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "nprofilerlib.h"
+
+/**
+ * Retry scheduling.
+ *
+ * A failed block isn't downloaded again right away: it waits in a queue (a
+ * min-heap by due time) with exponential backoff and jitter, while the slots
+ * keep downloading the healthy blocks. How long it waits and how many times
+ * it's tried depends on how it failed. Blocks out of attempts are set aside
+ * until retry_failed() gives them another round.
+ *
+ * When a whole window of transfers in a row fails on the server side, it's a
+ * storm (e.g., the server answering 502 to everything) rather than bad luck
+ * with some blocks. Then every failure holds off all transfers for a while,
+ * after which a single transfer probes the server, until one goes through.
+ */
+
+#define HOLD_BASE 100   // Milliseconds of the first holdoff
+#define HOLD_CAP  1000  // Longest holdoff, short since probing is cheap
+
+/* Backoff of each kind of failure, indexed by enum failures */
+static const struct policy {
+  unsigned int base;      // Milliseconds before the first retry
+  unsigned int cap;       // Longest wait between two attempts
+  unsigned int attempts;  // Attempts before giving up on the block
+} policies[] = {
+  {  250,  8000, RETRIES }, // FAIL_SERVER: 5xx or 429, wait for the server to recover
+  { 1000, 30000, 10 },      // FAIL_TIMEOUT: a slow server, don't pile more on it
+  {  500, 30000, RETRIES }, // FAIL_NETWORK: refused or reset connections, DNS...
+  {  100,  2000, 5 },       // FAIL_PARSE: a broken response, likely to be broken again
+  {    0,     0, 1 },       // FAIL_CLIENT: any other 4xx, retrying won't help
+};
+
+uint64_t now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* xorshift32, the jitter doesn't need more */
+static uint32_t jitter(struct curl* curl) {
+  uint32_t x = curl->seed != 0 ? curl->seed : (uint32_t) now_ms() | 1;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  curl->seed = x;
+  return x;
+}
+
+static void heap_push(struct curl* curl, struct block* block, uint64_t due) {
+  if (curl->qcount == curl->qcap) {
+    curl->qcap  = curl->qcap > 0 ? 2 * curl->qcap : 64;
+    curl->queue = (struct retry*) realloc(curl->queue, curl->qcap * sizeof(struct retry));
+  }
+  unsigned int i = curl->qcount++;
+  while (i > 0 && curl->queue[(i - 1) / 2].due > due) {
+    curl->queue[i] = curl->queue[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  curl->queue[i] = (struct retry) { block, due };
+}
+
+static struct block* heap_pop(struct curl* curl) {
+  struct block* block = curl->queue[0].block;
+  struct retry last = curl->queue[--curl->qcount];
+  unsigned int i = 0;
+  while (true) {
+    unsigned int c = 2 * i + 1;
+    if (c >= curl->qcount) break;
+    if (c + 1 < curl->qcount && curl->queue[c + 1].due < curl->queue[c].due) c++;
+    if (curl->queue[c].due >= last.due) break;
+    curl->queue[i] = curl->queue[c];
+    i = c;
+  }
+  curl->queue[i] = last;
+  return block;
+}
+
+/* Equal jitter: at least half the backoff, so a burst of failures doesn't come back at once */
+static uint64_t backoff(struct curl* curl, unsigned int base, unsigned int cap, unsigned int shift) {
+  uint64_t delay = (uint64_t) base << (shift < 16 ? shift : 16);
+  if (delay > cap) delay = cap;
+  return delay / 2 + jitter(curl) % (delay / 2 + 1);
+}
+
+/* Schedule a block that just failed, returns false if it's out of attempts */
+bool retry_push(struct curl* curl, struct block* block, enum failures failure) {
+  const struct policy* policy = &policies[failure];
+  uint64_t now = now_ms();
+  metrics_failure(&curl->metrics, failure);
+  if (failure == FAIL_SERVER || failure == FAIL_TIMEOUT || failure == FAIL_NETWORK) {
+    curl->streak++;
+    if (curl->streak >= curl->window) {
+      curl->holdoff = now + backoff(curl, HOLD_BASE, HOLD_CAP, curl->streak - curl->window);
+      metrics_event(&curl->metrics, EVENT_HOLDOFF);
+    }
+  }
+  if (block->retries >= policy->attempts || block->retries >= RETRIES) {
+    if (curl->fcount == curl->fcap) {
+      curl->fcap   = curl->fcap > 0 ? 2 * curl->fcap : 64;
+      curl->failed = (struct block**) realloc(curl->failed, curl->fcap * sizeof(struct block*));
+    }
+    curl->failed[curl->fcount++] = block;
+    metrics_event(&curl->metrics, EVENT_EXHAUSTED);
+    return false;
+  }
+
+  metrics_event(&curl->metrics, EVENT_RETRY);
+  heap_push(curl, block, now + backoff(curl, policy->base, policy->cap, block->retries > 1 ? block->retries - 1 : 0));
+  return true;
+}
+
+/* A transfer went through, so the server is fine */
+void retry_ok(struct curl* curl) {
+  curl->streak = 0;
+}
+
+/* Milliseconds until transfers can start again after a storm, 0 if they can */
+long retry_hold(struct curl* curl, uint64_t now) {
+  return curl->holdoff > now ? (long) (curl->holdoff - now) : 0;
+}
+
+/* How many transfers can be in flight, just the probe during a storm, else what the pacing allows */
+unsigned int retry_limit(struct curl* curl) {
+  return curl->streak >= curl->window ? 1 : pace_limit(&curl->pacing);
+}
+
+/* Schedule a block that didn't fail, e.g., aborted in flight, to be downloaded first */
+void retry_now(struct curl* curl, struct block* block) {
+  heap_push(curl, block, 0);
+}
+
+/* Next block whose retry is due, if any */
+struct block* retry_pop(struct curl* curl, uint64_t now) {
+  if (curl->qcount == 0 || curl->queue[0].due > now) return NULL;
+  return heap_pop(curl);
+}
+
+/* Milliseconds until the next retry is due, -1 if there are none */
+long retry_wait(struct curl* curl, uint64_t now) {
+  if (curl->qcount == 0) return -1;
+  return curl->queue[0].due > now ? (long) (curl->queue[0].due - now) : 0;
+}
+
+/* Give every block that ran out of attempts a new round, starting now */
+void retry_failed(struct curl* curl) {
+  for (unsigned int i = 0; i < curl->fcount; i++) {
+    curl->failed[i]->retries = 0;
+    retry_now(curl, curl->failed[i]);
+  }
+  curl->fcount = 0;
+}
+
+/* Forget every failure and start over from the first block, for a new download */
+void retry_reset(struct curl* curl) {
+  curl->qcount  = 0;
+  curl->fcount  = 0;
+  curl->tab     = 0;
+  curl->index   = 0;
+  curl->streak  = 0;
+  curl->holdoff = 0;
+}
+
+void retry_free(struct curl* curl) {
+  free(curl->queue);
+  free(curl->failed);
+  curl->queue  = NULL;
+  curl->failed = NULL;
+  curl->qcount = curl->qcap = 0;
+  curl->fcount = curl->fcap = 0;
+}
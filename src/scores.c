@@ -0,0 +1,718 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "nprofilerlib.h"
+
+/**
+ * Scores files.
+ *
+ * v1 (written by program versions 1.x.x) is a packed stream: header, then
+ * every player as ID + NUL terminated name, then every tab as a small header
+ * followed by 4 ints per block and 20 (player, replay, score) triples.
+ *
+ * v2 has a fixed header with the offsets of everything else: a tab directory,
+ * the player IDs, the offsets of their names in a string table, and one
+ * aligned column per field for blocks and leaderboard entries. The file is
+ * mapped and read in place, and player names point straight into it.
+ *
+ * v3 is v2 plus the leaderboard entries ranked past the top BOARD_SIZE: how
+ * many each block has, and where they start in a section where they're coded
+ * like the pages of a deep leaderboard, one block after the other. They're
+ * loaded into the pages an entry at a time, never decoded all at once.
+ *
+ * A delta is a v2 file which only stores the blocks that changed since a base
+ * snapshot, named in the string table, plus the global index of each of them.
+ * Loading one loads its base first (which may be a delta too) and then
+ * replaces those blocks. Compacting a chain folds it into a full snapshot.
+ */
+
+#define FILETYPE_SCORES 1 // Full snapshot
+#define FILETYPE_DELTA  2 // Only the blocks that changed since a base snapshot
+#define MAJOR_V2        2 // First version of the program to write v2 files
+#define VERSION_DEEP    3 // First format with deep leaderboards
+
+static inline uint32_t rd32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline size_t align(size_t offset) {
+  return (offset + SCORES_ALIGN - 1) & ~((size_t) SCORES_ALIGN - 1);
+}
+
+/* Find the loaded tab matching a tab stored in a scores file */
+static struct tab* match_tab(struct env* env, int platform, int mode, int type, int tab, unsigned int size) {
+  for (int j = 0; j < env->tcount; j++) {
+    struct tab* t = &env->tabs[j];
+    if (t->platform == platform && t->mode == mode && t->type == type && t->tab == tab && t->size == size && t->online) return t;
+  }
+  return NULL;
+}
+
+// Ranks of the entries of a block loaded so far
+struct ranker {
+  unsigned int rank;
+  unsigned int tied_rank;
+  unsigned int score;
+};
+
+/* Load the next entry of a block, unless it's empty or its player's scores are removed */
+static void load_entry(struct env* env, unsigned int b, struct ranker* r, unsigned int index, unsigned int replay_id, unsigned int score) {
+  /* Discard empty scores */
+  if (index == -1 && replay_id == -1 && score == -1) return;
+
+  /* Ignore hackers and cheaters if necessary */
+  struct player* player = index != -1 ? registry_get(env->players, index) : NULL;
+  int* flags = (int*) &env->config->flags;
+  if (player != NULL) {
+    if (player->hacker && gflag(flags, HackerFlags_RemoveScores) || player->cheater && gflag(flags, CheaterFlags_RemoveScores)) return;
+  }
+
+  /* Parse values */
+  r->rank++;
+  if (score != r->score) {
+    r->tied_rank++;
+    r->score = score;
+  }
+  leaderboard_put(env, b, player, score, replay_id, r->rank, r->tied_rank);
+  env->scount++;
+}
+
+/**
+ * Fill a block with its info and leaderboard. Each entry field pointer points
+ * to the field of the first entry, and consecutive entries are stride bytes
+ * apart, so this works both for v1 triples and v2 columns. The depth entries
+ * ranked past them are coded at deep, already validated, and their players
+ * are remapped if a remap is given.
+ */
+static void load_block(struct env* env, struct block* block, const uint32_t info[4], const unsigned char* players, const unsigned char* replays, const unsigned char* scores, size_t stride,
+                       const unsigned char* deep, const unsigned char* deep_end, unsigned int depth, const uint32_t* remap) {
+  /* Main block info */
+  struct store* store = &env->store;
+  unsigned int b      = block - env->blocks;
+  store->rank[b]      = info[0];
+  store->tied_rank[b] = info[1];
+  store->replay[b]    = info[2];
+  store->score[b]     = info[3];
+
+  /* Top leaderboard scores */
+  struct entries* e = &env->entries;
+  size_t first      = (size_t) b * BOARD_SIZE;
+  struct ranker r   = { (unsigned int) -1, (unsigned int) -1, (unsigned int) -1 };
+  env->lcount++;
+  env->revision++;
+  deep_clear(e, b, 1);
+  for (int k = 0; k < BOARD_SIZE; k++) {
+    load_entry(env, b, &r, rd32(players + k * stride), rd32(replays + k * stride), rd32(scores + k * stride));
+  }
+
+  /* Deep ones, which take the place of any removed above */
+  uint32_t score = 0;
+  for (unsigned int k = 0; k < depth; k++) {
+    uint32_t index, replay_id;
+    if (!deep_decode(&deep, deep_end, &index, &score, &replay_id)) break;
+    if (remap != NULL && index != (uint32_t) -1) index = remap[index];
+    load_entry(env, b, &r, index, replay_id, score);
+  }
+
+  /* Fill remaining empty spots (due to hackers and cheaters) with initialized scores */
+  unsigned int rank = r.rank;
+  if (++rank < BOARD_SIZE) {
+    size_t left = BOARD_SIZE - rank;
+    memset(e->score     + first + rank, 0xFF, left * sizeof(uint32_t));
+    memset(e->player    + first + rank, 0,    left * sizeof(struct player*));
+    memset(e->replay    + first + rank, 0xFF, left * sizeof(uint32_t));
+    memset(e->rank      + first + rank, 0xFF, left * sizeof(uint32_t));
+    memset(e->tied_rank + first + rank, 0xFF, left * sizeof(uint32_t));
+  }
+}
+
+static int parse_scores_v1(struct env* env, const unsigned char* f, int fsize) {
+  /* Parse header */
+  unsigned int psize = rd32(f +  8);            // Player count (4B)
+  unsigned int tsize = rd32(f + 12);            // Tab count (4B)
+  env->config->time  = *(time_t*)      (f + 16); // UNIX timestamp (8B)
+
+  /* Initialize variables */
+  unsigned int offset = 24;
+  fsize -= 24;
+  registry_clear(env->players);
+  env->scount = 0;
+  env->lcount = 0;
+
+  /* Parse players */
+  for (int i = 0; i < psize; i++) {
+    if (fsize < sizeof(int) + 1) { // Not enough bytes to contain another player (id + null char)
+      putlog("Scores file is corrupt");
+      return 1;
+    }
+    unsigned int id = rd32(f + offset);
+    const char* name = (const char*)(f + offset + sizeof(int));
+    size_t len = strnlen(name, fsize - sizeof(int));
+    if (len == fsize - sizeof(int)) { // Name isn't terminated
+      putlog("Scores file is corrupt");
+      return 1;
+    }
+    add_player(env->players, env->config, id, name);
+    offset += sizeof(int) + len + 1;
+    fsize  -= sizeof(int) + len + 1;
+  }
+
+  /* Parse scores */
+  for (int i = 0; i < tsize; i++) {
+    /* Tab header */
+    if (fsize < 8) { // Not enough bytes to contain tab header
+      putlog("Scores file is corrupt");
+      return 1;
+    }
+    char t_platform     = *(char*)(f + offset);
+    char t_mode         = *(char*)(f + offset + 1);
+    char t_type         = *(char*)(f + offset + 2);
+    char t_tab          = *(char*)(f + offset + 3);
+    unsigned int t_size = rd32(f + offset + 4);
+    int stride = t_size * (4 * sizeof(int) + BOARD_SIZE * 3 * sizeof(int)); // Theoretical size of tab info in scores file
+    offset += 8;
+    fsize  -= 8;
+    fsize  -= stride;
+    if (fsize < 0) { // Not enough bytes to contain tab scores
+      putlog("Scores file is corrupt");
+      return 1;
+    }
+
+    /* Find tab, skip it if it's not loaded */
+    struct tab* tab = match_tab(env, t_platform, t_mode, t_type, t_tab, t_size);
+    if (tab == NULL) {
+      offset += stride;
+      continue;
+    }
+
+    /* Tab scores */
+    for (int j = 0; j < tab->size; j++) {
+      uint32_t info[4] = { rd32(f + offset), rd32(f + offset + 4), rd32(f + offset + 8), rd32(f + offset + 12) };
+      offset += 4 * sizeof(int);
+      load_block(env, &tab->blocks[j], info, f + offset, f + offset + 4, f + offset + 8, 3 * sizeof(int), NULL, NULL, 0, NULL);
+      offset += BOARD_SIZE * 3 * sizeof(int);
+    }
+  }
+  return 0;
+}
+
+/* Check that a region of the file is in bounds and aligned */
+static bool in_file(size_t size, uint64_t offset, uint64_t len) {
+  return offset % SCORES_ALIGN == 0 && offset <= size && len <= size - offset;
+}
+
+/* Find the directory entry holding a global block index, if any */
+static const struct scores_tab* find_dir(const struct scores_tab* dir, unsigned int tcount, uint32_t block) {
+  for (int i = 0; i < tcount; i++) {
+    if (block >= dir[i].first && block - dir[i].first < dir[i].size) return &dir[i];
+  }
+  return NULL;
+}
+
+/* Check that the deep entries of a block are in the section and reference players of the file */
+static bool deep_valid(const unsigned char* deep, size_t size, uint32_t offset, uint32_t depth, uint32_t pcount) {
+  if (offset > size) return false;
+  const unsigned char* p = deep + offset;
+  uint32_t player, score = 0, replay;
+  for (uint32_t k = 0; k < depth; k++) {
+    if (!deep_decode(&p, deep + size, &player, &score, &replay)) return false;
+    if (player != (uint32_t) -1 && player >= pcount) return false;
+  }
+  return true;
+}
+
+/* Base snapshots are stored relative to the directory of the delta, unless absolute */
+static void base_path(char* out, size_t size, const char* filename, const char* base) {
+  const char* slash = strrchr(filename, '/');
+  int dir = base[0] != '/' && slash != NULL ? (int) (slash - filename + 1) : 0;
+  snprintf(out, size, "%.*s%s", dir, filename, base);
+}
+
+/* Timestamp of a scores file, from its header alone, false if it can't be read */
+static bool scores_time(const char* filename, uint64_t* time) {
+  struct mapping map;
+  int fsize = map_open(&map, filename);
+  const unsigned char* f = map.data;
+  size_t at = fsize >= 24 && f[5] < MAJOR_V2 ? 16 : offsetof(struct scores_header, time); // v1 has it right after the counts
+  bool ok = fsize >= 24 && memcmp(f, MAGIC, 4) == 0 && at + sizeof(*time) <= (size_t) fsize;
+  if (ok) memcpy(time, f + at, sizeof(*time));
+  map_close(&map);
+  return ok;
+}
+
+static int load_scores(struct env* env, const char* filename, int depth);
+
+/* Find a player of another snapshot among the loaded ones, like downloaded players */
+static uint32_t resolve_player(struct env* env, unsigned int id, const char* name) {
+  struct player* p = NULL;
+  if (id != -1) p = find_player_by_id(env->players, id);
+  if (!p && name != NULL) p = find_player_by_name(env->players, name);
+  if (!p) p = add_player(env->players, env->config, id, name);
+  return p->index;
+}
+
+/* Take a loaded block out of the totals before replacing it */
+static void unload_block(struct env* env, const struct block* block) {
+  const uint32_t* ranks = env->entries.rank + (size_t) (block - env->blocks) * BOARD_SIZE;
+  env->lcount--;
+  env->scount -= env->entries.depth[block - env->blocks];
+  for (int k = 0; k < BOARD_SIZE; k++) {
+    if (ranks[k] != (unsigned int) -1) env->scount--;
+  }
+}
+
+static int parse_scores_v2(struct env* env, const unsigned char* f, size_t fsize, const char* filename, int depth) {
+  /* Validate everything before touching the loaded scores, v2 headers end before the deep entries */
+  uint32_t version = fsize >= 12 ? rd32(f + 8) : 0;
+  size_t hsize = version >= VERSION_DEEP ? sizeof(struct scores_header) : offsetof(struct scores_header, depths);
+  if (fsize < hsize) {
+    putlog("Scores file is corrupt");
+    return 1;
+  }
+  struct scores_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(&header, f, hsize);
+  const struct scores_header* h = &header;
+  bool delta = h->filetype == FILETYPE_DELTA;
+  bool deep  = h->version >= VERSION_DEEP;
+  uint64_t entries = (uint64_t) h->bcount * BOARD_SIZE;
+  bool valid = h->version >= 2 && h->version <= SCORES_VERSION
+            && in_file(fsize, h->directory, (uint64_t) h->tcount * sizeof(struct scores_tab))
+            && in_file(fsize, h->players,   (uint64_t) h->pcount * sizeof(uint32_t))
+            && in_file(fsize, h->names,     (uint64_t) h->pcount * sizeof(uint32_t))
+            && in_file(fsize, h->strings,   h->strings_size)
+            && (h->strings_size == 0 || f[h->strings + h->strings_size - 1] == 0)
+            && (!delta || (in_file(fsize, h->blocks, h->bcount * sizeof(uint32_t)) && h->base < h->strings_size))
+            && (!deep || (in_file(fsize, h->depths,  h->bcount * sizeof(uint32_t))
+                       && in_file(fsize, h->offsets, h->bcount * sizeof(uint32_t))
+                       && in_file(fsize, h->deep,    h->deep_size)));
+  for (int c = 0; c < COL_COUNT && valid; c++) {
+    valid = in_file(fsize, h->columns[c], (c < COL_ENTRY_PLAYER ? h->bcount : entries) * sizeof(uint32_t));
+  }
+
+  /* Full snapshots store every block, deltas index blocks of the full layout */
+  const struct scores_tab* dir = (const struct scores_tab*) (f + h->directory);
+  uint64_t blocks = 0;
+  for (int i = 0; i < h->tcount && valid; i++) blocks += dir[i].size;
+  for (int i = 0; i < h->tcount && valid; i++) {
+    valid = (uint64_t) dir[i].first + dir[i].size <= (delta ? blocks : h->bcount);
+  }
+  const uint32_t* indices = delta ? (const uint32_t*) (f + h->blocks) : NULL;
+  for (int i = 0; delta && i < h->bcount && valid; i++) {
+    valid = find_dir(dir, h->tcount, indices[i]) != NULL;
+  }
+  const uint32_t* names = (const uint32_t*) (f + h->names);
+  for (int i = 0; i < h->pcount && valid; i++) {
+    valid = names[i] == (uint32_t) -1 || names[i] < h->strings_size;
+  }
+  const uint32_t* depths  = deep ? (const uint32_t*) (f + h->depths)  : NULL;
+  const uint32_t* offsets = deep ? (const uint32_t*) (f + h->offsets) : NULL;
+  for (int b = 0; deep && b < h->bcount && valid; b++) {
+    valid = deep_valid(f + h->deep, h->deep_size, offsets[b], depths[b], h->pcount);
+  }
+  if (!valid) {
+    putlog("Scores file is corrupt");
+    return 1;
+  }
+
+  /* A delta applies on top of its base, which is loaded first */
+  const uint32_t* ids = (const uint32_t*) (f + h->players);
+  const char* strings = (const char*) (f + h->strings);
+  uint32_t* remap = NULL;
+  if (delta) {
+    char path[PATH_MAX];
+    base_path(path, sizeof(path), filename, strings + h->base);
+    uint64_t base_time;
+    if (scores_time(path, &base_time) && base_time != h->base_time) { // Checked first, loading it would replace the scores
+      putlog("Base snapshot of delta doesn't match");
+      return 1;
+    }
+    if (load_scores(env, path, depth + 1) != 0) return 1;
+
+    /* Players are looked up among the loaded ones, and copied */
+    remap = (uint32_t*) calloc(h->pcount, sizeof(uint32_t));
+    for (int i = 0; i < h->pcount; i++) {
+      remap[i] = resolve_player(env, ids[i], names[i] != (uint32_t) -1 ? strings + names[i] : NULL);
+    }
+  } else {
+    registry_clear(env->players);
+    env->scount = 0;
+    env->lcount = 0;
+
+    /* Players, whose names are not copied but point into the mapping */
+    for (int i = 0; i < h->pcount; i++) {
+      struct player* p = registry_insert(env->players, ids[i], names[i] != (uint32_t) -1 ? strings + names[i] : NULL, false);
+      p->cheater = is_cheater(env->config, p);
+      p->hacker  = is_hacker(env->config, p);
+    }
+  }
+  env->config->time = h->time;
+
+  /* Blocks, whose tabs are found straight from the directory */
+  const uint32_t* col[COL_COUNT];
+  for (int c = 0; c < COL_COUNT; c++) col[c] = (const uint32_t*) (f + h->columns[c]);
+  for (size_t b = 0; b < h->bcount; b++) {
+    uint32_t g = delta ? indices[b] : b; // Blocks of full snapshots are in directory order
+    const struct scores_tab* d = find_dir(dir, h->tcount, g);
+    if (d == NULL) continue;
+    struct tab* tab = match_tab(env, d->platform, d->mode, d->type, d->tab, d->size);
+    if (tab == NULL) continue;
+    struct block* block = &tab->blocks[g - d->first];
+
+    /* Blocks of a delta replace the ones of its base */
+    uint32_t players[BOARD_SIZE];
+    const uint32_t* e = col[COL_ENTRY_PLAYER] + b * BOARD_SIZE;
+    if (delta) {
+      unload_block(env, block);
+      for (int k = 0; k < BOARD_SIZE; k++) players[k] = e[k] < h->pcount ? remap[e[k]] : (uint32_t) -1;
+      e = players;
+    }
+    uint32_t info[4] = { col[COL_RANK][b], col[COL_TIED_RANK][b], col[COL_REPLAY][b], col[COL_SCORE][b] };
+    load_block(env, block, info, (const unsigned char*) e,
+      (const unsigned char*) (col[COL_ENTRY_REPLAY] + b * BOARD_SIZE),
+      (const unsigned char*) (col[COL_ENTRY_SCORE]  + b * BOARD_SIZE), sizeof(uint32_t),
+      deep ? f + h->deep + offsets[b] : NULL, f + h->deep + h->deep_size, deep ? depths[b] : 0, remap);
+  }
+  free(remap);
+  return 0;
+}
+
+static int load_scores(struct env* env, const char* filename, int depth) {
+  if (depth > DELTA_DEPTH) {
+    putlog("Chain of delta snapshots is too long");
+    return 1;
+  }
+
+  /* Attempt to map the file */
+  struct mapping map;
+  int fsize = map_open(&map, filename);
+  if (fsize == 0) { // Generic error, e.g., file doesn't exist
+    putlog("Failed to load scores");
+    return 1;
+  }
+  map_advise(&map, 0, map.size, true);
+  const unsigned char* f = map.data;
+
+  /* Make rutinary checks */
+  int ret = 1;
+  if (fsize < 24) { // Not enough bytes to contain main header
+    putlog("Scores file is corrupt");
+  } else if (memcmp(f, MAGIC, 4) != 0) { // First 4 bytes are not magic number
+    putlog("Not an N++CC file");
+  } else if (f[4] != FILETYPE_SCORES && f[4] != FILETYPE_DELTA) { // File is not of the correct type
+    putlog("Not a scores file");
+  } else if (f[5] < MAJOR_V2 && f[4] == FILETYPE_DELTA) { // There are no v1 deltas
+    putlog("Scores file is corrupt");
+  } else if (f[5] < MAJOR_V2) { // Written by version 1 of the program
+    ret = parse_scores_v1(env, f, fsize);
+  } else {
+    ret = parse_scores_v2(env, f, fsize, filename, depth);
+  }
+  if (ret != 0 || f[4] == FILETYPE_DELTA) { // Names in deltas are copied, so the file isn't needed anymore
+    map_close(&map);
+    return ret;
+  }
+
+  /* Player names may point into this file now, so keep it until the next load */
+  map_close(&env->map);
+  env->map = map;
+  return 0;
+}
+
+// TODO: Change "putlog" by actual modal windows
+int parse_scores(struct env* env, const char* filename) {
+  if (load_scores(env, filename, 0) != 0) return 1;
+  putlog("Loaded scores file");
+  return 0;
+}
+
+static bool same_player(const struct player* a, const struct player* b) {
+  if (a == NULL || b == NULL) return a == b;
+  if (a->id != -1 || b->id != -1) return a->id == b->id;
+  return a->name != NULL && b->name != NULL && strcmp(a->name, b->name) == 0;
+}
+
+/* Whether a block's user rank or leaderboard differs between two snapshots with the same tabs */
+static bool block_changed(const struct env* a, const struct env* b, unsigned int i) {
+  const struct store* x = &a->store;
+  const struct store* y = &b->store;
+  if (x->rank[i] != y->rank[i] || x->tied_rank[i] != y->tied_rank[i] || x->replay[i] != y->replay[i] || x->score[i] != y->score[i]) return true;
+  if (!a->blocks[i].tab->online) return false;
+  for (size_t k = (size_t) i * BOARD_SIZE; k < (size_t) (i + 1) * BOARD_SIZE; k++) {
+    if (a->entries.score[k] != b->entries.score[k] || a->entries.replay[k] != b->entries.replay[k]) return true;
+    if (!same_player(a->entries.player[k], b->entries.player[k])) return true;
+  }
+
+  /* Deep entries, side by side */
+  if (a->entries.depth[i] != b->entries.depth[i]) return true;
+  struct deep_cursor c, d;
+  struct standing s, t;
+  deep_seek(&a->entries, i, 0, &c);
+  deep_seek(&b->entries, i, 0, &d);
+  while (deep_next(&a->entries, a->players, &c, &s) && deep_next(&b->entries, b->players, &d, &t)) {
+    if (s.score != t.score || s.replay != t.replay || !same_player(s.player, t.player)) return true;
+  }
+  return false;
+}
+
+/* Code the deep entries of a block for a scores file, numbering their players as they come */
+static void write_deep(const struct entries* entries, unsigned int g, uint32_t* fileidx, uint32_t* pcount, struct buffer* out) {
+  struct deep_cursor c;
+  struct standing s;
+  uint32_t prev = 0;
+  for (deep_seek(entries, g, 0, &c); deep_next(entries, NULL, &c, &s); prev = s.score) {
+    if (s.index != (uint32_t) -1 && fileidx[s.index] == (uint32_t) -1) fileidx[s.index] = (*pcount)++;
+    unsigned char p[DEEP_ENTRY];
+    unsigned char* end = deep_encode(p, s.index != (uint32_t) -1 ? fileidx[s.index] : (uint32_t) -1, prev, s.score, s.replay);
+    buffer_append(out, (const char*) p, end - p);
+  }
+}
+
+/**
+ * Write the loaded scores. If a mask of changed blocks is given, only those
+ * blocks and the players they reference are written, as a delta of the base.
+ */
+static int write_scores(struct env* env, const char* filename, const bool* changed, const char* base, uint64_t base_time) {
+  struct registry* players = env->players;
+
+  /* Number the players that will be written */
+  uint32_t* fileidx = (uint32_t*) malloc((players->count + 1) * sizeof(uint32_t));
+  uint32_t pcount = 0;
+  for (int i = 0; i < players->count; i++) fileidx[i] = changed != NULL ? (uint32_t) -1 : pcount++;
+  uint32_t bcount = 0;
+  uint32_t* offsets = (uint32_t*) malloc(env->bcount * sizeof(uint32_t));
+  struct buffer deep;
+  buffer_init(&deep);
+  for (int i = 0, g = 0; i < env->tcount; i++) {
+    for (int j = 0; j < env->tabs[i].size; j++, g++) {
+      if (changed != NULL && !changed[g]) continue;
+      struct player** entries = env->entries.player + (size_t) g * BOARD_SIZE;
+      for (int k = 0; env->tabs[i].online && k < BOARD_SIZE; k++) {
+        struct player* p = entries[k];
+        if (p != NULL && fileidx[p->index] == (uint32_t) -1) fileidx[p->index] = pcount++;
+      }
+      offsets[bcount++] = deep.len;
+      if (env->tabs[i].online) write_deep(&env->entries, g, fileidx, &pcount, &deep);
+    }
+  }
+
+  /* Compute layout */
+  struct scores_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MAGIC, 4);
+  h.filetype  = changed != NULL ? FILETYPE_DELTA : FILETYPE_SCORES;
+  h.major     = MAJOR;         // Version of the program
+  h.minor     = MINOR;
+  h.patch     = PATCH;
+  h.version   = SCORES_VERSION;
+  h.pcount    = pcount;
+  h.tcount    = env->tcount;
+  h.bcount    = bcount;
+  h.time      = (uint64_t) env->config->time;
+  h.base_time = base_time;
+  for (int i = 0; i < players->count; i++) {
+    const char* name = registry_get(players, i)->name;
+    if (name != NULL && fileidx[i] != (uint32_t) -1) h.strings_size += strlen(name) + 1;
+  }
+  if (base != NULL) h.strings_size += strlen(base) + 1;
+  size_t offset  = align(sizeof(h));
+  h.directory    = offset; offset = align(offset + h.tcount * sizeof(struct scores_tab));
+  h.players      = offset; offset = align(offset + h.pcount * sizeof(uint32_t));
+  h.names        = offset; offset = align(offset + h.pcount * sizeof(uint32_t));
+  h.strings      = offset; offset = align(offset + h.strings_size);
+  h.blocks       = offset; offset = align(offset + (changed != NULL ? h.bcount : 0) * sizeof(uint32_t));
+  for (int c = 0; c < COL_COUNT; c++) {
+    h.columns[c] = offset;
+    offset = align(offset + (c < COL_ENTRY_PLAYER ? 1 : BOARD_SIZE) * h.bcount * sizeof(uint32_t));
+  }
+  h.depths       = offset; offset = align(offset + h.bcount * sizeof(uint32_t));
+  h.offsets      = offset; offset = align(offset + h.bcount * sizeof(uint32_t));
+  h.deep         = offset; offset = align(offset + deep.len);
+  h.deep_size    = deep.len;
+  unsigned char* data = (unsigned char*) calloc(offset, sizeof(unsigned char));
+
+  /* Players and string table */
+  uint32_t* ids   = (uint32_t*) (data + h.players);
+  uint32_t* names = (uint32_t*) (data + h.names);
+  char* strings   = (char*) (data + h.strings);
+  uint32_t pos    = 0;
+  for (int i = 0; i < players->count; i++) {
+    struct player* p = registry_get(players, i);
+    uint32_t j = fileidx[i];
+    if (j == (uint32_t) -1) continue;
+    ids[j]   = p->id;
+    names[j] = p->name != NULL ? pos : (uint32_t) -1;
+    if (p->name == NULL) continue;
+    size_t len = strlen(p->name) + 1;
+    memcpy(strings + pos, p->name, len);
+    pos += len;
+  }
+  if (base != NULL) {
+    h.base = pos;
+    memcpy(strings + pos, base, strlen(base) + 1);
+  }
+  memcpy(data, &h, sizeof(h));
+
+  /* Tab directory and columns */
+  struct scores_tab* dir = (struct scores_tab*) (data + h.directory);
+  uint32_t* blocks = (uint32_t*) (data + h.blocks);
+  uint32_t* col[COL_COUNT];
+  for (int c = 0; c < COL_COUNT; c++) col[c] = (uint32_t*) (data + h.columns[c]);
+  uint32_t* depths = (uint32_t*) (data + h.depths);
+  memcpy(data + h.offsets, offsets, h.bcount * sizeof(uint32_t));
+  memcpy(data + h.deep, deep.data, deep.len);
+  const struct store* store     = &env->store;
+  const struct entries* entries = &env->entries;
+  uint32_t b = 0;
+  uint32_t g = 0;
+  for (int i = 0; i < env->tcount; i++) {
+    struct tab* tab = &env->tabs[i];
+    dir[i] = (struct scores_tab) { (uint8_t) tab->platform, (uint8_t) tab->mode, (uint8_t) tab->type, (uint8_t) tab->tab, tab->size, changed != NULL ? g : b, 0 };
+    for (int j = 0; j < tab->size; j++, g++) {
+      if (changed != NULL && !changed[g]) continue;
+      if (changed != NULL) blocks[b] = g;
+      col[COL_RANK][b]      = store->rank[g];
+      col[COL_TIED_RANK][b] = store->tied_rank[g];
+      col[COL_REPLAY][b]    = store->replay[g];
+      col[COL_SCORE][b]     = store->score[g];
+      for (int k = 0; k < BOARD_SIZE; k++) {
+        size_t e = (size_t) g * BOARD_SIZE + k;
+        struct player* player = tab->online ? entries->player[e] : NULL;
+        col[COL_ENTRY_PLAYER][b * BOARD_SIZE + k] = player != NULL ? fileidx[player->index] : -1;
+        col[COL_ENTRY_REPLAY][b * BOARD_SIZE + k] = tab->online ? entries->replay[e] : -1;
+        col[COL_ENTRY_SCORE][b * BOARD_SIZE + k]  = tab->online ? entries->score[e] : -1;
+      }
+      depths[b] = tab->online ? entries->depth[g] : 0;
+      b++;
+    }
+  }
+
+  /* Save scores file */
+  unsigned int result = save(data, offset, filename);
+  free(data);
+  free(fileidx);
+  free(offsets);
+  buffer_free(&deep);
+  return result == offset ? 0 : 1;
+}
+
+int save_scores(struct env* env, const char* filename) {
+  if (write_scores(env, filename, NULL, NULL, 0) != 0) {
+    putlog("Failed to save scores");
+    return 1;
+  }
+  putlog("Saved scores file");
+  return 0;
+}
+
+/**
+ * Save only the leaderboards that changed since the base snapshot, which may
+ * itself be a delta. The base is referenced by name, so keep deltas next to
+ * their base, or give it as an absolute path.
+ */
+int save_delta(struct env* env, const char* base, const char* filename) {
+  /* Load the base on the side, it sets the config timestamp so restore it */
+  struct env old;
+  env_init(&old, env->config);
+  time_t saved = env->config->time;
+  int ret = load_scores(&old, base, 0);
+  uint64_t base_time = env->config->time;
+  env->config->time = saved;
+  if (ret != 0) {
+    env_free(&old);
+    return 1;
+  }
+
+  /* Diff every block, both envs have the same tabs */
+  bool* changed = (bool*) calloc(env->bcount, sizeof(bool));
+  for (int i = 0, g = 0; i < env->tcount; i++) {
+    for (int j = 0; j < env->tabs[i].size; j++, g++) changed[g] = block_changed(env, &old, g);
+  }
+  env_free(&old);
+
+  /* Reference the base relative to the delta if they share a directory */
+  const char* slash = strrchr(filename, '/');
+  size_t dir = slash != NULL ? slash - filename + 1 : 0;
+  const char* name = base;
+  if (base[0] != '/' && strncmp(base, filename, dir) == 0 && strchr(base + dir, '/') == NULL) name = base + dir;
+  else if (base[0] != '/') putlog("Base of delta should be in its directory or absolute");
+
+  ret = write_scores(env, filename, changed, name, base_time);
+  free(changed);
+  putlog(ret == 0 ? "Saved delta scores file" : "Failed to save scores");
+  return ret;
+}
+
+/* Fold a chain of deltas into a full snapshot */
+int compact_scores(struct env* env, const char* filename, const char* output) {
+  if (load_scores(env, filename, 0) != 0) return 1;
+  int ret = write_scores(env, output, NULL, NULL, 0);
+  putlog(ret == 0 ? "Compacted scores file" : "Failed to save scores");
+  return ret;
+}
+
+/**
+ * Overlay the leaderboards of another snapshot on the loaded ones, e.g., to
+ * complete a partial download. Only blocks with some entry are taken, and
+ * the newest timestamp of both is kept.
+ */
+int merge_scores(struct env* env, const char* filename) {
+  struct env other;
+  env_init(&other, env->config);
+  time_t saved = env->config->time;
+  if (load_scores(&other, filename, 0) != 0) {
+    env->config->time = saved;
+    env_free(&other);
+    return 1;
+  }
+  if (saved > env->config->time) env->config->time = saved;
+
+  struct buffer deep; // Deep entries of a block, coded with the players found here
+  buffer_init(&deep);
+  for (int i = 0; i < env->tcount; i++) {
+    if (!env->tabs[i].online) continue;
+    for (int j = 0; j < env->tabs[i].size; j++) {
+      struct block* block = &env->tabs[i].blocks[j];
+      unsigned int g = block - env->blocks; // Same index in both envs
+      size_t first   = (size_t) g * BOARD_SIZE;
+      const struct entries* src = &other.entries;
+      if (src->rank[first] == (unsigned int) -1) continue; // Not downloaded in that snapshot
+
+      uint32_t info[4] = { other.store.rank[g], other.store.tied_rank[g], other.store.replay[g], other.store.score[g] };
+      uint32_t players[BOARD_SIZE];
+      uint32_t replays[BOARD_SIZE];
+      uint32_t scores[BOARD_SIZE];
+      for (int k = 0; k < BOARD_SIZE; k++) {
+        const struct player* p = src->player[first + k];
+        bool empty = src->rank[first + k] == (unsigned int) -1;
+        players[k] = !empty && p != NULL ? resolve_player(env, p->id, p->name) : (uint32_t) -1;
+        replays[k] = !empty ? src->replay[first + k] : (uint32_t) -1;
+        scores[k]  = !empty ? src->score[first + k] : (uint32_t) -1;
+      }
+      buffer_clear(&deep);
+      struct deep_cursor c;
+      struct standing s;
+      uint32_t prev = 0;
+      for (deep_seek(src, g, 0, &c); deep_next(src, other.players, &c, &s); prev = s.score) {
+        unsigned char p[DEEP_ENTRY];
+        uint32_t player = s.player != NULL ? resolve_player(env, s.player->id, s.player->name) : (uint32_t) -1;
+        buffer_append(&deep, (const char*) p, deep_encode(p, player, prev, s.score, s.replay) - p);
+      }
+      unload_block(env, block);
+      load_block(env, block, info, (const unsigned char*) players, (const unsigned char*) replays, (const unsigned char*) scores, sizeof(uint32_t),
+        (const unsigned char*) deep.data, (const unsigned char*) deep.data + deep.len, src->depth[g], NULL);
+    }
+  }
+  buffer_free(&deep);
+  env_free(&other);
+  putlog("Merged scores file");
+  return 0;
+}
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "nprofilerlib.h"
+
+/**
+ * Publishing downloads.
+ *
+ * The download thread never touches the loaded scores. It decodes every
+ * leaderboard into a board of its own and, now and then, publishes the boards
+ * it has so far as an immutable snapshot by swapping feed->current. Readers
+ * (the UI) pick up the latest snapshot at their own pace and apply whatever
+ * boards are new to their blocks, so they always see a consistent, if partial,
+ * download, and no thread ever waits for another.
+ *
+ * Snapshots are reclaimed with epochs: a reader announces the epoch it saw
+ * before loading feed->current, and a snapshot retired at epoch r is only
+ * freed once no reader announced an epoch older than r. Boards are shared by
+ * every snapshot of a download, so they're freed along with its last one.
+ */
+
+static struct pool* pool_new() {
+  return (struct pool*) calloc(1, sizeof(struct pool));
+}
+
+static void pool_free(struct pool* pool) {
+  if (pool == NULL) return;
+  for (unsigned int i = 0; i < pool->chunk_count; i++) free(pool->chunks[i]);
+  free(pool->chunks);
+  free(pool);
+}
+
+static void snapshot_free(struct snapshot* s) {
+  pool_free(s->pool);
+  free(s->boards);
+  free(s);
+}
+
+/* Free the retired snapshots no reader can be using anymore */
+static void reclaim(struct feed* feed) {
+  uint64_t oldest = UINT64_MAX;
+  for (int i = 0; i < FEED_READERS; i++) {
+    uint64_t e = __atomic_load_n(&feed->readers[i], __ATOMIC_SEQ_CST);
+    if (e != 0 && e < oldest) oldest = e;
+  }
+  struct snapshot** s = &feed->retired;
+  while (*s != NULL) {
+    if ((*s)->retired <= oldest) {
+      struct snapshot* next = (*s)->next;
+      snapshot_free(*s);
+      *s = next;
+    } else {
+      s = &(*s)->next;
+    }
+  }
+}
+
+void feed_init(struct feed* feed, unsigned int bcount) {
+  memset(feed, 0, sizeof(struct feed));
+  feed->epoch  = 1;
+  feed->bcount = bcount;
+  feed->boards = (const struct board**) calloc(bcount, sizeof(struct board*));
+  feed->pool   = pool_new();
+}
+
+/* Only once the writer is done and nobody is reading */
+void feed_free(struct feed* feed) {
+  if (feed->current != NULL) snapshot_free(feed->current);
+  while (feed->retired != NULL) {
+    struct snapshot* next = feed->retired->next;
+    snapshot_free(feed->retired);
+    feed->retired = next;
+  }
+  pool_free(feed->pool);
+  pool_free(feed->done);
+  free(feed->boards);
+  feed->current = NULL;
+  feed->pool    = NULL;
+  feed->done    = NULL;
+  feed->boards  = NULL;
+}
+
+/* Writer: start a new download, which readers see as every board being cleared */
+void feed_reset(struct feed* feed) {
+  feed->done  = feed->pool; // Handed to the last snapshot of the download when publishing
+  feed->pool  = pool_new();
+  feed->count = 0;
+  feed->generation++;
+  memset(feed->boards, 0, feed->bcount * sizeof(struct board*));
+  feed_publish(feed, false);
+}
+
+/* Writer: room for the next board, which is kept by feed_put() */
+struct board* feed_board(struct feed* feed) {
+  struct pool* pool = feed->pool;
+  if (pool->count / FEED_CHUNK >= pool->chunk_count) {
+    pool->chunks = (struct board**) realloc(pool->chunks, (pool->chunk_count + 1) * sizeof(struct board*));
+    pool->chunks[pool->chunk_count++] = (struct board*) malloc(FEED_CHUNK * sizeof(struct board));
+  }
+  return &pool->chunks[pool->count / FEED_CHUNK][pool->count % FEED_CHUNK];
+}
+
+/* Writer: keep the last board from feed_board() as the one of block index */
+void feed_put(struct feed* feed, unsigned int index) {
+  struct pool* pool = feed->pool;
+  if (feed->boards[index] == NULL) feed->count++;
+  feed->boards[index] = &pool->chunks[pool->count / FEED_CHUNK][pool->count % FEED_CHUNK];
+  pool->count++;
+}
+
+/* Writer: make the working set visible to the readers */
+void feed_publish(struct feed* feed, bool complete) {
+  struct snapshot* s = (struct snapshot*) calloc(1, sizeof(struct snapshot));
+  s->version    = ++feed->version;
+  s->generation = feed->generation;
+  s->count      = feed->count;
+  s->complete   = complete;
+  s->time       = time(NULL);
+  s->boards     = (const struct board**) malloc(feed->bcount * sizeof(struct board*));
+  memcpy(s->boards, feed->boards, feed->bcount * sizeof(struct board*));
+
+  struct snapshot* old = __atomic_exchange_n(&feed->current, s, __ATOMIC_SEQ_CST);
+  uint64_t epoch = __atomic_add_fetch(&feed->epoch, 1, __ATOMIC_SEQ_CST);
+  if (old != NULL) {
+    if (old->generation != s->generation) { // Last snapshot of the previous download
+      old->pool  = feed->done;
+      feed->done = NULL;
+    }
+    old->retired  = epoch;
+    old->next     = feed->retired;
+    feed->retired = old;
+  } else {
+    pool_free(feed->done);
+    feed->done = NULL;
+  }
+  reclaim(feed);
+}
+
+/* Reader: the latest snapshot, valid until feed_leave() */
+const struct snapshot* feed_enter(struct feed* feed, unsigned int slot) {
+  __atomic_store_n(&feed->readers[slot], __atomic_load_n(&feed->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&feed->current, __ATOMIC_SEQ_CST);
+}
+
+void feed_leave(struct feed* feed, unsigned int slot) {
+  __atomic_store_n(&feed->readers[slot], 0, __ATOMIC_SEQ_CST);
+}
+
+void reader_init(struct reader* reader, unsigned int slot, unsigned int bcount) {
+  memset(reader, 0, sizeof(struct reader));
+  reader->slot    = slot;
+  reader->applied = (const struct board**) calloc(bcount, sizeof(struct board*));
+}
+
+void reader_free(struct reader* reader) {
+  free(reader->applied);
+  reader->applied = NULL;
+}
+
+/* Empty every leaderboard, when a new download starts */
+static void clear_scores(struct env* env) {
+  store_clear(&env->store, 0, env->bcount);
+  entries_clear(&env->entries, 0, env->bcount);
+  env->lcount = 0;
+  env->scount = 0;
+}
+
+/* Reader: apply the boards that are new since last time, returns whether there were any */
+bool feed_sync(struct feed* feed, struct reader* reader, struct env* env) {
+  const struct snapshot* s = feed_enter(feed, reader->slot);
+  if (s == NULL || s->version == reader->version) {
+    feed_leave(feed, reader->slot);
+    return false;
+  }
+  if (s->generation != reader->generation) {
+    clear_scores(env);
+    memset(reader->applied, 0, env->bcount * sizeof(struct board*));
+    reader->generation = s->generation;
+  }
+  for (int i = 0; i < env->bcount; i++) {
+    const struct board* board = s->boards[i];
+    if (board == NULL || board == reader->applied[i]) continue;
+    if (reader->applied[i] == NULL) env->lcount++;
+    apply_board(env, &env->blocks[i], board);
+    reader->applied[i] = board;
+  }
+  reader->version   = s->version;
+  reader->complete  = s->complete;
+  env->config->time = s->time; // Timestamp of the scores, which is saved with them
+  env->revision++;
+  feed_leave(feed, reader->slot);
+  return true;
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "nprofilerlib.h"
+
+/**
+ * Block sorting.
+ *
+ * Instead of moving blocks around, every sort column of the store is read
+ * once into a compact key table, followed by the replay ID as tie-breaker,
+ * and a permutation of block indices is radix sorted over it: one stable
+ * counting pass per key byte, from the last column to the first, skipping
+ * the bytes every block shares. Ties on every key keep their block order.
+ * The store is only read while extracting the keys, so sorting while scores
+ * are downloaded is safe: at worst a row uses a value from just before an
+ * update.
+ */
+
+/* Column of a key, as signed values as the benchmark's qsort baseline compares them */
+static void key_column(const struct store* store, unsigned int count, enum orders order, bool reverse, uint32_t* row, unsigned int width) {
+  const uint32_t* col;
+  switch (order) {
+    case ATTEMPTS: col = store->attempts; break;
+    case GOLD:     col = store->gold; break;
+    case SCORE:    col = store->score; break;
+    case RANK:     col = store->rank; break;
+    case VICTORIES:
+      for (unsigned int i = 0; i < count; i++, row += width) {
+        uint32_t v = (uint32_t) ((int) store->victories[i] + (int) store->victories_ep[i]) ^ 0x80000000u;
+        *row = reverse ? ~v : v;
+      }
+      return;
+    case ID:
+    default:       col = store->id;
+  }
+  uint32_t flip = reverse ? 0x7FFFFFFFu : 0x80000000u; // Signed to unsigned order, then reversed if needed
+  for (unsigned int i = 0; i < count; i++, row += width) *row = col[i] ^ flip;
+}
+
+/* Fill perm with the indices of the blocks in sorted order, by each key in turn */
+void sort_blocks(const struct store* store, unsigned int count, const struct sort_key* keys, unsigned int kcount, unsigned int* perm) {
+  /* Extract the keys, one column at a time, descending ones flipped */
+  unsigned int width = kcount + 1;
+  uint32_t* table = (uint32_t*) malloc((size_t) count * width * sizeof(uint32_t));
+  for (unsigned int k = 0; k < kcount; k++) key_column(store, count, keys[k].order, keys[k].reverse, table + k, width);
+  for (unsigned int i = 0; i < count; i++) {
+    table[(size_t) i * width + kcount] = store->replay[i] ^ 0x80000000u;
+    perm[i] = i;
+  }
+
+  /* Least significant byte of the least significant column first */
+  unsigned int* src = perm;
+  unsigned int* dst = (unsigned int*) malloc(count * sizeof(unsigned int));
+  unsigned int* tmp = dst;
+  unsigned int hist[256];
+  for (int k = kcount; k >= 0; k--) {
+    for (int shift = 0; shift < 32; shift += 8) {
+      memset(hist, 0, sizeof(hist));
+      for (unsigned int i = 0; i < count; i++) hist[(table[(size_t) i * width + k] >> shift) & 0xFF]++;
+      if (count == 0 || hist[(table[k] >> shift) & 0xFF] == count) continue;
+      for (unsigned int d = 0, sum = 0; d < 256; d++) {
+        unsigned int c = hist[d];
+        hist[d] = sum;
+        sum += c;
+      }
+      for (unsigned int i = 0; i < count; i++) {
+        unsigned int b = src[i];
+        dst[hist[(table[(size_t) b * width + k] >> shift) & 0xFF]++] = b;
+      }
+      unsigned int* swap = src;
+      src = dst;
+      dst = swap;
+    }
+  }
+  if (src != perm) memcpy(perm, src, count * sizeof(unsigned int));
+  free(tmp);
+  free(table);
+}
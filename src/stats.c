@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "nprofilerlib.h"
+
+/**
+ * Highscoring stats.
+ *
+ * stats_update() walks every leaderboard once and fills a dense matrix with
+ * how many scores each player has in each tab at each rank, plus the sum of
+ * those scores. Rankings are then reductions over a player's row of the
+ * matrix, which is tcount * BOARD_SIZE counters, instead of rescans of the
+ * leaderboards. Tabs are selected with a mask, bit i being env->tabs[i].
+ */
+
+/* Mask of the loaded tabs matching the type and tab checkboxes */
+unsigned int stats_mask(struct env* env, const bool types[3], const bool tabs[6]) {
+  unsigned int mask = 0;
+  for (int i = 0; i < env->tcount; i++) {
+    if (types[env->tabs[i].type] && tabs[env->tabs[i].tab]) mask |= 1u << i;
+  }
+  return mask;
+}
+
+/* Rebuild the matrix if the scores changed since last time, returns whether it did */
+bool stats_update(struct stats* stats, struct env* env) {
+  if (stats->counts != NULL && stats->revision == env->revision) return false;
+
+  /* Make room for every player */
+  unsigned int pcount = env->players->count;
+  unsigned int tcount = env->tcount;
+  if (stats->counts == NULL || pcount > stats->capacity || tcount != stats->tcount) {
+    stats_free(stats);
+    stats->capacity = pcount > PLAYER_MAX ? pcount : PLAYER_MAX;
+    stats->counts   = (uint16_t*) malloc(stats->capacity * tcount * BOARD_SIZE * sizeof(uint16_t));
+    stats->tied     = (uint16_t*) malloc(stats->capacity * tcount * BOARD_SIZE * sizeof(uint16_t));
+    stats->totals   = (uint64_t*) malloc(stats->capacity * tcount * sizeof(uint64_t));
+  }
+  stats->pcount   = pcount;
+  stats->tcount   = tcount;
+  stats->revision = env->revision;
+  memset(stats->counts, 0, pcount * tcount * BOARD_SIZE * sizeof(uint16_t));
+  memset(stats->tied,   0, pcount * tcount * BOARD_SIZE * sizeof(uint16_t));
+  memset(stats->totals, 0, pcount * tcount * sizeof(uint64_t));
+
+  /* Single pass over the entries of every tab, which are contiguous */
+  const struct entries* e = &env->entries;
+  for (int t = 0; t < tcount; t++) {
+    struct tab* tab = &env->tabs[t];
+    if (!tab->online) continue;
+    size_t first = (size_t) (tab->blocks - env->blocks) * BOARD_SIZE;
+    size_t last  = first + (size_t) tab->size * BOARD_SIZE;
+    for (size_t k = first; k < last; k++) {
+      const struct player* p = e->player[k];
+      if (p == NULL || e->rank[k] >= BOARD_SIZE || e->tied_rank[k] >= BOARD_SIZE) continue;
+      size_t cell = (size_t) p->index * tcount + t;
+      stats->counts[cell * BOARD_SIZE + e->rank[k]]++;
+      stats->tied[cell * BOARD_SIZE + e->tied_rank[k]]++;
+      stats->totals[cell] += e->score[k];
+    }
+  }
+  return true;
+}
+
+void stats_free(struct stats* stats) {
+  free(stats->counts);
+  free(stats->tied);
+  free(stats->totals);
+  stats->counts   = NULL;
+  stats->tied     = NULL;
+  stats->totals   = NULL;
+  stats->pcount   = 0;
+  stats->capacity = 0;
+}
+
+/* Scores of a player ranked under cutoff, e.g., 1 for 0ths and 20 for Top20s */
+unsigned int stats_count(struct stats* stats, unsigned int player, unsigned int mask, unsigned int cutoff, bool ties) {
+  const uint16_t* row = (ties ? stats->tied : stats->counts) + (size_t) player * stats->tcount * BOARD_SIZE;
+  unsigned int count = 0;
+  if (cutoff > BOARD_SIZE) cutoff = BOARD_SIZE;
+  for (int t = 0; t < stats->tcount; t++, row += BOARD_SIZE) {
+    if (!(mask & (1u << t))) continue;
+    for (int r = 0; r < cutoff; r++) count += row[r];
+  }
+  return count;
+}
+
+/* 20 points for a 0th, 19 for a 1st... down to 1 for a 19th */
+unsigned int stats_points(struct stats* stats, unsigned int player, unsigned int mask, bool ties) {
+  const uint16_t* row = (ties ? stats->tied : stats->counts) + (size_t) player * stats->tcount * BOARD_SIZE;
+  unsigned int points = 0;
+  for (int t = 0; t < stats->tcount; t++, row += BOARD_SIZE) {
+    if (!(mask & (1u << t))) continue;
+    for (int r = 0; r < BOARD_SIZE; r++) points += (BOARD_SIZE - r) * row[r];
+  }
+  return points;
+}
+
+uint64_t stats_score(struct stats* stats, unsigned int player, unsigned int mask) {
+  const uint64_t* row = stats->totals + (size_t) player * stats->tcount;
+  uint64_t score = 0;
+  for (int t = 0; t < stats->tcount; t++) {
+    if (mask & (1u << t)) score += row[t];
+  }
+  return score;
+}
+
+/* Highest value first, then by player or block order so results are stable */
+static int rowcmp(const void* a, const void* b) {
+  const struct row* r = (const struct row*) a;
+  const struct row* s = (const struct row*) b;
+  if (r->value != s->value) return r->value < s->value ? 1 : -1;
+  if (r->block != s->block) return (r->block > s->block) - (r->block < s->block);
+  return (r->player->index > s->player->index) - (r->player->index < s->player->index);
+}
+
+static bool ignored(struct env* env, const struct player* p, int hacker_flag, int cheater_flag) {
+  int* flags = (int*) &env->config->flags;
+  return p->hacker && gflag(flags, hacker_flag) || p->cheater && gflag(flags, cheater_flag);
+}
+
+/**
+ * Fill rows (room for stats->pcount) with every player that has something in
+ * the ranking, sorted, and return how many there are. Cutoff is only used to
+ * count tops.
+ */
+unsigned int stats_ranking(struct stats* stats, struct env* env, enum rankings type, unsigned int mask, unsigned int cutoff, bool ties, struct row* rows) {
+  unsigned int count = 0;
+  for (unsigned int i = 0; i < stats->pcount; i++) {
+    struct player* p = registry_get(env->players, i);
+    if (p == NULL || ignored(env, p, HackerFlags_IgnoreRankings, CheaterFlags_IgnoreRankings)) continue;
+    double value = 0;
+    switch (type) {
+      case TOPS:
+        value = stats_count(stats, i, mask, cutoff, ties);
+        break;
+      case TOTAL_SCORE:
+        value = (double) stats_score(stats, i, mask) / 1000;
+        break;
+      case POINTS:
+        value = stats_points(stats, i, mask, ties);
+        break;
+      case AVG_POINTS: {
+        unsigned int tops = stats_count(stats, i, mask, BOARD_SIZE, ties);
+        value = tops > 0 ? (double) stats_points(stats, i, mask, ties) / tops : 0;
+        break;
+      }
+    }
+    if (value > 0) rows[count++] = (struct row) { p, NULL, value };
+  }
+  qsort(rows, count, sizeof(struct row), rowcmp);
+  return count;
+}
+
+/**
+ * Fill rows (room for env->bcount) with the leaderboards of the tabs in the
+ * mask, by the gap between the scores ranked inf and sup, biggest first
+ * unless told otherwise.
+ */
+unsigned int stats_spreads(struct env* env, unsigned int mask, unsigned int inf, unsigned int sup, bool smallest, struct row* rows) {
+  const struct entries* e = &env->entries;
+  unsigned int count = 0;
+  if (inf >= BOARD_SIZE || sup >= BOARD_SIZE) return 0;
+  for (int t = 0; t < env->tcount; t++) {
+    if (!(mask & (1u << t)) || !env->tabs[t].online) continue;
+    for (int j = 0; j < env->tabs[t].size; j++) {
+      struct block* block = &env->tabs[t].blocks[j];
+      size_t a = (size_t) (block - env->blocks) * BOARD_SIZE + inf;
+      size_t b = (size_t) (block - env->blocks) * BOARD_SIZE + sup;
+      if (e->rank[a] == (unsigned int) -1 || e->rank[b] == (unsigned int) -1) continue;
+      double spread = ((double) e->score[a] - (double) e->score[b]) / 1000;
+      rows[count++] = (struct row) { e->player[a], block, smallest ? -spread : spread };
+    }
+  }
+  qsort(rows, count, sizeof(struct row), rowcmp);
+  for (int i = 0; smallest && i < count; i++) rows[i].value = -rows[i].value;
+  return count;
+}
+
+/**
+ * Fill rows (room for env->bcount) with the leaderboards of the tabs in the
+ * mask where the user is ranked between inf and sup, or isn't if missing,
+ * valued by the user's score, in tab order.
+ */
+unsigned int stats_lists(struct env* env, unsigned int mask, unsigned int inf, unsigned int sup, bool missing, bool ties, struct row* rows) {
+  const struct store* st = &env->store;
+  unsigned int count = 0;
+  for (int t = 0; t < env->tcount; t++) {
+    if (!(mask & (1u << t)) || !env->tabs[t].online) continue;
+    unsigned int first = env->tabs[t].blocks - env->blocks;
+    for (unsigned int b = first; b < first + env->tabs[t].size; b++) {
+      unsigned int rank = ties ? st->tied_rank[b] : st->rank[b];
+      bool in = rank != (unsigned int) -1 && rank >= inf && rank <= sup;
+      if (in == missing) continue;
+      double score = st->score[b] != (unsigned int) -1 ? (double) st->score[b] / 1000 : 0;
+      rows[count++] = (struct row) { NULL, &env->blocks[b], score };
+    }
+  }
+  return count;
+}
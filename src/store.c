@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "nprofilerlib.h"
+
+/**
+ * Block store.
+ *
+ * Blocks only keep what describes them (name and tab) and the download
+ * bookkeeping. Their numbers live in the store, one array per field, and
+ * their leaderboards in the entries, one array per entry field, all indexed
+ * by the position of the block in env->blocks. Filters, footers, sorts and
+ * stats each walk the few columns they need instead of whole blocks, and
+ * other orders of the blocks are permutations of indices, never copies.
+ */
+
+void store_init(struct store* store, unsigned int bcount) {
+  store->type            = (uint8_t*)  calloc(bcount, sizeof(uint8_t));
+  store->mode            = (uint8_t*)  calloc(bcount, sizeof(uint8_t));
+  store->tab             = (uint8_t*)  calloc(bcount, sizeof(uint8_t));
+  store->id              = (uint32_t*) calloc(bcount, sizeof(uint32_t));
+  store->attempts        = (uint32_t*) calloc(bcount, sizeof(uint32_t));
+  store->deaths          = (uint32_t*) calloc(bcount, sizeof(uint32_t));
+  store->victories       = (uint32_t*) calloc(bcount, sizeof(uint32_t));
+  store->victories_ep    = (uint32_t*) calloc(bcount, sizeof(uint32_t));
+  store->state           = (uint8_t*)  calloc(bcount, sizeof(uint8_t));
+  store->gold            = (uint32_t*) calloc(bcount, sizeof(uint32_t));
+  store->score_deathless = (uint32_t*) calloc(bcount, sizeof(uint32_t));
+  store->score           = (uint32_t*) malloc(bcount * sizeof(uint32_t));
+  store->rank            = (uint32_t*) malloc(bcount * sizeof(uint32_t));
+  store->tied_rank       = (uint32_t*) malloc(bcount * sizeof(uint32_t));
+  store->replay          = (uint32_t*) malloc(bcount * sizeof(uint32_t));
+  store_clear(store, 0, bcount);
+}
+
+void store_free(struct store* store) {
+  free(store->type);
+  free(store->mode);
+  free(store->tab);
+  free(store->id);
+  free(store->attempts);
+  free(store->deaths);
+  free(store->victories);
+  free(store->victories_ep);
+  free(store->state);
+  free(store->gold);
+  free(store->score_deathless);
+  free(store->score);
+  free(store->rank);
+  free(store->tied_rank);
+  free(store->replay);
+  memset(store, 0, sizeof(struct store));
+}
+
+void entries_init(struct entries* entries, unsigned int bcount) {
+  size_t count = (size_t) bcount * BOARD_SIZE;
+  entries->score     = (uint32_t*) malloc(count * sizeof(uint32_t));
+  entries->replay    = (uint32_t*) malloc(count * sizeof(uint32_t));
+  entries->rank      = (uint32_t*) malloc(count * sizeof(uint32_t));
+  entries->tied_rank = (uint32_t*) malloc(count * sizeof(uint32_t));
+  entries->player    = (struct player**) malloc(count * sizeof(struct player*));
+  deep_init(entries, bcount);
+  entries_clear(entries, 0, bcount);
+}
+
+void entries_free(struct entries* entries) {
+  free(entries->score);
+  free(entries->replay);
+  free(entries->rank);
+  free(entries->tied_rank);
+  free(entries->player);
+  deep_free(entries);
+  memset(entries, 0, sizeof(struct entries));
+}
+
+/* Empty the leaderboards of count blocks from the one at index first, deep entries included */
+void entries_clear(struct entries* entries, unsigned int first, unsigned int count) {
+  size_t start = (size_t) first * BOARD_SIZE;
+  size_t size  = (size_t) count * BOARD_SIZE;
+  memset(entries->score     + start, 0xFF, size * sizeof(uint32_t));
+  memset(entries->replay    + start, 0xFF, size * sizeof(uint32_t));
+  memset(entries->rank      + start, 0xFF, size * sizeof(uint32_t));
+  memset(entries->tied_rank + start, 0xFF, size * sizeof(uint32_t));
+  memset(entries->player    + start, 0,    size * sizeof(struct player*));
+  deep_clear(entries, first, count);
+}
+
+/* Empty the user's entry of count blocks from the one at index first */
+void store_clear(struct store* store, unsigned int first, unsigned int count) {
+  memset(store->score     + first, 0xFF, count * sizeof(uint32_t));
+  memset(store->rank      + first, 0xFF, count * sizeof(uint32_t));
+  memset(store->tied_rank + first, 0xFF, count * sizeof(uint32_t));
+  memset(store->replay    + first, 0xFF, count * sizeof(uint32_t));
+}
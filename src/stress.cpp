@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <thread>
+#include <algorithm>
+
+#include "nprofilerlib.h"
+
+/**
+ * Stress test of publishing downloads, meant to be built with ThreadSanitizer
+ * (make stress), which reports any race between the threads below.
+ *
+ * A writer downloads every leaderboard several times over, publishing
+ * snapshots as it goes like the download thread does. The main thread plays
+ * the UI: it applies the snapshots to its scores with feed_sync(), rebuilds
+ * the stats, sorts the main table on several columns and refilters its view,
+ * over and over. A second reader walks
+ * the latest snapshot at its own pace, checking every board it finds, so a
+ * snapshot or board reclaimed while still in use reads as garbage (or, under
+ * TSan or ASan, as a report).
+ *
+ * The writer makes up its boards by default. Given a host, it downloads them
+ * with update_scores() instead, retries and all, e.g. from a stub server.
+ */
+
+#define DOWNLOADS 5     // Downloads in a row
+#define BATCH     32    // Boards published at once by the made up downloads
+#define PLAYERS   2000  // Players the made up boards draw from
+
+static struct feed feed;
+static struct env env;
+static struct config config;
+static bool writing = true;
+static unsigned int failures = 0;
+static uint32_t seed = 1;
+
+/* xorshift32, only the writer uses it */
+static uint32_t rnd() {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static void fail(const char* what, unsigned int n) {
+  if (__atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED) < 10) fprintf(stderr, "FAIL: %s (%u)\n", what, n);
+}
+
+static void usage() {
+  printf("Usage: nprofiler-stress [-d downloads] [-h host -n nprofile] [-w window]\n");
+  printf("  Publish downloads while the UI side syncs, sorts and rebuilds stats\n");
+  printf("  and another reader walks the snapshots, failing on anything torn\n");
+}
+
+/* Leaderboard with decreasing scores, which the checking reader relies on */
+static void make_board(struct board* board) {
+  memset(board, 0, sizeof(struct board));
+  board->count = BOARD_SIZE;
+  unsigned int score = 100000 + rnd() % 900000;
+  for (unsigned int k = 0; k < BOARD_SIZE; k++) {
+    struct entry* e = &board->entries[k];
+    unsigned int p = rnd() % PLAYERS;
+    if (rnd() % 4 != 0) score -= rnd() % 500;
+    e->id       = 100000 + p;
+    e->score    = score;
+    e->replay   = rnd();
+    e->has_name = true;
+    snprintf(e->name, sizeof(e->name), "Player%u", p);
+  }
+}
+
+/* Every online leaderboard in a random order, a batch per snapshot */
+static void made_up_downloads(unsigned int downloads) {
+  unsigned int* order = (unsigned int*) malloc(env.bcount * sizeof(unsigned int));
+  unsigned int count = 0;
+  for (int t = 0; t < env.tcount; t++) {
+    if (!env.tabs[t].online) continue;
+    for (int i = 0; i < env.tabs[t].size; i++) order[count++] = &env.tabs[t].blocks[i] - env.blocks;
+  }
+  for (unsigned int d = 0; d < downloads; d++) {
+    feed_reset(&feed);
+    for (unsigned int i = count - 1; i > 0; i--) std::swap(order[i], order[rnd() % (i + 1)]);
+    for (unsigned int i = 0; i < count; i++) {
+      make_board(feed_board(&feed));
+      feed_put(&feed, order[i]);
+      if (i % BATCH == BATCH - 1) feed_publish(&feed, false);
+    }
+    feed_publish(&feed, true);
+  }
+  free(order);
+}
+
+/* The same downloads the UI makes, from a server */
+static void real_downloads(unsigned int downloads, const char* host, unsigned int window) {
+  struct curl curl;
+  memset(&curl, 0, sizeof(curl));
+  if (curlinit(&curl, window) != 0) {
+    fail("cURL could not be initialized", 0);
+    curldestroy(&curl);
+    return;
+  }
+  curl.host = host;
+  env.curl  = &curl;
+  env.feed  = &feed;
+  int* flags = (int*) &env.flags;
+  for (unsigned int d = 0; d < downloads; d++) {
+    for (int t = 0; t < env.tcount; t++) {
+      for (int i = 0; i < env.tabs[t].size; i++) {
+        env.tabs[t].blocks[i].updated = false;
+        env.tabs[t].blocks[i].retries = 0;
+      }
+    }
+    retry_reset(&curl);
+    feed_reset(&feed);
+    sflag(flags, DownloadFlags_Download);
+    for (int round = 0; round < 3 && update_scores(&env) != 0; round++) retry_failed(&curl);
+    cflag(flags, DownloadFlags_Download);
+    feed_publish(&feed, true);
+  }
+  env.curl = NULL;
+  curldestroy(&curl);
+}
+
+/* Second reader: every board of the latest snapshot has to be whole */
+static void check_snapshots(unsigned long* walked) {
+  while (__atomic_load_n(&writing, __ATOMIC_ACQUIRE)) {
+    const struct snapshot* s = feed_enter(&feed, 1);
+    if (s != NULL) {
+      unsigned int count = 0;
+      for (unsigned int b = 0; b < feed.bcount; b++) {
+        const struct board* board = s->boards[b];
+        if (board == NULL) continue;
+        count++;
+        if (board->count > BOARD_SIZE) fail("board with too many entries", b);
+        for (unsigned int k = 1; k < board->count && k < BOARD_SIZE; k++) {
+          if (board->entries[k].score > board->entries[k - 1].score) fail("board out of order", b);
+        }
+      }
+      if (count != s->count) fail("snapshot count doesn't match its boards", s->version);
+      (*walked)++;
+    }
+    feed_leave(&feed, 1);
+  }
+}
+
+int main(int argc, char** argv) {
+  unsigned int downloads = DOWNLOADS;
+  unsigned int window    = WINDOW;
+  const char* host       = NULL;
+  const char* nprofile   = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)      downloads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) host      = argv[++i];
+    else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) nprofile  = argv[++i];
+    else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) window    = atoi(argv[++i]);
+    else {
+      usage();
+      return 1;
+    }
+  }
+  if (downloads == 0 || (host != NULL) != (nprofile != NULL)) {
+    usage();
+    return 1;
+  }
+
+  /* Without a config file, so no player is left out */
+  initialize();
+  memset(&config, 0, sizeof(config));
+  env_init(&env, &config);
+  if (nprofile != NULL) { // Level IDs for the URLs
+    struct mapping savefile;
+    if (savefile_open(&savefile, nprofile) != FILESIZE) {
+      fprintf(stderr, "Error reading nprofile %s\n", nprofile);
+      return 1;
+    }
+    parse_tabs(savefile.data, &env);
+    savefile_close(&savefile);
+  }
+  feed_init(&feed, env.bcount);
+  struct reader reader;
+  reader_init(&reader, 0, env.bcount);
+  struct stats stats = {};
+  unsigned int* perm = (unsigned int*) malloc(env.bcount * sizeof(unsigned int));
+  struct row* rows = NULL;
+  unsigned int capacity = 0;
+  struct view view = {};
+  static const struct sort_key specs[][2] = { // Two columns, as shift-clicked in the table
+    { { SCORE, true },     { ID, false } },
+    { { RANK, false },     { GOLD, true } },
+    { { ATTEMPTS, false }, { VICTORIES, true } },
+  };
+
+  unsigned long walked = 0;
+  std::thread writer([&]() {
+    log_thread("download");
+    if (host != NULL) real_downloads(downloads, host, window);
+    else made_up_downloads(downloads);
+    __atomic_store_n(&writing, false, __ATOMIC_RELEASE);
+  });
+  std::thread checker(check_snapshots, &walked);
+
+  /* The UI: apply whatever is new, then work on it */
+  unsigned long syncs = 0, sorts = 0;
+  bool types[3] = { true, true, true }, tabs[6] = { true, true, true, true, true, true };
+  bool modes[4] = { true, true, true, true }, states[3] = { true, true, true };
+  while (true) {
+    bool done = !__atomic_load_n(&writing, __ATOMIC_ACQUIRE); // Then this sync gets the last snapshot
+    if (!feed_sync(&feed, &reader, &env)) {
+      if (done) break;
+      continue;
+    }
+    syncs++;
+    if (env.lcount > feed.bcount) fail("more leaderboards than blocks", env.lcount);
+    stats_update(&stats, &env);
+    if (stats.pcount > capacity) { // A row per player at most
+      capacity = stats.pcount;
+      rows = (struct row*) realloc(rows, capacity * sizeof(struct row));
+    }
+    stats_ranking(&stats, &env, TOPS, stats_mask(&env, types, tabs), 20, true, rows);
+    sort_blocks(&env.store, env.bcount, specs[sorts % 3], 2, perm);
+    view.dirty = true; // The order changed
+    view_update(&view, &env, perm, tabs, types, modes, states);
+    if (view.count > env.bcount) fail("more rows than blocks", view.count);
+    for (unsigned int r = 0; r < view.count; r++) {
+      if (view.rows[r] >= env.bcount) fail("row out of the blocks", view.rows[r]);
+    }
+    sorts++;
+  }
+  writer.join();
+  checker.join();
+
+  unsigned int obcount = 0;
+  for (int t = 0; t < env.tcount; t++) if (env.tabs[t].online) obcount += env.tabs[t].size;
+  if (!reader.complete || env.lcount != obcount) fail("last download not fully applied", env.lcount);
+  printf("%u downloads of %u leaderboards: %lu syncs and sorts, %lu snapshots walked, %u failures\n",
+    downloads, obcount, syncs, walked, failures);
+
+  free(rows);
+  free(perm);
+  view_free(&view);
+  stats_free(&stats);
+  reader_free(&reader);
+  feed_free(&feed);
+  env_free(&env);
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""
+Stub of the N++ server, to download from with faults injected.
+
+Answers get_scores requests with a made up leaderboard of 20 decreasing
+scores, the same for the same ID every time, after making them wait like a
+server would:
+  - Requests are served --capacity at a time, each taking --service seconds.
+    Beyond that, --queue more wait their turn, and any others get a 502.
+  - --fail of them get a 502 anyway, and --bad a body cut short.
+  - Every --period seconds, a storm of 502s lasts --storm seconds.
+  - The --inactive'th request is answered -1337, as for an inactive Steam ID.
+
+GET /count gives the requests served, /peak the most in the system at once,
+and /reset zeroes both, e.g., to measure one download after another.
+
+  python3 src/stub.py --port 8000 --fail 0.05 &
+  bin/nprofiler-cli download -h http://127.0.0.1:8000 -n nprofile
+"""
+
+import argparse
+import http.server
+import json
+import random
+import socketserver
+import threading
+import time
+
+parser = argparse.ArgumentParser(description="Fault-injecting stub of the N++ server")
+parser.add_argument("--port",     type=int,   default=8000, help="port to listen to on 127.0.0.1")
+parser.add_argument("--service",  type=float, default=0.05, help="seconds each request takes")
+parser.add_argument("--capacity", type=int,   default=8,    help="requests served at once")
+parser.add_argument("--queue",    type=int,   default=100,  help="requests waiting beyond which it's a 502")
+parser.add_argument("--fail",     type=float, default=0.0,  help="rate of random 502s")
+parser.add_argument("--bad",      type=float, default=0.0,  help="rate of bodies cut short")
+parser.add_argument("--period",   type=float, default=0.0,  help="seconds between storms of 502s, none if 0")
+parser.add_argument("--storm",    type=float, default=0.0,  help="seconds a storm lasts")
+parser.add_argument("--inactive", type=int,   default=0,    help="request answered -1337, none if 0")
+parser.add_argument("--seed",     type=int,   default=None, help="seed of the injected faults")
+args = parser.parse_args()
+
+random.seed(args.seed)
+start   = time.time()
+lock    = threading.Lock()
+served  = threading.Semaphore(args.capacity)
+count   = 0  # Requests
+present = 0  # Requests being served or waiting
+peak    = 0
+
+
+def board(id):
+  scores = [{
+    "score":     100000 - 10 * i - id % 7,
+    "rank":      i,
+    "user_id":   1000 + (7 * i + id) % 5000,
+    "user_name": "P%d" % ((7 * i + id) % 5000),
+    "replay_id": 100 * id + i,
+  } for i in range(20)]
+  info = {"my_score": 99000, "my_rank": 3, "my_replay_id": 5, "my_display_name": "P3"}
+  return json.dumps({"userInfo": info, "scores": scores, "query_type": "global"}).encode()
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+  protocol_version = "HTTP/1.1" # Keep connections alive, as the server does
+
+  def log_message(self, *_):
+    pass
+
+  def reply(self, status, body):
+    self.send_response(status)
+    self.send_header("Content-Type", "application/json")
+    self.send_header("Content-Length", str(len(body)))
+    self.end_headers()
+    self.wfile.write(body)
+
+  def do_GET(self):
+    global count, present, peak
+    if self.path == "/count": return self.reply(200, str(count).encode())
+    if self.path == "/peak":  return self.reply(200, str(peak).encode())
+    if self.path == "/reset":
+      with lock: count = peak = 0
+      return self.reply(200, b"0")
+    if "get_scores" not in self.path or "_id=" not in self.path:
+      return self.reply(404, b"not found")
+
+    with lock:
+      count += 1
+      n = count
+      present += 1
+      peak = max(peak, present)
+      over = present > args.capacity + args.queue
+    try:
+      if n == args.inactive:
+        return self.reply(200, b"-1337")
+      if over: # Turned away, quicker than being served
+        time.sleep(args.service / 4)
+        return self.reply(502, b"bad gateway")
+      with served:
+        time.sleep(args.service)
+      storming = args.period > 0 and (time.time() - start) % args.period < args.storm
+      if storming or random.random() < args.fail:
+        return self.reply(502, b"bad gateway")
+      body = board(int(self.path.rsplit("_id=", 1)[1].split("&")[0]))
+      if random.random() < args.bad:
+        body = body[:random.randrange(1, len(body))]
+      self.reply(200, body)
+    finally:
+      with lock: present -= 1
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+  daemon_threads     = True
+  request_queue_size = 128
+
+
+print("Stub server on http://127.0.0.1:%d" % args.port, flush=True)
+Server(("127.0.0.1", args.port), Handler).serve_forever()
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "nprofilerlib.h"
+
+/**
+ * Main table view.
+ *
+ * The table only draws the visible rows, so all the per-frame work left is
+ * filtering the blocks and adding up the footer. Both are cached here and
+ * redone when the view is marked dirty (a filter or the order changed) or
+ * when the scores change, which is tracked with the env revision. Rows are
+ * indices into the blocks and their columns in the store, which never move.
+ */
+
+/* Refilter the blocks, in the given order if any, if needed, returns whether it did */
+bool view_update(struct view* view, struct env* env, const unsigned int* order, const bool tabs[6], const bool types[3], const bool modes[4], const bool states[3]) {
+  if (view->rows != NULL && !view->dirty && view->revision == env->revision) return false;
+  unsigned int count = env->bcount;
+  if (view->rows == NULL) view->rows = (unsigned int*) calloc(count, sizeof(unsigned int));
+  view->dirty    = false;
+  view->revision = env->revision;
+  view->count    = 0;
+  view->scored   = 0;
+  view->ranked   = 0;
+  view->atts     = 0;
+  view->vics     = 0;
+  view->gold     = 0;
+  view->rank     = 0;
+  view->score    = 0;
+
+  /* Filter on the byte columns, then add up the rows that pass */
+  const struct store* st = &env->store;
+  for (unsigned int r = 0; r < count; r++) {
+    unsigned int i = order != NULL ? order[r] : r;
+    if (!(types[st->type[i]] && modes[st->mode[i]] && tabs[st->tab[i]] && st->state[i] < 3 && states[st->state[i]])) continue;
+    view->rows[view->count++] = i;
+  }
+  for (unsigned int r = 0; r < view->count; r++) {
+    unsigned int i = view->rows[r];
+    view->atts += st->attempts[i];
+    view->vics += st->victories[i] + st->victories_ep[i];
+    view->gold += st->gold[i];
+    if (st->score[i] < 1000 * MAX_SCORE) {
+      view->scored++;
+      view->score += st->score[i];
+    }
+    if (st->rank[i] != (uint32_t) -1) {
+      view->ranked++;
+      view->rank += st->rank[i];
+    }
+  }
+  return true;
+}
+
+void view_free(struct view* view) {
+  free(view->rows);
+  view->rows  = NULL;
+  view->count = 0;
+}
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <limits.h>
+#endif
+
+#include "nprofilerlib.h"
+
+/**
+ * Savefile watcher.
+ *
+ * The game rewrites the savefile while it's played, and we pick that up
+ * without reading the whole thing again. On Linux, inotify tells us when the
+ * file is written, through a watch on its directory so replacing it works
+ * too. Elsewhere, or if inotify isn't available, its modification time and
+ * size are polled instead.
+ *
+ * Once the writer closes the file, or it hasn't been written for
+ * WATCH_SETTLE, it's mapped again. The block records are compared with a
+ * copy of them as last decoded, and only the ones that differ are decoded
+ * into the store, and only their counters: a download may be reading the
+ * IDs meanwhile, and the replays may be downloaded ones. A save never
+ * changes an ID, so one that does is reported for a full reload instead.
+ * Each update records which blocks changed and which sort orders they
+ * affect, so the UI only redoes what depends on those. The leaderboards and
+ * stats don't come from the savefile, so they're left alone. Each update is
+ * also timestamped from the save to the screen.
+ */
+
+/* Wall clock microseconds, comparable to the modification time of the file */
+static uint64_t wall_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t mtime_us(const struct stat* st) {
+#ifdef __linux__
+  return (uint64_t) st->st_mtim.tv_sec * 1000000 + st->st_mtim.tv_nsec / 1000;
+#else
+  return (uint64_t) st->st_mtime * 1000000;
+#endif
+}
+
+/* Copy the records of a mapped savefile, and decode them all */
+static void snapshot(struct watcher* watcher, struct env* env, const unsigned char* f) {
+  for (unsigned int i = 0; i < BLOCK_COUNT; i++) {
+    memcpy(watcher->records + (size_t) i * BLOCK_SIZE, f + catalogue.items[i].offset, BLOCK_SIZE);
+  }
+  parse_tabs(f, env);
+}
+
+/**
+ * Start watching a savefile, which must be the one the blocks of env come
+ * from. Its records are decoded again, so they're the ones we diff against.
+ */
+int watch_open(struct watcher* watcher, struct env* env, const char* filename) {
+  memset(watcher, 0, sizeof(struct watcher));
+  watcher->filename = filename;
+  watcher->fd       = -1;
+  if (env->bcount != BLOCK_COUNT) return 1;
+
+  struct mapping map;
+  if (map_open(&map, filename) != FILESIZE) {
+    seterr("Error reading savefile");
+    map_close(&map);
+    return 1;
+  }
+  watcher->records = (unsigned char*) malloc((size_t) BLOCK_COUNT * BLOCK_SIZE);
+  watcher->changed = (unsigned int*) malloc(BLOCK_COUNT * sizeof(unsigned int));
+  snapshot(watcher, env, map.data);
+  map_close(&map);
+
+  struct stat st;
+  if (stat(filename, &st) == 0) {
+    watcher->mtime = mtime_us(&st);
+    watcher->size  = st.st_size;
+  }
+
+#ifdef __linux__
+  /* Watch the directory, since the file may be replaced rather than written */
+  const char* slash = strrchr(filename, '/');
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%.*s", slash != NULL ? (int) (slash - filename) : 1, slash != NULL ? filename : ".");
+  watcher->name = slash != NULL ? slash + 1 : filename;
+  watcher->fd   = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watcher->fd >= 0 && inotify_add_watch(watcher->fd, dir[0] != '\0' ? dir : "/", IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+    close(watcher->fd);
+    watcher->fd = -1;
+  }
+  if (watcher->fd < 0) putlog("Can't watch the savefile, polling it instead");
+#endif
+  return 0;
+}
+
+/* Take note of the writes to the savefile since the last call */
+static void notice(struct watcher* watcher, uint64_t now) {
+  bool written = false;
+#ifdef __linux__
+  if (watcher->fd >= 0) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(watcher->fd, buf, sizeof(buf))) > 0) {
+      for (char* p = buf; p < buf + len; ) {
+        const struct inotify_event* event = (const struct inotify_event*) p;
+        p += sizeof(struct inotify_event) + event->len;
+        if (event->len == 0 || strcmp(event->name, watcher->name) != 0) continue;
+        written = true;
+        if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) watcher->closed = true;
+      }
+    }
+  } else
+#endif
+  {
+    struct stat st;
+    if (stat(watcher->filename, &st) == 0 && (mtime_us(&st) != watcher->mtime || (size_t) st.st_size != watcher->size)) {
+      watcher->mtime = mtime_us(&st);
+      watcher->size  = st.st_size;
+      written = true;
+    }
+  }
+  if (!written) return;
+  if (!watcher->pending) watcher->noticed = wall_us();
+  watcher->pending = true;
+  watcher->written = now;
+}
+
+/* Which sort orders, as 1 << enum orders, a change of record affects */
+static unsigned int affected(const struct record* a, const struct record* b) {
+  unsigned int orders = 0;
+  if (a->attempts != b->attempts) orders |= 1u << ATTEMPTS;
+  if (a->gold != b->gold)         orders |= 1u << GOLD;
+  if (a->victories != b->victories || a->victories_ep != b->victories_ep) orders |= 1u << VICTORIES;
+  return orders;
+}
+
+/* Whether any block has another ID than when last decoded, which a save never changes */
+static bool ids_changed(const struct watcher* watcher, const unsigned char* f) {
+  for (unsigned int i = 0; i < BLOCK_COUNT; i++) {
+    const unsigned char* fresh = f + catalogue.items[i].offset + offsetof(struct record, id);
+    const unsigned char* old   = watcher->records + (size_t) i * BLOCK_SIZE + offsetof(struct record, id);
+    if (memcmp(fresh, old, sizeof(uint32_t)) != 0) return true;
+  }
+  return false;
+}
+
+/* Decode the counters of the records that changed since the last update, in runs within a tab */
+static int update(struct watcher* watcher, struct env* env) {
+  struct mapping map;
+  if (map_open(&map, watcher->filename) != FILESIZE) { // Caught mid-write, the end of it will be noticed
+    map_close(&map);
+    return 0;
+  }
+  if (ids_changed(watcher, map.data)) { // Corrupt, or another savefile altogether
+    map_close(&map);
+    log_write(LOG_WARN, "Savefile changed block IDs, it has to be loaded again.");
+    return -1;
+  }
+  struct stat st;
+  watcher->saved   = stat(watcher->filename, &st) == 0 ? mtime_us(&st) : watcher->noticed;
+  watcher->count   = 0;
+  watcher->orders  = 0;
+  watcher->states  = false;
+  watcher->shown   = 0;
+
+  unsigned int start = 0, run = 0;
+  for (unsigned int i = 0; i <= BLOCK_COUNT; i++) {
+    bool changed = false;
+    if (i < BLOCK_COUNT) {
+      const unsigned char* fresh = map.data + catalogue.items[i].offset;
+      unsigned char* old = watcher->records + (size_t) i * BLOCK_SIZE;
+      if (memcmp(fresh, old, BLOCK_SIZE) != 0) {
+        struct record a, b;
+        memcpy(&a, old, BLOCK_SIZE);
+        memcpy(&b, fresh, BLOCK_SIZE);
+        watcher->orders |= affected(&a, &b);
+        watcher->states |= a.state != b.state;
+        watcher->changed[watcher->count++] = i;
+        memcpy(old, fresh, BLOCK_SIZE);
+        changed = true;
+      }
+    }
+    if (run > 0 && (!changed || i == BLOCK_COUNT || catalogue.items[i].tab != catalogue.items[start].tab)) {
+      decode_counters((const struct record*) (map.data + catalogue.items[start].offset), run, &env->store, start);
+      run = 0;
+    }
+    if (changed && run++ == 0) start = i;
+  }
+  map_close(&map);
+  watcher->applied = wall_us();
+  return watcher->count;
+}
+
+/**
+ * Apply the game's latest save if it's done writing it. Never blocks, so it
+ * can be called every frame. Returns how many blocks changed, whose indices
+ * are in watcher->changed, 0 if nothing did, or -1 if it can't be applied
+ * and the savefile must be loaded again, e.g., with watch_open().
+ */
+int watch_poll(struct watcher* watcher, struct env* env) {
+  if (watcher->records == NULL) return 0;
+  uint64_t now = now_ms();
+  notice(watcher, now);
+  if (!watcher->pending || (!watcher->closed && now - watcher->written < WATCH_SETTLE)) return 0;
+  watcher->pending = false;
+  watcher->closed  = false;
+  return update(watcher, env);
+}
+
+/* Mark the last update as on screen, closing its latency measure */
+void watch_shown(struct watcher* watcher) {
+  watcher->shown = wall_us();
+}
+
+void watch_close(struct watcher* watcher) {
+#ifdef __linux__
+  if (watcher->fd >= 0) close(watcher->fd);
+#endif
+  free(watcher->records);
+  free(watcher->changed);
+  memset(watcher, 0, sizeof(struct watcher));
+  watcher->fd = -1;
+}